@@ -0,0 +1,377 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "sessionmanager.h"
+#include "tcpsession.h"
+#include "prefixtable.h"
+#include "aggregate.h"
+
+/*
+ * A place in the table. A place is empty when valid is 0.
+ */
+struct aggregate_slot_t {
+	struct aggregate_entry_t entry;
+	uint8_t valid;
+};
+
+struct aggregate_t {
+	struct aggregate_slot_t *slots;
+
+	/* The number of sets of AGGREGATE_WAYS places */
+	unsigned int sets;
+
+	/* The prefix length and its mask in network byte order */
+	int length;
+	uint32_t mask;
+
+	/* The totals of evicted prefixes */
+	struct aggregate_entry_t other;
+
+	unsigned int count;
+	uint64_t evicted;
+
+	prefix_table_t *filter;
+
+	/* Where the counters and RTT samples are read from, module -1 if not */
+	int counter_module[AGGREGATE_COUNTERS];
+	aggregate_counter_t counter_read[AGGREGATE_COUNTERS];
+	int rtt_module;
+	aggregate_sample_t rtt_sample;
+
+	/* The periodic snapshot, with period_end 0 until the first packet */
+	uint64_t period;
+	uint64_t period_end;
+	aggregate_period_callback_t period_callback;
+	void *period_arg;
+};
+
+/*
+ * Clears an entry for the given prefix.
+ */
+void aggregate_entry_clear (struct aggregate_entry_t *entry, uint32_t prefix, int length);
+
+/*
+ * Adds the totals of one entry to another.
+ */
+void aggregate_entry_merge (struct aggregate_entry_t *into, const struct aggregate_entry_t *from);
+
+/*
+ * Returns the entry for the prefix of an address, adding it and evicting
+ * another if needed, or NULL if the address is filtered out.
+ */
+struct aggregate_entry_t *aggregate_lookup (aggregate_t * aggregate, uint32_t address, uint64_t time);
+
+/*
+ * Creates a table with room for capacity prefixes, which is rounded up to
+ * a multiple of AGGREGATE_WAYS, keyed on the given prefix length. Returns
+ * NULL if the length is more than 32.
+ */
+aggregate_t *aggregate_create (unsigned int capacity, int length) {
+	aggregate_t *aggregate;
+	int i;
+
+	if (length < 0 || length > 32) {
+		fprintf (stderr, "aggregate: Prefix length out of range\n");
+		return NULL;
+	}
+	if (capacity < AGGREGATE_WAYS)
+		capacity = AGGREGATE_WAYS;
+
+	aggregate = malloc (sizeof (aggregate_t));
+	aggregate->sets = (capacity + AGGREGATE_WAYS - 1) / AGGREGATE_WAYS;
+	aggregate->slots = calloc (aggregate->sets * AGGREGATE_WAYS, sizeof (struct aggregate_slot_t));
+	aggregate->length = length;
+	aggregate->mask = (length == 0) ? 0 : htonl (0xffffffffu << (32 - length));
+	aggregate->filter = NULL;
+	for (i = 0; i < AGGREGATE_COUNTERS; i++) {
+		aggregate->counter_module[i] = -1;
+		aggregate->counter_read[i] = NULL;
+	}
+	aggregate->rtt_module = -1;
+	aggregate->rtt_sample = NULL;
+	aggregate->period = 0;
+	aggregate->period_end = 0;
+	aggregate->period_callback = NULL;
+	aggregate->period_arg = NULL;
+	aggregate_reset (aggregate);
+	return aggregate;
+}
+
+/*
+ * Frees a table. It must have been taken off any session manager.
+ */
+void aggregate_destroy (aggregate_t * aggregate) {
+	free (aggregate->slots);
+	free (aggregate);
+}
+
+/*
+ * Only aggregates the prefixes of addresses with a value greater than 0 in
+ * the given table. The table is not copied or freed. NULL removes this.
+ */
+void aggregate_set_filter (aggregate_t * aggregate, prefix_table_t * filter) {
+	aggregate->filter = filter;
+}
+
+/*
+ * Sums a counter, e.g. AGGREGATE_BYTES with bwest_total, read from the
+ * data of the module with the given id as each session ends.
+ */
+void aggregate_set_counter (aggregate_t * aggregate, int counter, int module, aggregate_counter_t read) {
+	if (counter < 0 || counter >= AGGREGATE_COUNTERS) {
+		fprintf (stderr, "aggregate: Counter out of range\n");
+		return;
+	}
+	aggregate->counter_module[counter] = module;
+	aggregate->counter_read[counter] = read;
+}
+
+/*
+ * Takes RTT samples, e.g. with rtt_n_sequence_last_sample, from the data
+ * of the module with the given id, each time the module produces one.
+ */
+void aggregate_set_rtt (aggregate_t * aggregate, int module, aggregate_sample_t sample) {
+	aggregate->rtt_module = module;
+	aggregate->rtt_sample = sample;
+}
+
+/*
+ * Calls the callback, then resets the table, each time a period of the
+ * given length in seconds of trace time has passed. A length of 0 turns
+ * this off.
+ */
+void aggregate_set_period (aggregate_t * aggregate, double length, aggregate_period_callback_t callback, void *arg) {
+	if (length < 0.0) {
+		fprintf (stderr, "aggregate: Period out of range\n");
+		length = 0.0;
+	}
+	aggregate->period = TCP_SEC_TO_NSEC (length);
+	aggregate->period_end = 0;
+	aggregate->period_callback = callback;
+	aggregate->period_arg = arg;
+}
+
+/*
+ * Clears an entry for the given prefix.
+ */
+void aggregate_entry_clear (struct aggregate_entry_t *entry, uint32_t prefix, int length) {
+	memset (entry, 0, sizeof (struct aggregate_entry_t));
+	entry->prefix = prefix;
+	entry->length = length;
+	entry->rtt_min = -1.0;
+}
+
+/*
+ * Adds the totals of one entry to another.
+ */
+void aggregate_entry_merge (struct aggregate_entry_t *into, const struct aggregate_entry_t *from) {
+	int i;
+
+	into->flows += from->flows;
+	for (i = 0; i < AGGREGATE_COUNTERS; i++)
+		into->counters[i] += from->counters[i];
+	into->rtt_samples += from->rtt_samples;
+	into->rtt_sum += from->rtt_sum;
+	if (from->rtt_min >= 0.0 && (into->rtt_min < 0.0 || from->rtt_min < into->rtt_min))
+		into->rtt_min = from->rtt_min;
+	if (from->last_update > into->last_update)
+		into->last_update = from->last_update;
+}
+
+/*
+ * Returns the entry for the prefix of an address, adding it and evicting
+ * another if needed, or NULL if the address is filtered out.
+ */
+struct aggregate_entry_t *aggregate_lookup (aggregate_t * aggregate, uint32_t address, uint64_t time) {
+	uint32_t prefix = address & aggregate->mask;
+	struct aggregate_slot_t *set, *victim = NULL;
+	int i;
+
+	if (aggregate->filter != NULL && prefix_table_lookup_v4 (aggregate->filter, address) <= 0)
+		return NULL;
+
+	set = &(aggregate->slots[(((uint64_t) prefix * 0x9e3779b97f4a7c15ULL) >> 32) % aggregate->sets * AGGREGATE_WAYS]);
+	for (i = 0; i < AGGREGATE_WAYS; i++) {
+		if (set[i].valid && set[i].entry.prefix == prefix) {
+			if (time > set[i].entry.last_update)
+				set[i].entry.last_update = time;
+			return &(set[i].entry);
+		}
+		if (!set[i].valid) {
+			if (victim == NULL || victim->valid)
+				victim = &(set[i]);
+		} else if (victim == NULL || (victim->valid && set[i].entry.last_update < victim->entry.last_update)) {
+			victim = &(set[i]);
+		}
+	}
+
+	if (victim->valid) {
+		aggregate_entry_merge (&(aggregate->other), &(victim->entry));
+		aggregate->evicted++;
+	} else {
+		aggregate->count++;
+	}
+	victim->valid = 1;
+	aggregate_entry_clear (&(victim->entry), prefix, aggregate->length);
+	victim->entry.last_update = time;
+	return &(victim->entry);
+}
+
+/*
+ * Adds the RTT sample, if any, taken with the last packet of a session.
+ * The time is that of the packet, in nanoseconds, and updated has a bit
+ * set for each of the first SM_MASK_MODULES modules that was given the
+ * packet. A module that was not given it has no new sample.
+ */
+void aggregate_update_session (aggregate_t * aggregate, tcp_session_t * session, uint64_t time, uint32_t updated) {
+	struct aggregate_entry_t *entry;
+	double rtt;
+	int i;
+
+	if (aggregate->period > 0) {
+		if (aggregate->period_end == 0)
+			aggregate->period_end = time + aggregate->period;
+		while (time >= aggregate->period_end) {
+			if (aggregate->period_callback != NULL)
+				aggregate->period_callback (aggregate, aggregate->period_arg);
+			aggregate_reset (aggregate);
+			aggregate->period_end += aggregate->period;
+		}
+	}
+
+	/* The module still holds the sample of an earlier packet if it was
+	 * not given this one, and that sample has been added already.
+	 */
+	if (aggregate->rtt_sample == NULL)
+		return;
+	if (aggregate->rtt_module < SM_MASK_MODULES && !(updated & (1u << aggregate->rtt_module)))
+		return;
+	rtt = aggregate->rtt_sample (session->data[aggregate->rtt_module]);
+	if (rtt < 0.0)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		entry = aggregate_lookup (aggregate, (i == 0) ? session->id.ip_a : session->id.ip_b, time);
+		if (entry == NULL)
+			continue;
+		entry->rtt_samples++;
+		entry->rtt_sum += rtt;
+		if (entry->rtt_min < 0.0 || rtt < entry->rtt_min)
+			entry->rtt_min = rtt;
+	}
+}
+
+/*
+ * Adds the counters of a session that has ended.
+ */
+void aggregate_end_session (aggregate_t * aggregate, tcp_session_t * session) {
+	struct aggregate_entry_t *entry;
+	uint64_t counters[AGGREGATE_COUNTERS];
+	int i, j;
+
+	for (j = 0; j < AGGREGATE_COUNTERS; j++) {
+		if (aggregate->counter_read[j] != NULL)
+			counters[j] = aggregate->counter_read[j] (session->data[aggregate->counter_module[j]]);
+		else
+			counters[j] = 0;
+	}
+
+	for (i = 0; i < 2; i++) {
+		entry = aggregate_lookup (aggregate, (i == 0) ? session->id.ip_a : session->id.ip_b, session->end_time);
+		if (entry == NULL)
+			continue;
+		entry->flows++;
+		for (j = 0; j < AGGREGATE_COUNTERS; j++)
+			entry->counters[j] += counters[j];
+	}
+}
+
+/*
+ * Copies up to max entries of the table into entries, followed by the
+ * overflow entry if anything has been evicted, and returns how many were
+ * copied.
+ */
+int aggregate_snapshot (aggregate_t * aggregate, struct aggregate_entry_t *entries, int max) {
+	unsigned int i;
+	int count = 0;
+
+	for (i = 0; i < aggregate->sets * AGGREGATE_WAYS && count < max; i++) {
+		if (aggregate->slots[i].valid)
+			entries[count++] = aggregate->slots[i].entry;
+	}
+	if (aggregate->evicted > 0 && count < max)
+		entries[count++] = aggregate->other;
+	return count;
+}
+
+/*
+ * Returns the number of prefixes in the table, not counting the overflow
+ * entry.
+ */
+unsigned int aggregate_count (aggregate_t * aggregate) {
+	return aggregate->count;
+}
+
+/*
+ * Returns the number of prefixes evicted since the table was reset.
+ */
+uint64_t aggregate_evicted (aggregate_t * aggregate) {
+	return aggregate->evicted;
+}
+
+/*
+ * Empties the table.
+ */
+void aggregate_reset (aggregate_t * aggregate) {
+	unsigned int i;
+
+	for (i = 0; i < aggregate->sets * AGGREGATE_WAYS; i++)
+		aggregate->slots[i].valid = 0;
+	aggregate_entry_clear (&(aggregate->other), 0, 0);
+	aggregate->other.other = 1;
+	aggregate->count = 0;
+	aggregate->evicted = 0;
+}
+
+/*
+ * Returns the mean RTT of an entry in seconds, or -1.0 if it has none.
+ */
+double aggregate_mean_rtt (const struct aggregate_entry_t *entry) {
+	if (entry->rtt_samples == 0)
+		return -1.0;
+	return entry->rtt_sum / entry->rtt_samples;
+}
@@ -0,0 +1,191 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <inttypes.h>
+#include "sessionmanager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An aggregate table sums the results of flows per host or per subnet, so
+ * that reports by server or by /24 need not be rebuilt from per-flow
+ * output. Each endpoint address of a flow is cut to the table's prefix
+ * length, e.g. 32 for hosts or 24 for subnets, and the flow is counted
+ * against both prefixes. A prefix table can limit this to the prefixes of
+ * interest, e.g. the servers being monitored. Use one table per prefix
+ * length.
+ *
+ * Tables hold a fixed number of prefixes in sets of AGGREGATE_WAYS. When a
+ * set is full, the prefix updated longest ago is evicted and its totals are
+ * added to a single overflow entry, so the long tail is still counted.
+ *
+ * A table is fed by the session manager it is given to: each RTT sample is
+ * added as it is taken and the counters are added as each session ends.
+ * It must be used from the manager's thread only.
+ */
+typedef struct aggregate_t aggregate_t;
+
+#define AGGREGATE_WAYS 4
+
+/*
+ * The counters summed at the end of each flow.
+ */
+enum {
+	AGGREGATE_BYTES,
+	AGGREGATE_DATA_PACKETS,
+	AGGREGATE_RETRANSMISSIONS,
+	AGGREGATE_COUNTERS
+};
+
+/*
+ * Returns a counter of a session from its data for a module.
+ */
+typedef uint64_t (*aggregate_counter_t) (void *data);
+
+/*
+ * Returns the RTT sample, in seconds, taken by a module with the packet it
+ * was last updated with, or a negative value if that packet gave none. A
+ * sample must not be returned again for later packets, as
+ * rtt_n_sequence_last_sample() does not.
+ */
+typedef double (*aggregate_sample_t) (void *data);
+
+/*
+ * The totals of one prefix. The overflow entry has other set and holds
+ * the totals of every prefix that has been evicted.
+ */
+struct aggregate_entry_t {
+	uint32_t prefix;		/* network byte order */
+	uint8_t length;
+	uint8_t other;
+	uint64_t flows;
+	uint64_t counters[AGGREGATE_COUNTERS];
+	uint64_t rtt_samples;
+	double rtt_sum;			/* seconds */
+	double rtt_min;			/* seconds, -1.0 if no samples */
+	uint64_t last_update;	/* nanoseconds */
+};
+
+/*
+ * Called with the table at the end of each period, just before it is
+ * reset.
+ */
+typedef void (*aggregate_period_callback_t) (aggregate_t * aggregate, void *arg);
+
+/*
+ * Creates a table with room for capacity prefixes, which is rounded up to
+ * a multiple of AGGREGATE_WAYS, keyed on the given prefix length. Returns
+ * NULL if the length is more than 32.
+ */
+aggregate_t *aggregate_create (unsigned int capacity, int length);
+
+/*
+ * Frees a table. It must have been taken off any session manager.
+ */
+void aggregate_destroy (aggregate_t * aggregate);
+
+/*
+ * Only aggregates the prefixes of addresses with a value greater than 0 in
+ * the given table. The table is not copied or freed. NULL removes this.
+ */
+void aggregate_set_filter (aggregate_t * aggregate, prefix_table_t * filter);
+
+/*
+ * Sums a counter, e.g. AGGREGATE_BYTES with bwest_total, read from the
+ * data of the module with the given id as each session ends.
+ */
+void aggregate_set_counter (aggregate_t * aggregate, int counter, int module, aggregate_counter_t read);
+
+/*
+ * Takes RTT samples, e.g. with rtt_n_sequence_last_sample, from the data
+ * of the module with the given id, each time the module produces one.
+ */
+void aggregate_set_rtt (aggregate_t * aggregate, int module, aggregate_sample_t sample);
+
+/*
+ * Calls the callback, then resets the table, each time a period of the
+ * given length in seconds of trace time has passed. A length of 0 turns
+ * this off.
+ */
+void aggregate_set_period (aggregate_t * aggregate, double length, aggregate_period_callback_t callback, void *arg);
+
+/*
+ * Adds the RTT sample, if any, taken with the last packet of a session.
+ * The time is that of the packet, in nanoseconds, and updated has a bit
+ * set for each of the first SM_MASK_MODULES modules that was given the
+ * packet. A module that was not given it has no new sample.
+ */
+void aggregate_update_session (aggregate_t * aggregate, tcp_session_t * session, uint64_t time, uint32_t updated);
+
+/*
+ * Adds the counters of a session that has ended.
+ */
+void aggregate_end_session (aggregate_t * aggregate, tcp_session_t * session);
+
+/*
+ * Copies up to max entries of the table into entries, followed by the
+ * overflow entry if anything has been evicted, and returns how many were
+ * copied.
+ */
+int aggregate_snapshot (aggregate_t * aggregate, struct aggregate_entry_t *entries, int max);
+
+/*
+ * Returns the number of prefixes in the table, not counting the overflow
+ * entry.
+ */
+unsigned int aggregate_count (aggregate_t * aggregate);
+
+/*
+ * Returns the number of prefixes evicted since the table was reset.
+ */
+uint64_t aggregate_evicted (aggregate_t * aggregate);
+
+/*
+ * Empties the table.
+ */
+void aggregate_reset (aggregate_t * aggregate);
+
+/*
+ * Returns the mean RTT of an entry in seconds, or -1.0 if it has none.
+ */
+double aggregate_mean_rtt (const struct aggregate_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*AGGREGATE_H_ */
@@ -39,13 +39,61 @@
 #include <libtrace.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "sessionmanager.h"
+#include "tcpsession.h"
+#include "serialize.h"
+#include "mempool.h"
 #include "bwest.h"
 
+/* The number of intervals in the sliding window of byte counts */
+#define BWEST_RING_LENGTH 10
+
+/* The default length of an interval, in seconds */
+#define BWEST_INTERVAL 1.0
+
+/* The weight given to the old rate when smoothing */
+#define BWEST_SMOOTH 0.875
+
+/* After this many idle intervals the smoothed rate is treated as zero */
+#define BWEST_MAX_DECAY 64
+
+/*
+ * The settings of a bwest module. The length of the intervals over which
+ * rates are measured is kept in seconds for computing rates and in
+ * nanoseconds for finding the interval of a packet.
+ */
+struct bwest_config_t {
+	double interval;
+	uint64_t interval_ns;
+};
+
 /*
- * This struct stores the necessary data for recording the RTT of a handshake.
+ * This struct keeps the rate of one direction. Bytes are counted in a ring
+ * of intervals, where the slot for the current interval is given by the
+ * interval number modulo BWEST_RING_LENGTH.
+ */
+struct bwest_rate_t {
+	/* The bytes acknowledged in each interval of the window */
+	uint64_t ring[BWEST_RING_LENGTH];
+
+	/* The sum of the ring, i.e. the bytes in the whole window */
+	uint64_t window_bytes;
+
+	/* The smoothed rate over completed intervals, in bytes per second */
+	double smoothed;
+
+	/* The highest rate over a single interval and over the whole window */
+	double peak;
+	double window_peak;
+};
+
+/*
+ * This struct stores the necessary data for estimating the bandwidth.
  */
 struct bwest_t {
+	struct bwest_config_t *config;
+
 	uint64_t bytesin;
 	uint64_t bytesout;
 
@@ -53,18 +101,64 @@ struct bwest_t {
 	uint32_t ackout;
 
 	uint8_t established;
+
+	/* The rates for each direction, 0 = incoming, 1 = outgoing */
+	struct bwest_rate_t rate[2];
+
+	/* The number of the current interval, counted from the epoch, and
+	 * whether any packets have been seen yet.
+	 */
+	uint64_t interval;
+	uint8_t started;
+
+	/* Whether any bytes were acknowledged in the current interval */
+	uint8_t active;
+
+	/* The number of completed intervals, and those that had traffic */
+	uint32_t intervals;
+	uint32_t active_intervals;
 };
 
+/*
+ * Moves the rate estimates forward to the interval containing the given
+ * time, completing any intervals that have passed.
+ */
+void bwest_advance (struct bwest_t *record, uint64_t time);
+
+/*
+ * Completes the current interval, of the given length in seconds, of one
+ * direction and starts the next.
+ */
+void bwest_rate_complete (struct bwest_rate_t *rate, double length, uint64_t interval, uint32_t intervals);
+
+/*
+ * Return the highest rate over a single interval for one direction.
+ */
+double bwest_rate_peak (struct bwest_t *record, int dir);
+
+/*
+ * Return the highest rate over the whole window for one direction.
+ */
+double bwest_rate_window_peak (struct bwest_t *record, int dir);
+
 /*
  * Allocates and initialises a new data structure for a new tcp session.
  */
-void *bwest_create () {
-	struct bwest_t *record = malloc (sizeof (struct bwest_t));
+void *bwest_create (void *config) {
+	struct bwest_t *record = mem_alloc (sizeof (struct bwest_t));
+	record->config = (struct bwest_config_t *) config;
 	record->bytesin = 0;
 	record->bytesout = 0;
 	record->ackin=0;
 	record->ackout=0;
 	record->established = 0;
+
+	memset (record->rate, 0, sizeof (record->rate));
+	record->interval = 0;
+	record->started = 0;
+	record->active = 0;
+	record->intervals = 0;
+	record->active_intervals = 0;
 	return record;
 }
 
@@ -72,35 +166,118 @@ void *bwest_create () {
  * Frees the data structure of a closed tcp session.
  */
 void bwest_destroy (void *data) {
-	free (data);
+	mem_free (data);
+}
+
+/*
+ * Completes the current interval, of the given length in seconds, of one
+ * direction and starts the next.
+ */
+void bwest_rate_complete (struct bwest_rate_t *rate, double length, uint64_t interval, uint32_t intervals) {
+	int slot = interval % BWEST_RING_LENGTH;
+	double current = rate->ring[slot] / length;
+
+	rate->smoothed = (BWEST_SMOOTH * rate->smoothed) + ((1 - BWEST_SMOOTH) * current);
+
+	if (current > rate->peak)
+		rate->peak = current;
+
+	/* Only a full window gives a rate over the whole window */
+	if (intervals + 1 >= BWEST_RING_LENGTH) {
+		current = rate->window_bytes / (length * BWEST_RING_LENGTH);
+		if (current > rate->window_peak)
+			rate->window_peak = current;
+	}
+
+	/* Make room for the next interval */
+	slot = (interval + 1) % BWEST_RING_LENGTH;
+	rate->window_bytes -= rate->ring[slot];
+	rate->ring[slot] = 0;
 }
 
 /*
- * Updates the RTT estimates given a new packet belonging to the flow.
+ * Moves the rate estimates forward to the interval containing the given
+ * time, completing any intervals that have passed.
  */
-void bwest_update (void *data, struct libtrace_packet_t *packet) {
+void bwest_advance (struct bwest_t *record, uint64_t time) {
+	uint64_t now = time / record->config->interval_ns;
+	int i, steps = 0;
+
+	if (!record->started) {
+		record->interval = now;
+		record->started = 1;
+		return;
+	}
+
+	/* Complete the passed intervals. Once the whole window has passed,
+	 * the ring is empty and the remaining intervals are all idle.
+	 */
+	while (record->interval < now && steps < BWEST_RING_LENGTH) {
+		for (i = 0; i < 2; i++)
+			bwest_rate_complete (&(record->rate[i]), record->config->interval, record->interval, record->intervals);
+		if (record->active)
+			record->active_intervals++;
+		record->active = 0;
+		record->intervals++;
+		record->interval++;
+		steps++;
+	}
+
+	if (record->interval < now) {
+		uint64_t idle = now - record->interval;
+
+		/* The smoothed rate decays towards zero during idle intervals */
+		for (i = 0; i < 2; i++) {
+			if (idle > BWEST_MAX_DECAY) {
+				record->rate[i].smoothed = 0.0;
+			} else {
+				uint64_t j;
+				for (j = 0; j < idle; j++)
+					record->rate[i].smoothed *= BWEST_SMOOTH;
+			}
+		}
+		record->intervals += idle;
+		record->interval = now;
+	}
+}
+
+/*
+ * Updates the bandwidth estimates given a new packet belonging to the flow.
+ */
+int bwest_update (void *data, const struct session_packet_t *packet) {
 
 	struct bwest_t *record = (struct bwest_t *) data;
-	struct libtrace_tcp *tcp = trace_get_tcp((struct libtrace_packet_t *)packet);
+	const struct libtrace_tcp *tcp = packet->tcp;
 
-	int direction = trace_get_direction(packet);
+	int direction = packet->direction;
 
 	if (direction !=0 && direction != 1)
-		return;
+		return SM_WANT_ALL;
+
+	bwest_advance (record, packet->time);
 
 	if (record->established) {
+		int slot = record->interval % BWEST_RING_LENGTH;
 		if (direction==0) {
 			/* outgoing */
 			uint32_t len=htonl(tcp->ack_seq);
 			len=len-record->ackout;
 			record->bytesin+=len;
 			record->ackout=htonl(tcp->ack_seq);
+			record->rate[0].ring[slot]+=len;
+			record->rate[0].window_bytes+=len;
+			if (len > 0)
+				record->active = 1;
 		} else {
 			/* incoming */
 			uint32_t len=htonl(tcp->ack_seq);
 			len=len-record->ackin;
 			record->bytesout+=len;
 			record->ackin=htonl(tcp->ack_seq);
+			record->rate[1].ring[slot]+=len;
+			record->rate[1].window_bytes+=len;
+			if (len > 0)
+				record->active = 1;
 		}
 	} else if (tcp->syn && tcp->ack) {
 		if (direction==0) {
@@ -115,6 +292,56 @@ void bwest_update (void *data, struct libtrace_packet_t *packet) {
 		record->established=1;
 	}
 
+	return SM_WANT_ALL;
+}
+
+/*
+ * Writes the data of a session into a buffer for a checkpoint.
+ */
+size_t bwest_serialize (void *data, char *buf, size_t len) {
+	struct bwest_t *record = (struct bwest_t *) data;
+	struct serial_t serial;
+
+	serial_writer_init (&serial, buf, len);
+	SERIAL_PUT (&serial, record->bytesin);
+	SERIAL_PUT (&serial, record->bytesout);
+	SERIAL_PUT (&serial, record->ackin);
+	SERIAL_PUT (&serial, record->ackout);
+	SERIAL_PUT (&serial, record->established);
+	SERIAL_PUT (&serial, record->rate);
+	SERIAL_PUT (&serial, record->interval);
+	SERIAL_PUT (&serial, record->started);
+	SERIAL_PUT (&serial, record->active);
+	SERIAL_PUT (&serial, record->intervals);
+	SERIAL_PUT (&serial, record->active_intervals);
+	return serial.pos;
+}
+
+/*
+ * Rebuilds the data of a session from a checkpoint.
+ */
+void *bwest_deserialize (void *config, const char *buf, size_t len) {
+	struct bwest_t *record = bwest_create (config);
+	struct serial_t serial;
+
+	serial_reader_init (&serial, buf, len);
+	SERIAL_GET (&serial, record->bytesin);
+	SERIAL_GET (&serial, record->bytesout);
+	SERIAL_GET (&serial, record->ackin);
+	SERIAL_GET (&serial, record->ackout);
+	SERIAL_GET (&serial, record->established);
+	SERIAL_GET (&serial, record->rate);
+	SERIAL_GET (&serial, record->interval);
+	SERIAL_GET (&serial, record->started);
+	SERIAL_GET (&serial, record->active);
+	SERIAL_GET (&serial, record->intervals);
+	SERIAL_GET (&serial, record->active_intervals);
+
+	if (serial.error) {
+		bwest_destroy (record);
+		return NULL;
+	}
+	return record;
 }
 
 /*
@@ -122,9 +349,18 @@ void bwest_update (void *data, struct libtrace_packet_t *packet) {
  */
 struct session_module_t *bwest_module () {
 	struct session_module_t *module = malloc (sizeof (struct session_module_t));
+	struct bwest_config_t *config = malloc (sizeof (struct bwest_config_t));
+
+	config->interval = BWEST_INTERVAL;
+	config->interval_ns = TCP_SEC_TO_NSEC (BWEST_INTERVAL);
+
+	module->config = config;
 	module->create = &bwest_create;
 	module->destroy = &bwest_destroy;
 	module->update = &bwest_update;
+	module->serialize = &bwest_serialize;
+	module->deserialize = &bwest_deserialize;
+	module->syn = NULL;
 	return module;
 }
 
@@ -151,3 +387,105 @@ uint64_t bwest_total (void *data) {
 	return bwest_incoming(data)+bwest_outgoing(data);
 }
 
+/*
+ * Return the highest rate over a single interval for one direction. The
+ * current interval is included as it is at least as fast as its bytes
+ * so far.
+ */
+double bwest_rate_peak (struct bwest_t *record, int dir) {
+	struct bwest_rate_t *rate = &(record->rate[dir]);
+	double current = rate->ring[record->interval % BWEST_RING_LENGTH] / record->config->interval;
+	return current > rate->peak ? current : rate->peak;
+}
+
+/*
+ * Return the highest rate over the whole window for one direction,
+ * including the window that ends with the current interval.
+ */
+double bwest_rate_window_peak (struct bwest_t *record, int dir) {
+	struct bwest_rate_t *rate = &(record->rate[dir]);
+	double current = rate->window_bytes / (record->config->interval * BWEST_RING_LENGTH);
+	return current > rate->window_peak ? current : rate->window_peak;
+}
+
+/*
+ * Return the smoothed incoming rate in bytes per second
+ */
+double bwest_rate_incoming (void *data) {
+	struct bwest_t *record = (struct bwest_t *) data;
+	return record->rate[0].smoothed;
+}
+
+/*
+ * Return the smoothed outgoing rate in bytes per second
+ */
+double bwest_rate_outgoing (void *data) {
+	struct bwest_t *record = (struct bwest_t *) data;
+	return record->rate[1].smoothed;
+}
+
+/*
+ * Return the peak incoming rate over one interval in bytes per second
+ */
+double bwest_peak_incoming (void *data) {
+	return bwest_rate_peak ((struct bwest_t *) data, 0);
+}
+
+/*
+ * Return the peak outgoing rate over one interval in bytes per second
+ */
+double bwest_peak_outgoing (void *data) {
+	return bwest_rate_peak ((struct bwest_t *) data, 1);
+}
+
+/*
+ * Return the peak incoming rate over the window in bytes per second
+ */
+double bwest_window_peak_incoming (void *data) {
+	return bwest_rate_window_peak ((struct bwest_t *) data, 0);
+}
+
+/*
+ * Return the peak outgoing rate over the window in bytes per second
+ */
+double bwest_window_peak_outgoing (void *data) {
+	return bwest_rate_window_peak ((struct bwest_t *) data, 1);
+}
+
+/*
+ * Return the time, in seconds, of the completed intervals in which
+ * bytes were acknowledged.
+ */
+double bwest_active_time (void *data) {
+	struct bwest_t *record = (struct bwest_t *) data;
+	return record->active_intervals * record->config->interval;
+}
+
+/*
+ * Return the time, in seconds, of the completed intervals in which
+ * nothing was acknowledged.
+ */
+double bwest_idle_time (void *data) {
+	struct bwest_t *record = (struct bwest_t *) data;
+	return (record->intervals - record->active_intervals) * record->config->interval;
+}
+
+/*
+ * Sets the length of an interval in seconds for this module. The default
+ * is 1 second, which makes the window 10 seconds long.
+ */
+void bwest_set_interval (struct session_module_t *module, double interval) {
+	struct bwest_config_t *config = (struct bwest_config_t *) module->config;
+
+	/* The interval must be a whole nanosecond or more, as packet times
+	 * are divided by it.
+	 */
+	if (interval > 0.0 && TCP_SEC_TO_NSEC (interval) >= 1) {
+		config->interval = interval;
+	} else {
+		config->interval = BWEST_INTERVAL;
+		fprintf (stderr, "bwest: Interval out of range\n");
+	}
+	config->interval_ns = TCP_SEC_TO_NSEC (config->interval);
+}
+
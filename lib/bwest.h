@@ -29,16 +29,60 @@
  */
 
 
-#ifndef RTTHANDSHAKE_H_
-#define RTTHANDSHAKE_H_
+#ifndef BWEST_H_
+#define BWEST_H_
 
 /*
  * This returns the session module for use by the session manager.
  */
 struct session_module_t *bwest_module ();
 
+/*
+ * The update function of the module, which a pipeline built with
+ * sessionpipeline.h can call directly.
+ */
+struct session_packet_t;
+int bwest_update (void *data, const struct session_packet_t *packet);
+
 uint64_t bwest_total(void *data);
 uint64_t bwest_incoming(void *data);
 uint64_t bwest_outgoing(void *data);
 
-#endif							
+/*
+ * Rates are measured over intervals of one second by default, and the
+ * bytes of the last 10 intervals are kept in a ring to give the rate over
+ * a 10 second window. All rates are in bytes per second.
+ */
+
+/*
+ * Sets the length of an interval in seconds for a module returned by
+ * bwest_module(). The window is always 10 intervals long.
+ */
+void bwest_set_interval (struct session_module_t *module, double interval);
+
+/*
+ * Return the smoothed rate over the completed intervals.
+ */
+double bwest_rate_incoming (void *data);
+double bwest_rate_outgoing (void *data);
+
+/*
+ * Return the highest rate seen over a single interval.
+ */
+double bwest_peak_incoming (void *data);
+double bwest_peak_outgoing (void *data);
+
+/*
+ * Return the highest rate seen over a whole window.
+ */
+double bwest_window_peak_incoming (void *data);
+double bwest_window_peak_outgoing (void *data);
+
+/*
+ * Return the time, in seconds, of the completed intervals during which
+ * data was or was not acknowledged.
+ */
+double bwest_active_time (void *data);
+double bwest_idle_time (void *data);
+
+#endif							/*BWEST_H_ */
@@ -0,0 +1,584 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <libtrace.h>
+#include "sessionmanager.h"
+#include "tcpsession.h"
+#include "capturepipeline.h"
+
+/* The size of a cache line, which the two ends of a ring are kept apart by */
+#define CAPTURE_CACHE_LINE 64
+
+/* The most descriptors a shard takes off a ring at once */
+#define CAPTURE_PIPELINE_BATCH 64
+
+/* The number of empty passes over its rings after which an idle shard
+ * starts to sleep, and the longest it sleeps between passes, in ns.
+ */
+#define CAPTURE_PIPELINE_SPINS 256
+#define CAPTURE_PIPELINE_SLEEP_MAX 100000
+
+/* The key of the flow hash that chooses the shard */
+#define CAPTURE_PIPELINE_HASH_KEY 0x9e3779b97f4a7c15ULL
+
+/*
+ * A single-producer, single-consumer ring of descriptors. The reader only
+ * writes the first cache line and the shard only the second, and each side
+ * keeps a copy of the other's index so that it seldom reads the other's
+ * line. The indices run freely and are masked to find the slot. The shard
+ * counts the packets it took from the ring on its own line too, so that
+ * shards never write a line that another thread writes.
+ */
+struct capture_ring_t {
+	/* The next slot the reader fills, and the last tail it saw */
+	uint32_t head;
+	uint32_t cached_tail;
+
+	/* The packets the reader dropped or had to wait to queue */
+	uint64_t dropped;
+	uint64_t stalls;
+	char reader_padding[CAPTURE_CACHE_LINE - 2 * sizeof (uint32_t) - 2 * sizeof (uint64_t)];
+
+	/* The next slot the shard takes, the last head it saw and the
+	 * packets it has taken.
+	 */
+	uint32_t tail;
+	uint32_t cached_head;
+	uint64_t processed;
+	char shard_padding[CAPTURE_CACHE_LINE - 2 * sizeof (uint32_t) - sizeof (uint64_t)];
+
+	uint32_t mask;
+	struct capture_desc_t *slots;
+};
+
+/*
+ * An analysis thread with its session manager and one ring per reader.
+ * Its members are only written as the thread starts and stops, so shards
+ * can share cache lines.
+ */
+struct capture_shard_t {
+	capture_pipeline_t *pipeline;
+	int index;
+
+	pthread_t thread;
+	int started;
+
+	session_manager_t *manager;
+	struct capture_ring_t **rings;
+};
+
+struct capture_pipeline_t {
+	int readers;
+	int shards;
+	int policy;
+	uint32_t ring_size;
+
+	capture_pipeline_create_manager_t create_manager;
+	void *arg;
+
+	struct capture_shard_t *shard;
+
+	/* Set while the analysis threads run, and once they should stop
+	 * after emptying their rings.
+	 */
+	int running;
+	int finishing;
+};
+
+/*
+ * Creates an empty ring with room for size descriptors, a power of two.
+ */
+struct capture_ring_t *capture_ring_create (uint32_t size);
+
+/*
+ * Frees a ring.
+ */
+void capture_ring_destroy (struct capture_ring_t *ring);
+
+/*
+ * Returns the slot for the next descriptor of a ring, waiting for room or
+ * returning NULL if it is full, depending on the policy.
+ */
+struct capture_desc_t *capture_ring_reserve (struct capture_ring_t *ring, int policy);
+
+/*
+ * Makes the descriptor in the slot from capture_ring_reserve() visible to
+ * the shard.
+ */
+void capture_ring_publish (struct capture_ring_t *ring);
+
+/*
+ * Passes the descriptors waiting on a ring to the shard's session manager,
+ * up to a batch at a time. Returns the number taken.
+ */
+int capture_ring_drain (struct capture_shard_t *shard, struct capture_ring_t *ring);
+
+/*
+ * The analysis thread of a shard.
+ */
+void *capture_pipeline_shard_thread (void *data);
+
+/*
+ * Stops the analysis threads that were started, once they have emptied
+ * their rings.
+ */
+void capture_pipeline_stop (capture_pipeline_t * pipeline);
+
+/*
+ * Creates an empty ring with room for size descriptors, a power of two.
+ */
+struct capture_ring_t *capture_ring_create (uint32_t size) {
+	struct capture_ring_t *ring;
+
+	if (posix_memalign ((void **) &ring, CAPTURE_CACHE_LINE, sizeof (struct capture_ring_t)) != 0)
+		return NULL;
+	memset (ring, 0, sizeof (struct capture_ring_t));
+
+	if (posix_memalign ((void **) &(ring->slots), CAPTURE_CACHE_LINE, size * sizeof (struct capture_desc_t)) != 0) {
+		free (ring);
+		return NULL;
+	}
+	ring->mask = size - 1;
+	return ring;
+}
+
+/*
+ * Frees a ring.
+ */
+void capture_ring_destroy (struct capture_ring_t *ring) {
+	if (ring == NULL)
+		return;
+	free (ring->slots);
+	free (ring);
+}
+
+/*
+ * Returns the slot for the next descriptor of a ring, waiting for room or
+ * returning NULL if it is full, depending on the policy.
+ */
+struct capture_desc_t *capture_ring_reserve (struct capture_ring_t *ring, int policy) {
+	uint32_t head = ring->head;
+
+	if (head - ring->cached_tail > ring->mask) {
+		ring->cached_tail = __atomic_load_n (&(ring->tail), __ATOMIC_ACQUIRE);
+
+		if (head - ring->cached_tail > ring->mask) {
+			/* Only the reader writes the counters, so they need no locked
+			 * instructions, just whole stores for other threads to read.
+			 */
+			if (policy == CAPTURE_PIPELINE_DROP) {
+				__atomic_store_n (&(ring->dropped), ring->dropped + 1, __ATOMIC_RELAXED);
+				return NULL;
+			}
+
+			__atomic_store_n (&(ring->stalls), ring->stalls + 1, __ATOMIC_RELAXED);
+			do {
+				sched_yield ();
+				ring->cached_tail = __atomic_load_n (&(ring->tail), __ATOMIC_ACQUIRE);
+			} while (head - ring->cached_tail > ring->mask);
+		}
+	}
+	return &(ring->slots[head & ring->mask]);
+}
+
+/*
+ * Makes the descriptor in the slot from capture_ring_reserve() visible to
+ * the shard.
+ */
+void capture_ring_publish (struct capture_ring_t *ring) {
+	__atomic_store_n (&(ring->head), ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Passes the descriptors waiting on a ring to the shard's session manager,
+ * up to a batch at a time. Returns the number taken.
+ */
+int capture_ring_drain (struct capture_shard_t *shard, struct capture_ring_t *ring) {
+	uint32_t tail = ring->tail;
+	uint32_t count = ring->cached_head - tail;
+	struct capture_desc_t *desc;
+	uint32_t i;
+
+	if (count == 0) {
+		ring->cached_head = __atomic_load_n (&(ring->head), __ATOMIC_ACQUIRE);
+		count = ring->cached_head - tail;
+		if (count == 0)
+			return 0;
+	}
+	if (count > CAPTURE_PIPELINE_BATCH)
+		count = CAPTURE_PIPELINE_BATCH;
+
+	for (i = 0; i < count; i++) {
+		desc = &(ring->slots[(tail + i) & ring->mask]);
+		if (shard->manager != NULL)
+			session_manager_update_raw (shard->manager, desc->headers, desc->caplen, desc->time, desc->direction);
+	}
+
+	/* Give the slots back to the reader */
+	__atomic_store_n (&(ring->tail), tail + count, __ATOMIC_RELEASE);
+	__atomic_store_n (&(ring->processed), ring->processed + count, __ATOMIC_RELAXED);
+	return count;
+}
+
+/*
+ * The analysis thread of a shard.
+ */
+void *capture_pipeline_shard_thread (void *data) {
+	struct capture_shard_t *shard = (struct capture_shard_t *) data;
+	capture_pipeline_t *pipeline = shard->pipeline;
+	int i, idle, finishing, spins = 0;
+	struct timespec nap = { 0, 0 };
+
+	/* The manager is made here so that its memory is local to the shard */
+	shard->manager = pipeline->create_manager (pipeline->arg, shard->index);
+	if (shard->manager == NULL)
+		fprintf (stderr, "Cannot create the session manager of shard %d\n", shard->index);
+
+	for (;;) {
+		/* Everything pushed before finishing was set is on the rings, so
+		 * the thread stops once a pass after seeing it finds them empty.
+		 */
+		finishing = __atomic_load_n (&(pipeline->finishing), __ATOMIC_ACQUIRE);
+
+		idle = 1;
+		for (i = 0; i < pipeline->readers; i++) {
+			if (capture_ring_drain (shard, shard->rings[i]) > 0)
+				idle = 0;
+		}
+
+		if (!idle) {
+			spins = 0;
+			nap.tv_nsec = 0;
+			continue;
+		}
+		if (finishing)
+			break;
+
+		/* Poll for a while, as packets seldom stop for long, and then
+		 * sleep for longer and longer so that an idle shard leaves its
+		 * CPU alone.
+		 */
+		if (spins < CAPTURE_PIPELINE_SPINS) {
+			spins++;
+			sched_yield ();
+		} else {
+			nap.tv_nsec = (nap.tv_nsec == 0) ? 1000 : nap.tv_nsec * 2;
+			if (nap.tv_nsec > CAPTURE_PIPELINE_SLEEP_MAX)
+				nap.tv_nsec = CAPTURE_PIPELINE_SLEEP_MAX;
+			nanosleep (&nap, NULL);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Creates a pipeline for the given number of reader threads and shards.
+ * Each ring holds ring_size descriptors, rounded up to a power of two.
+ * Returns NULL if the arguments are not valid.
+ */
+capture_pipeline_t *capture_pipeline_create (int readers, int shards, unsigned int ring_size, int policy,
+		capture_pipeline_create_manager_t create_manager, void *arg) {
+	capture_pipeline_t *pipeline;
+	uint32_t size = 1;
+	int i, j;
+
+	if (readers < 1 || shards < 1 || create_manager == NULL) {
+		fprintf (stderr, "A capture pipeline needs a reader, a shard and a way to create managers\n");
+		return NULL;
+	}
+	if (policy != CAPTURE_PIPELINE_BLOCK && policy != CAPTURE_PIPELINE_DROP) {
+		fprintf (stderr, "Unknown capture pipeline policy %d\n", policy);
+		return NULL;
+	}
+	if (ring_size == 0 || ring_size > 0x80000000U) {
+		fprintf (stderr, "Bad capture ring size: %u\n", ring_size);
+		return NULL;
+	}
+	while (size < ring_size)
+		size <<= 1;
+
+	pipeline = malloc (sizeof (capture_pipeline_t));
+	pipeline->readers = readers;
+	pipeline->shards = shards;
+	pipeline->policy = policy;
+	pipeline->ring_size = size;
+	pipeline->create_manager = create_manager;
+	pipeline->arg = arg;
+	pipeline->running = 0;
+	pipeline->finishing = 0;
+
+	pipeline->shard = calloc (shards, sizeof (struct capture_shard_t));
+	for (i = 0; i < shards; i++) {
+		pipeline->shard[i].pipeline = pipeline;
+		pipeline->shard[i].index = i;
+		pipeline->shard[i].rings = calloc (readers, sizeof (struct capture_ring_t *));
+		for (j = 0; j < readers; j++) {
+			pipeline->shard[i].rings[j] = capture_ring_create (size);
+			if (pipeline->shard[i].rings[j] == NULL) {
+				fprintf (stderr, "Cannot allocate a capture ring of %u descriptors\n", size);
+				capture_pipeline_destroy (pipeline);
+				return NULL;
+			}
+		}
+	}
+	return pipeline;
+}
+
+/*
+ * Starts the analysis threads. Returns 0, or -1 if they could not all be
+ * started, in which case the ones that did start are stopped again.
+ */
+int capture_pipeline_start (capture_pipeline_t * pipeline) {
+	int i;
+
+	if (pipeline->running)
+		return 0;
+
+	/* The managers of a finished pipeline are kept for the caller */
+	if (pipeline->finishing) {
+		fprintf (stderr, "A capture pipeline can only be started once\n");
+		return -1;
+	}
+
+	pipeline->running = 1;
+	for (i = 0; i < pipeline->shards; i++) {
+		if (pthread_create (&(pipeline->shard[i].thread), NULL, &capture_pipeline_shard_thread, &(pipeline->shard[i])) != 0) {
+			fprintf (stderr, "Cannot start a capture pipeline thread\n");
+			capture_pipeline_stop (pipeline);
+			return -1;
+		}
+		pipeline->shard[i].started = 1;
+	}
+	return 0;
+}
+
+/*
+ * Pushes a libtrace packet from the given reader, which is a number from 0
+ * to readers - 1 used by only one thread.
+ */
+int capture_pipeline_push (capture_pipeline_t * pipeline, int reader, struct libtrace_packet_t *packet) {
+	uint16_t ethertype;
+	uint32_t remaining;
+	const uint8_t *l3 = trace_get_layer3 (packet, &ethertype, &remaining);
+
+	if (l3 == NULL || ethertype != 0x0800)
+		return -1;
+	return capture_pipeline_push_raw (pipeline, reader, l3, remaining, tcp_packet_time (packet),
+			trace_get_direction (packet));
+}
+
+/*
+ * As capture_pipeline_push(), for a buffer that starts at the IPv4 header.
+ * The headers are copied, so the buffer can be reused once this returns.
+ */
+int capture_pipeline_push_raw (capture_pipeline_t * pipeline, int reader, const uint8_t * l3, size_t caplen,
+		uint64_t ts_ns, int direction) {
+	const struct libtrace_ip *ip = (const struct libtrace_ip *) l3;
+	const struct libtrace_tcp *tcp;
+	struct capture_desc_t *desc;
+	tcp_session_id_t id;
+	size_t headers;
+	uint32_t hash;
+	int shard;
+
+	if (reader < 0 || reader >= pipeline->readers)
+		return -1;
+
+	/* Only the first fragment of an IPv4 TCP packet has the ports */
+	if (caplen < sizeof (struct libtrace_ip) || ip->ip_v != 4 || ip->ip_hl < 5 || ip->ip_p != 6
+			|| (ntohs (ip->ip_off) & 0x1fff) != 0)
+		return -1;
+	headers = ip->ip_hl << 2;
+	if (headers + sizeof (struct libtrace_tcp) > caplen)
+		return -1;
+	tcp = (const struct libtrace_tcp *) (l3 + headers);
+	headers += tcp->doff << 2;
+	if (tcp->doff < 5 || headers > caplen)
+		return -1;
+
+	/* The ID is built as the session manager does, so that both
+	 * directions of a flow have the same hash and go to the same shard.
+	 */
+	if (ip->ip_src.s_addr < ip->ip_dst.s_addr) {
+		id.ip_a = ip->ip_src.s_addr;
+		id.ip_b = ip->ip_dst.s_addr;
+		id.port_a = ntohs (tcp->source);
+		id.port_b = ntohs (tcp->dest);
+	} else {
+		id.ip_a = ip->ip_dst.s_addr;
+		id.ip_b = ip->ip_src.s_addr;
+		id.port_a = ntohs (tcp->dest);
+		id.port_b = ntohs (tcp->source);
+	}
+	hash = tcp_session_id_hash (&id, CAPTURE_PIPELINE_HASH_KEY);
+	shard = (int) (((uint64_t) hash * pipeline->shards) >> 32);
+
+	desc = capture_ring_reserve (pipeline->shard[shard].rings[reader], pipeline->policy);
+	if (desc == NULL)
+		return 1;
+
+	desc->time = ts_ns;
+	desc->hash = hash;
+	desc->caplen = headers;
+	desc->direction = direction;
+	memcpy (desc->headers, l3, headers);
+
+	capture_ring_publish (pipeline->shard[shard].rings[reader]);
+	return 0;
+}
+
+/*
+ * Stops the analysis threads that were started, once they have emptied
+ * their rings.
+ */
+void capture_pipeline_stop (capture_pipeline_t * pipeline) {
+	int i;
+
+	__atomic_store_n (&(pipeline->finishing), 1, __ATOMIC_RELEASE);
+	for (i = 0; i < pipeline->shards; i++) {
+		if (pipeline->shard[i].started) {
+			pthread_join (pipeline->shard[i].thread, NULL);
+			pipeline->shard[i].started = 0;
+		}
+	}
+	pipeline->running = 0;
+}
+
+/*
+ * Waits until the shards have analysed every packet pushed and stops them.
+ * The readers must have stopped pushing first.
+ */
+void capture_pipeline_finish (capture_pipeline_t * pipeline) {
+	if (pipeline->running)
+		capture_pipeline_stop (pipeline);
+}
+
+/*
+ * Returns the session manager of a shard, or NULL if the shard has not
+ * been started.
+ */
+session_manager_t *capture_pipeline_manager (capture_pipeline_t * pipeline, int shard) {
+	if (shard < 0 || shard >= pipeline->shards)
+		return NULL;
+	return pipeline->shard[shard].manager;
+}
+
+/*
+ * Returns the number of packets of a shard that were analysed.
+ */
+uint64_t capture_pipeline_processed (capture_pipeline_t * pipeline, int shard) {
+	uint64_t processed = 0;
+	int i;
+
+	if (shard < 0 || shard >= pipeline->shards)
+		return 0;
+	for (i = 0; i < pipeline->readers; i++)
+		processed += __atomic_load_n (&(pipeline->shard[shard].rings[i]->processed), __ATOMIC_RELAXED);
+	return processed;
+}
+
+/*
+ * Returns the number of packets for a shard that were dropped because a
+ * ring was full.
+ */
+uint64_t capture_pipeline_dropped (capture_pipeline_t * pipeline, int shard) {
+	uint64_t dropped = 0;
+	int i;
+
+	if (shard < 0 || shard >= pipeline->shards)
+		return 0;
+	for (i = 0; i < pipeline->readers; i++)
+		dropped += __atomic_load_n (&(pipeline->shard[shard].rings[i]->dropped), __ATOMIC_RELAXED);
+	return dropped;
+}
+
+/*
+ * Returns the number of packets for a shard that a reader had to wait to
+ * queue because a ring was full.
+ */
+uint64_t capture_pipeline_stalls (capture_pipeline_t * pipeline, int shard) {
+	uint64_t stalls = 0;
+	int i;
+
+	if (shard < 0 || shard >= pipeline->shards)
+		return 0;
+	for (i = 0; i < pipeline->readers; i++)
+		stalls += __atomic_load_n (&(pipeline->shard[shard].rings[i]->stalls), __ATOMIC_RELAXED);
+	return stalls;
+}
+
+/*
+ * Returns the number of packets waiting on the rings of a shard.
+ */
+unsigned int capture_pipeline_queued (capture_pipeline_t * pipeline, int shard) {
+	struct capture_ring_t *ring;
+	unsigned int queued = 0;
+	int i;
+
+	if (shard < 0 || shard >= pipeline->shards)
+		return 0;
+	for (i = 0; i < pipeline->readers; i++) {
+		ring = pipeline->shard[shard].rings[i];
+		queued += __atomic_load_n (&(ring->head), __ATOMIC_ACQUIRE) - __atomic_load_n (&(ring->tail), __ATOMIC_ACQUIRE);
+	}
+	return queued;
+}
+
+/*
+ * Finishes the pipeline if it is running and frees it, along with the
+ * session managers of the shards.
+ */
+void capture_pipeline_destroy (capture_pipeline_t * pipeline) {
+	int i, j;
+
+	if (pipeline == NULL)
+		return;
+
+	capture_pipeline_finish (pipeline);
+
+	for (i = 0; i < pipeline->shards; i++) {
+		if (pipeline->shard[i].manager != NULL)
+			session_manager_destroy (pipeline->shard[i].manager);
+		if (pipeline->shard[i].rings != NULL) {
+			for (j = 0; j < pipeline->readers; j++)
+				capture_ring_destroy (pipeline->shard[i].rings[j]);
+			free (pipeline->shard[i].rings);
+		}
+	}
+	free (pipeline->shard);
+	free (pipeline);
+}
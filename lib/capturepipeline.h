@@ -0,0 +1,180 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#ifndef CAPTUREPIPELINE_H_
+#define CAPTUREPIPELINE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "sessionmanager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A capture pipeline separates reading packets from analysing them. One or
+ * more reader threads, which belong to the caller, push packets into the
+ * pipeline. Each packet is reduced to a descriptor that holds its flow
+ * hash, its time, its direction and a copy of its IP and TCP headers. The
+ * descriptor is placed on the ring of the shard that owns the flow. Each
+ * shard has its own analysis thread and session manager, which take the
+ * descriptors off its rings and pass them to session_manager_update_raw().
+ *
+ * Every ring has one reader and one shard, so the rings need no locks:
+ * there is a ring for each pair of reader and shard. Both directions of a
+ * flow go to the same shard. Packets from one reader keep their order, but
+ * packets of one flow should all come through the same reader, e.g. one
+ * per receive queue of a NIC with symmetric hashing.
+ *
+ * When a ring is full, the reader either waits for the shard to catch up
+ * (CAPTURE_PIPELINE_BLOCK) or drops the packet (CAPTURE_PIPELINE_DROP).
+ * Both are counted for each shard.
+ */
+typedef struct capture_pipeline_t capture_pipeline_t;
+
+/* What a reader does when the ring of a shard is full */
+#define CAPTURE_PIPELINE_BLOCK 0
+#define CAPTURE_PIPELINE_DROP 1
+
+/*
+ * The number of header bytes a descriptor holds, enough for the largest
+ * IPv4 and TCP headers.
+ */
+#define CAPTURE_DESC_HEADER_MAX 120
+
+/*
+ * A packet on its way from a reader to a shard.
+ */
+struct capture_desc_t {
+	/* The time of the packet, in nanoseconds */
+	uint64_t time;
+
+	/* The hash of the flow, which chose the shard */
+	uint32_t hash;
+
+	/* The number of header bytes held */
+	uint16_t caplen;
+
+	/* 0 for outbound, 1 for inbound */
+	int8_t direction;
+	uint8_t padding;
+
+	/* The packet from the IP header on */
+	uint8_t headers[CAPTURE_DESC_HEADER_MAX];
+};
+
+/*
+ * Creates the session manager of a shard and registers its modules. It is
+ * called on the shard's own thread, once for each shard, possibly from
+ * several threads at once, so memory pools made in it are local to the
+ * shard (see mempool.h).
+ */
+typedef session_manager_t *(*capture_pipeline_create_manager_t) (void *arg, int shard);
+
+/*
+ * Creates a pipeline for the given number of reader threads and shards.
+ * Each ring holds ring_size descriptors, rounded up to a power of two.
+ * Returns NULL if the arguments are not valid.
+ */
+capture_pipeline_t *capture_pipeline_create (int readers, int shards, unsigned int ring_size, int policy,
+		capture_pipeline_create_manager_t create_manager, void *arg);
+
+/*
+ * Starts the analysis threads. Returns 0, or -1 if they could not all be
+ * started, in which case the ones that did start are stopped again. A
+ * pipeline can only be started once, and packets should only be pushed
+ * while it runs.
+ */
+int capture_pipeline_start (capture_pipeline_t * pipeline);
+
+/*
+ * Pushes a libtrace packet from the given reader, which is a number from 0
+ * to readers - 1 used by only one thread. Returns 0 if the packet was
+ * queued, 1 if it was dropped because the ring was full, or -1 if it is
+ * not an IPv4 TCP packet, which is skipped.
+ */
+int capture_pipeline_push (capture_pipeline_t * pipeline, int reader, struct libtrace_packet_t *packet);
+
+/*
+ * As capture_pipeline_push(), for a buffer that starts at the IPv4 header,
+ * as for session_manager_update_raw(). The headers are copied, so the
+ * buffer can be reused once this returns.
+ */
+int capture_pipeline_push_raw (capture_pipeline_t * pipeline, int reader, const uint8_t * l3, size_t caplen,
+		uint64_t ts_ns, int direction);
+
+/*
+ * Waits until the shards have analysed every packet pushed and stops them.
+ * The readers must have stopped pushing first.
+ */
+void capture_pipeline_finish (capture_pipeline_t * pipeline);
+
+/*
+ * Returns the session manager of a shard, or NULL if the shard has not
+ * been started. It should only be used once the pipeline has finished.
+ */
+session_manager_t *capture_pipeline_manager (capture_pipeline_t * pipeline, int shard);
+
+/*
+ * Returns the number of packets of a shard that were analysed.
+ */
+uint64_t capture_pipeline_processed (capture_pipeline_t * pipeline, int shard);
+
+/*
+ * Returns the number of packets for a shard that were dropped because a
+ * ring was full.
+ */
+uint64_t capture_pipeline_dropped (capture_pipeline_t * pipeline, int shard);
+
+/*
+ * Returns the number of packets for a shard that a reader had to wait to
+ * queue because a ring was full.
+ */
+uint64_t capture_pipeline_stalls (capture_pipeline_t * pipeline, int shard);
+
+/*
+ * Returns the number of packets waiting on the rings of a shard.
+ */
+unsigned int capture_pipeline_queued (capture_pipeline_t * pipeline, int shard);
+
+/*
+ * Finishes the pipeline if it is running and frees it, along with the
+ * session managers of the shards.
+ */
+void capture_pipeline_destroy (capture_pipeline_t * pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*CAPTUREPIPELINE_H_ */
@@ -0,0 +1,296 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sessionmanager.h"
+#include "rttmodule.h"
+#include "bwest.h"
+#include "reordering.h"
+#include "flowexport.h"
+
+/*
+ * The columns of a flow record. Wider columns come first so that every
+ * column stays aligned to its width.
+ */
+enum flow_export_column_id_t {
+	FLOW_START_TIME, FLOW_END_TIME, FLOW_BYTES_IN, FLOW_BYTES_OUT,
+	FLOW_IP_A, FLOW_IP_B, FLOW_RTT_INSIDE, FLOW_RTT_OUTSIDE,
+	FLOW_REORDERING,			/* one column per reordering type */
+	FLOW_PORT_A = FLOW_REORDERING + LAST_REORDERING, FLOW_PORT_B,
+	FLOW_STATE, FLOW_COLUMN_COUNT
+};
+
+struct flow_export_column_def_t {
+	const char *name;
+	uint32_t width;
+};
+
+const struct flow_export_column_def_t flow_export_columns[FLOW_COLUMN_COUNT] = {
+	{"start_time", 8},
+	{"end_time", 8},
+	{"bytes_in", 8},
+	{"bytes_out", 8},
+	{"ip_a", 4},
+	{"ip_b", 4},
+	{"rtt_inside", 4},
+	{"rtt_outside", 4},
+	{"reordering_inorder", 4},
+	{"reordering_high", 4},
+	{"reordering_retransmission", 4},
+	{"reordering_network_reordering", 4},
+	{"reordering_network_duplicate", 4},
+	{"reordering_unknown", 4},
+	{"port_a", 2},
+	{"port_b", 2},
+	{"state", 1}
+};
+
+struct flow_exporter_t {
+	FILE *file;
+
+	/* The header and column table, as written at the start of the file */
+	struct flow_export_header_t header;
+	struct flow_export_column_t columns[FLOW_COLUMN_COUNT];
+
+	/* The block being filled, written out once it is full */
+	char *block;
+	uint32_t length;
+
+	/* The ids of the modules to take values from, or -1 */
+	int bwest_id;
+	int rtt_id;
+	struct rtt_module_t *rtt_module;
+	int reordering_id;
+
+	/* Set if any write has failed */
+	int error;
+};
+
+/*
+ * Copies a value into the next free slot of a column of the current block.
+ */
+void flow_exporter_put (flow_exporter_t * exporter, int column, const void *value);
+
+/*
+ * Writes the current block to the file and starts a new one.
+ */
+void flow_exporter_write_block (flow_exporter_t * exporter);
+
+
+
+/*
+ * Creates an exporter writing to a new file at path. Returns NULL if the
+ * file cannot be created.
+ */
+flow_exporter_t *flow_exporter_create (const char *path) {
+	flow_exporter_t *exporter;
+	uint32_t offset;
+	int i;
+
+	FILE *file = fopen (path, "wb");
+	if (file == NULL) {
+		fprintf (stderr, "Cannot open flow export file %s\n", path);
+		return NULL;
+	}
+
+	exporter = malloc (sizeof (flow_exporter_t));
+	exporter->file = file;
+
+	/* Lay out the columns one after another within a block */
+	memset (exporter->columns, 0, sizeof (exporter->columns));
+	offset = sizeof (struct flow_export_block_t);
+	for (i = 0; i < FLOW_COLUMN_COUNT; i++) {
+		strncpy (exporter->columns[i].name, flow_export_columns[i].name, FLOW_EXPORT_NAME_LENGTH - 1);
+		exporter->columns[i].width = flow_export_columns[i].width;
+		exporter->columns[i].offset = offset;
+		offset += flow_export_columns[i].width * FLOW_EXPORT_BLOCK_RECORDS;
+	}
+
+	memset (&(exporter->header), 0, sizeof (exporter->header));
+	memcpy (exporter->header.magic, FLOW_EXPORT_MAGIC, sizeof (exporter->header.magic));
+	exporter->header.version = FLOW_EXPORT_VERSION;
+	exporter->header.byte_order = FLOW_EXPORT_BYTE_ORDER;
+	exporter->header.header_size = sizeof (exporter->header) + sizeof (exporter->columns);
+	exporter->header.block_size = offset;
+	exporter->header.block_records = FLOW_EXPORT_BLOCK_RECORDS;
+	exporter->header.column_count = FLOW_COLUMN_COUNT;
+	exporter->header.record_count = 0;
+
+	exporter->block = calloc (1, offset);
+	exporter->length = 0;
+
+	exporter->bwest_id = -1;
+	exporter->rtt_id = -1;
+	exporter->rtt_module = NULL;
+	exporter->reordering_id = -1;
+
+	exporter->error = 0;
+
+	/* The record count in the header is filled in on destroy */
+	if (fwrite (&(exporter->header), sizeof (exporter->header), 1, file) != 1
+	    || fwrite (exporter->columns, sizeof (exporter->columns), 1, file) != 1)
+		exporter->error = 1;
+
+	return exporter;
+}
+
+/*
+ * Flushes the last block, completes the header and closes the file.
+ * Returns 0 on success or -1 if any write failed.
+ */
+int flow_exporter_destroy (flow_exporter_t * exporter) {
+	int error;
+
+	if (exporter->length > 0)
+		flow_exporter_write_block (exporter);
+
+	if (fseek (exporter->file, 0, SEEK_SET) != 0
+	    || fwrite (&(exporter->header), sizeof (exporter->header), 1, exporter->file) != 1)
+		exporter->error = 1;
+
+	if (fclose (exporter->file) != 0)
+		exporter->error = 1;
+
+	error = exporter->error;
+	if (error)
+		fprintf (stderr, "Error writing flow export file\n");
+
+	free (exporter->block);
+	free (exporter);
+	return error ? -1 : 0;
+}
+
+/*
+ * Tell the exporter the ids of the modules to take values from. Columns
+ * for modules that are not set are left as -1.0 for RTTs and 0 otherwise.
+ */
+void flow_exporter_set_bwest (flow_exporter_t * exporter, int module_id) {
+	exporter->bwest_id = module_id;
+}
+
+void flow_exporter_set_rtt (flow_exporter_t * exporter, struct rtt_module_t *module, int module_id) {
+	exporter->rtt_module = module;
+	exporter->rtt_id = module_id;
+}
+
+void flow_exporter_set_reordering (flow_exporter_t * exporter, int module_id) {
+	exporter->reordering_id = module_id;
+}
+
+/*
+ * Appends a record for a session. Records are buffered and written a
+ * block at a time.
+ */
+void flow_exporter_add (flow_exporter_t * exporter, tcp_session_t * session) {
+	uint64_t bytes_in = 0, bytes_out = 0;
+	float rtt_inside = -1.0, rtt_outside = -1.0;
+	uint32_t count;
+	uint8_t state = session->state;
+	int i;
+
+	flow_exporter_put (exporter, FLOW_START_TIME, &(session->start_time));
+	flow_exporter_put (exporter, FLOW_END_TIME, &(session->end_time));
+
+	if (exporter->bwest_id >= 0) {
+		bytes_in = bwest_incoming (session->data[exporter->bwest_id]);
+		bytes_out = bwest_outgoing (session->data[exporter->bwest_id]);
+	}
+	flow_exporter_put (exporter, FLOW_BYTES_IN, &bytes_in);
+	flow_exporter_put (exporter, FLOW_BYTES_OUT, &bytes_out);
+
+	flow_exporter_put (exporter, FLOW_IP_A, &(session->id.ip_a));
+	flow_exporter_put (exporter, FLOW_IP_B, &(session->id.ip_b));
+
+	if (exporter->rtt_id >= 0) {
+		rtt_inside = exporter->rtt_module->inside_rtt (session->data[exporter->rtt_id]);
+		rtt_outside = exporter->rtt_module->outside_rtt (session->data[exporter->rtt_id]);
+	}
+	flow_exporter_put (exporter, FLOW_RTT_INSIDE, &rtt_inside);
+	flow_exporter_put (exporter, FLOW_RTT_OUTSIDE, &rtt_outside);
+
+	for (i = 0; i < LAST_REORDERING; i++) {
+		count = 0;
+		if (exporter->reordering_id >= 0)
+			count = reordering_get_type_count (session->data[exporter->reordering_id], i);
+		flow_exporter_put (exporter, FLOW_REORDERING + i, &count);
+	}
+
+	flow_exporter_put (exporter, FLOW_PORT_A, &(session->id.port_a));
+	flow_exporter_put (exporter, FLOW_PORT_B, &(session->id.port_b));
+	flow_exporter_put (exporter, FLOW_STATE, &state);
+
+	exporter->header.record_count++;
+	exporter->length++;
+	if (exporter->length == FLOW_EXPORT_BLOCK_RECORDS)
+		flow_exporter_write_block (exporter);
+}
+
+/*
+ * A close callback that adds each finished session to the exporter given
+ * as arg, for use with session_manager_set_close_callback().
+ */
+void flow_exporter_close_callback (tcp_session_t * session, void *arg) {
+	flow_exporter_add ((flow_exporter_t *) arg, session);
+}
+
+/*
+ * Returns the number of records added so far.
+ */
+uint64_t flow_exporter_count (flow_exporter_t * exporter) {
+	return exporter->header.record_count;
+}
+
+/*
+ * Copies a value into the next free slot of a column of the current block.
+ */
+void flow_exporter_put (flow_exporter_t * exporter, int column, const void *value) {
+	uint32_t width = exporter->columns[column].width;
+	memcpy (exporter->block + exporter->columns[column].offset + exporter->length * width, value, width);
+}
+
+/*
+ * Writes the current block to the file and starts a new one.
+ */
+void flow_exporter_write_block (flow_exporter_t * exporter) {
+	struct flow_export_block_t block_header;
+
+	block_header.count = exporter->length;
+	block_header.padding = 0;
+	memcpy (exporter->block, &block_header, sizeof (block_header));
+
+	if (fwrite (exporter->block, exporter->header.block_size, 1, exporter->file) != 1)
+		exporter->error = 1;
+
+	memset (exporter->block, 0, exporter->header.block_size);
+	exporter->length = 0;
+}
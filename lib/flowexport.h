@@ -0,0 +1,143 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef FLOWEXPORT_H_
+#define FLOWEXPORT_H_
+
+#include <inttypes.h>
+#include "sessionmanager.h"
+#include "rttmodule.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A flow exporter appends one record per finished session to a binary
+ * file, instead of formatting the results as text.
+ *
+ * The file starts with a flow_export_header_t, followed by one
+ * flow_export_column_t per column, followed by fixed-size blocks. Each
+ * block starts with a flow_export_block_t and then holds every column in
+ * turn as an array of block_records values, so a column can be scanned
+ * without touching the others. Block n starts at
+ * header_size + n * block_size, and every column starts on an 8 byte
+ * boundary, so the file can be mapped into memory and read in place. The
+ * last block may be partly filled, with the unused slots zeroed.
+ *
+ * Values are in host byte order. Times are in nanoseconds since the
+ * epoch, RTTs are in seconds, with -1.0 when not known, and IP addresses
+ * and ports are as found in the tcp_session_id_t.
+ */
+
+#define FLOW_EXPORT_MAGIC "TCPTFLOW"
+#define FLOW_EXPORT_VERSION 2
+#define FLOW_EXPORT_BYTE_ORDER 0x01020304
+
+/* The number of records in each block. This must be a multiple of 8 */
+#define FLOW_EXPORT_BLOCK_RECORDS 4096
+
+#define FLOW_EXPORT_NAME_LENGTH 32
+
+struct flow_export_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+
+	/* The size of the header and column table, and of each block */
+	uint32_t header_size;
+	uint32_t block_size;
+
+	uint32_t block_records;
+	uint32_t column_count;
+
+	/* The total number of records, written when the exporter is destroyed */
+	uint64_t record_count;
+};
+
+struct flow_export_column_t {
+	char name[FLOW_EXPORT_NAME_LENGTH];
+
+	/* The size of one value, and the offset of the column in a block */
+	uint32_t width;
+	uint32_t offset;
+};
+
+struct flow_export_block_t {
+	/* The number of records used in this block */
+	uint32_t count;
+	uint32_t padding;
+};
+
+typedef struct flow_exporter_t flow_exporter_t;
+
+/*
+ * Creates an exporter writing to a new file at path. Returns NULL if the
+ * file cannot be created.
+ */
+flow_exporter_t *flow_exporter_create (const char *path);
+
+/*
+ * Flushes the last block, completes the header and closes the file.
+ * Returns 0 on success or -1 if any write failed.
+ */
+int flow_exporter_destroy (flow_exporter_t * exporter);
+
+/*
+ * Tell the exporter the ids of the modules to take values from. Columns
+ * for modules that are not set are left as -1.0 for RTTs and 0 otherwise.
+ */
+void flow_exporter_set_bwest (flow_exporter_t * exporter, int module_id);
+void flow_exporter_set_rtt (flow_exporter_t * exporter, struct rtt_module_t *module, int module_id);
+void flow_exporter_set_reordering (flow_exporter_t * exporter, int module_id);
+
+/*
+ * Appends a record for a session. Records are buffered and written a
+ * block at a time.
+ */
+void flow_exporter_add (flow_exporter_t * exporter, tcp_session_t * session);
+
+/*
+ * A close callback that adds each finished session to the exporter given
+ * as arg, for use with session_manager_set_close_callback().
+ */
+void flow_exporter_close_callback (tcp_session_t * session, void *arg);
+
+/*
+ * Returns the number of records added so far.
+ */
+uint64_t flow_exporter_count (flow_exporter_t * exporter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*FLOWEXPORT_H_ */
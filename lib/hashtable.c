@@ -31,10 +31,14 @@
 
 #define ARRAY_SIZE 2000003
 
+/* The smallest size of the array of live entries */
+#define LIVE_INCREMENT 1024
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <libtrace.h>
 #include "sessionmanager.h"
+#include "mempool.h"
 #include "hashtable.h"
 #include "tcpsession.h"
 
@@ -43,6 +47,18 @@
  */
 struct hashtable_t {
 	struct hash_entry **arr;
+
+	/* The number of sessions in the hashtable */
+	unsigned int count;
+
+	/*
+	 * Every entry in the hashtable, packed into the first count places
+	 * of an array so that iterating costs time in the number of sessions
+	 * rather than the size of the hashtable. An entry is removed by moving
+	 * the last entry into its place.
+	 */
+	struct hash_entry **live;
+	unsigned int live_size;
 };
 
 /*
@@ -60,17 +76,22 @@ struct hash_entry {
 	 * hash tables.
 	 */
 	struct hash_entry *next;
+
+	/*
+	 * The position of the entry in the array of live entries
+	 */
+	unsigned int live_idx;
 };
 
 /*
- * This struct is for the iterator. Using a hashtable with external
- * chaining, both the array index and chain index need to be stored
- * if the remove function is to work correctly.
+ * This struct is for the iterator, which walks the array of live entries
+ * from the end so that removing the current entry only moves an entry
+ * that has already been returned.
  * */
 struct hashtable_iterator_t {
-	unsigned int array_position;
-	unsigned int list_position;
-	struct hash_entry **entry_ptr;
+	hashtable_t *hashtable;
+	unsigned int position;
+	struct hash_entry *current;
 };
 
 /*
@@ -78,15 +99,29 @@ struct hashtable_iterator_t {
  * */
 int hashtable_compute_hash (tcp_session_id_t * id);
 
+/*
+ * Adds an entry to the end of the array of live entries.
+ */
+void hashtable_live_add (hashtable_t * hashtable, struct hash_entry *entry);
+
+/*
+ * Takes an entry out of the array of live entries, moving the last entry
+ * into its place, and shrinks the array once it is mostly empty.
+ */
+void hashtable_live_remove (hashtable_t * hashtable, struct hash_entry *entry);
+
 /*
  * Creates and initialises a new hashtable
  */
 hashtable_t *hashtable_create () {
 	int i;
-	hashtable_t *hashtable = (hashtable_t *) malloc (sizeof (hashtable_t));
-	hashtable->arr = (struct hash_entry **) malloc (ARRAY_SIZE * sizeof (struct hash_entry *));
+	hashtable_t *hashtable = (hashtable_t *) mem_alloc (sizeof (hashtable_t));
+	hashtable->arr = (struct hash_entry **) mem_alloc (ARRAY_SIZE * sizeof (struct hash_entry *));
 	for (i = 0; i < ARRAY_SIZE; i++)
 		hashtable->arr[i] = NULL;
+	hashtable->count = 0;
+	hashtable->live_size = LIVE_INCREMENT;
+	hashtable->live = (struct hash_entry **) mem_alloc (hashtable->live_size * sizeof (struct hash_entry *));
 	return hashtable;
 }
 
@@ -94,18 +129,14 @@ hashtable_t *hashtable_create () {
  * Frees the memory associated with a hashtable
  */
 void hashtable_destroy (hashtable_t * hashtable) {
-	int i;
-	struct hash_entry *ptr;
-	for (i = 0; i < ARRAY_SIZE; i++) {
-		while (hashtable->arr[i] != NULL) {
-			ptr = hashtable->arr[i]->next;
-			free (hashtable->arr[i]->session);
-			free (hashtable->arr[i]);
-			hashtable->arr[i] = ptr;
-		}
+	unsigned int i;
+	for (i = 0; i < hashtable->count; i++) {
+		mem_free (hashtable->live[i]->session);
+		mem_free (hashtable->live[i]);
 	}
-	free (hashtable->arr);
-	free (hashtable);
+	mem_free (hashtable->live);
+	mem_free (hashtable->arr);
+	mem_free (hashtable);
 }
 
 /* Computes the hash of a flow's IP addresses and TCP ports */
@@ -117,6 +148,37 @@ int hashtable_compute_hash (tcp_session_id_t * id) {
 	return key % ARRAY_SIZE;
 }
 
+/*
+ * Adds an entry to the end of the array of live entries.
+ */
+void hashtable_live_add (hashtable_t * hashtable, struct hash_entry *entry) {
+	if (hashtable->count == hashtable->live_size) {
+		hashtable->live_size *= 2;
+		hashtable->live = (struct hash_entry **) mem_realloc (hashtable->live, hashtable->live_size * sizeof (struct hash_entry *));
+	}
+	entry->live_idx = hashtable->count;
+	hashtable->live[hashtable->count] = entry;
+	hashtable->count++;
+}
+
+/*
+ * Takes an entry out of the array of live entries, moving the last entry
+ * into its place, and shrinks the array once it is mostly empty.
+ */
+void hashtable_live_remove (hashtable_t * hashtable, struct hash_entry *entry) {
+	struct hash_entry *last;
+
+	hashtable->count--;
+	last = hashtable->live[hashtable->count];
+	last->live_idx = entry->live_idx;
+	hashtable->live[entry->live_idx] = last;
+
+	if (hashtable->live_size > LIVE_INCREMENT && hashtable->count < hashtable->live_size / 4) {
+		hashtable->live_size /= 2;
+		hashtable->live = (struct hash_entry **) mem_realloc (hashtable->live, hashtable->live_size * sizeof (struct hash_entry *));
+	}
+}
+
 /*
  * Inserts a session into the hashtable
  */
@@ -124,7 +186,7 @@ void hashtable_insert (hashtable_t * hashtable, tcp_session_t * session) {
 
 	int hash = hashtable_compute_hash (&(session->id));
 
-	struct hash_entry *new_hash_entry = (struct hash_entry *) malloc (sizeof (struct hash_entry));
+	struct hash_entry *new_hash_entry = (struct hash_entry *) mem_alloc (sizeof (struct hash_entry));
 	new_hash_entry->session = session;
 
 	/* Append new entry to the front of the list as it is more likely
@@ -132,6 +194,7 @@ void hashtable_insert (hashtable_t * hashtable, tcp_session_t * session) {
 	 */
 	new_hash_entry->next = hashtable->arr[hash];
 	hashtable->arr[hash] = new_hash_entry;
+	hashtable_live_add (hashtable, new_hash_entry);
 }
 
 /*
@@ -175,9 +238,10 @@ tcp_session_t *hashtable_remove (hashtable_t * hashtable, tcp_session_id_t * id)
 		if (tcp_session_id_equals (id, &(entry->session->id))) {
 			session = entry->session;
 			*entry_ptr = entry->next;
+			hashtable_live_remove (hashtable, entry);
 			entry->next = NULL;
 			entry->session = NULL;
-			free (entry);
+			mem_free (entry);
 			return session;
 		}
 		entry_ptr = &(entry->next);
@@ -189,13 +253,13 @@ tcp_session_t *hashtable_remove (hashtable_t * hashtable, tcp_session_id_t * id)
 
 /*
  * Creates and initialises a new iterator over the hashtable. The ordering of
- * the elements is by the hash function and therefore is not based on the
- * order of insertion.
+ * the elements is not based on the order of insertion.
  */
 hashtable_iterator_t *hashtable_iterator_create (hashtable_t * hashtable) {
-	hashtable_iterator_t *iterator = malloc (sizeof (hashtable_iterator_t));
-	iterator->array_position = 0;
-	iterator->entry_ptr = &(hashtable->arr[0]);
+	hashtable_iterator_t *iterator = mem_alloc (sizeof (hashtable_iterator_t));
+	iterator->hashtable = hashtable;
+	iterator->position = hashtable->count;
+	iterator->current = NULL;
 	return iterator;
 }
 
@@ -204,43 +268,14 @@ hashtable_iterator_t *hashtable_iterator_create (hashtable_t * hashtable) {
  */
 tcp_session_t *hashtable_iterator_next (hashtable_t * hashtable, hashtable_iterator_t * iterator) {
 
-	if (*(iterator->entry_ptr) == NULL) {
-
-		/* Scan vertically through array */
-		do {
-			iterator->array_position++;
-			/* Check if end of array has been reached */
-			if (iterator->array_position == ARRAY_SIZE)
-				return NULL;
-		} while (hashtable->arr[iterator->array_position] == NULL);
-		/* Return the first non-NULL entry found */
-		iterator->entry_ptr = &(hashtable->arr[iterator->array_position]);
-
-	} else {
-
-		/* If we already have an entry, try to scan horizontally
-		 * through list
-		 */
-		if ((*(iterator->entry_ptr))->next != NULL) {
-			iterator->entry_ptr = &((*(iterator->entry_ptr))->next);
-		} else {
-			/* End of list reached, so scan vertically through array
-			 */
-			do {
-				iterator->array_position++;
-				/* Check if end of array has been reached */
-				if (iterator->array_position == ARRAY_SIZE)
-					return NULL;
-			} while (hashtable->arr[iterator->array_position] == NULL);
-			/* Return the first non-NULL entry found */
-			iterator->entry_ptr = &(hashtable->arr[iterator->array_position]);
-		}
-
+	if (iterator->position == 0) {
+		iterator->current = NULL;
+		return NULL;
 	}
 
-	/* entry_ptr is now valid */
-	return (*(iterator->entry_ptr))->session;
-
+	iterator->position--;
+	iterator->current = hashtable->live[iterator->position];
+	return iterator->current->session;
 }
 
 /*
@@ -250,23 +285,35 @@ tcp_session_t *hashtable_iterator_next (hashtable_t * hashtable, hashtable_itera
  */
 tcp_session_t *hashtable_iterator_remove (hashtable_iterator_t * iterator) {
 
-	struct hash_entry *entry;
+	struct hash_entry *entry = iterator->current;
+	struct hash_entry **entry_ptr;
 	struct tcp_session_t *session;
+	hashtable_t *hashtable = iterator->hashtable;
 
-	if (iterator->entry_ptr == NULL)
+	if (entry == NULL)
 		return NULL;
 
-	entry = (*(iterator->entry_ptr));
 	session = entry->session;
 
-	if (entry == NULL)
-		return NULL;
+	/* Find the link to the entry in its chain */
+	entry_ptr = &(hashtable->arr[hashtable_compute_hash (&(session->id))]);
+	while (*entry_ptr != entry)
+		entry_ptr = &((*entry_ptr)->next);
 
-	/* All-in-one adjustment of hashtable: */
-	*(iterator->entry_ptr) = entry->next;
+	/* The entry moved into this place has already been returned */
+	*entry_ptr = entry->next;
+	hashtable_live_remove (hashtable, entry);
 	entry->session = NULL;
 	entry->next = NULL;
-	free (entry);
+	mem_free (entry);
+	iterator->current = NULL;
 	return session;
 
 }
+
+/*
+ * Returns the number of sessions in the hashtable.
+ */
+unsigned int hashtable_count (hashtable_t * hashtable) {
+	return hashtable->count;
+}
@@ -63,8 +63,8 @@ tcp_session_t *hashtable_remove (hashtable_t * hashtable, tcp_session_id_t * id)
 
 /*
  * Creates and initialises a new iterator over the hashtable. The ordering of
- * the elements is by the hash function and therefore is not based on the
- * order of insertion.
+ * the elements is not based on the order of insertion. Iterating costs
+ * time in the number of sessions, not the size of the hashtable.
  */
 hashtable_iterator_t *hashtable_iterator_create (hashtable_t * hashtable);
 
@@ -80,4 +80,9 @@ tcp_session_t *hashtable_iterator_next (hashtable_t * hashtable, hashtable_itera
  */
 tcp_session_t *hashtable_iterator_remove (hashtable_iterator_t * iterator);
 
+/*
+ * Returns the number of sessions in the hashtable.
+ */
+unsigned int hashtable_count (hashtable_t * hashtable);
+
 #endif							/*HASHTABLE_H_ */
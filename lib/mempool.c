@@ -0,0 +1,680 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+#include "mempool.h"
+
+/*
+ * The size classes of a pool grow by MEM_POOL_ALIGN up to MEM_POOL_SMALL_MAX
+ * and then double up to MEM_POOL_CLASS_MAX. Larger blocks are taken from
+ * the system one at a time.
+ */
+#define MEM_POOL_ALIGN 16
+#define MEM_POOL_SMALL_MAX 512
+#define MEM_POOL_CLASS_MAX 8192
+#define MEM_POOL_CLASSES (MEM_POOL_SMALL_MAX / MEM_POOL_ALIGN + 4)
+
+/* The size of the slabs that blocks are cut from */
+#define MEM_POOL_SLAB_SIZE (256 * 1024)
+
+/* The size of a huge page, which is also the size of the slabs of a pool
+ * that uses huge pages.
+ */
+#define MEM_HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+/*
+ * Where the memory of a chunk came from, so that it is given back the
+ * same way.
+ */
+#define MEM_SOURCE_SYSTEM 0
+#define MEM_SOURCE_MMAP 1
+#define MEM_SOURCE_HUGETLB 2
+
+/*
+ * The header in front of all memory from mem_alloc(), which finds the
+ * allocator it came from when it is freed.
+ */
+struct mem_header_t {
+	const struct mem_allocator_t *allocator;
+	size_t size;
+};
+
+/* The size of the header, rounded up so that the memory stays aligned */
+#define MEM_HEADER_SIZE ((sizeof (struct mem_header_t) + MEM_POOL_ALIGN - 1) & ~((size_t) MEM_POOL_ALIGN - 1))
+
+/*
+ * A freed block, on the list of its size class.
+ */
+struct mem_block_t {
+	struct mem_block_t *next;
+};
+
+/*
+ * The start of a slab, or of a block too large for the size classes. These
+ * are linked so that the pool can give them all back.
+ */
+struct mem_chunk_t {
+	struct mem_chunk_t *prev;
+	struct mem_chunk_t *next;
+	size_t size;
+	int source;
+};
+
+/* The size of a chunk header, rounded up as for MEM_HEADER_SIZE */
+#define MEM_CHUNK_SIZE ((sizeof (struct mem_chunk_t) + MEM_POOL_ALIGN - 1) & ~((size_t) MEM_POOL_ALIGN - 1))
+
+struct mem_pool_t {
+	struct mem_allocator_t allocator;
+
+	/* The NUMA node of the memory, or -1 */
+	int node;
+
+	/* The freed blocks of each size class */
+	struct mem_block_t *free_lists[MEM_POOL_CLASSES];
+
+	/* The unused end of the newest slab */
+	char *next;
+	size_t left;
+
+	/* The slabs and the large blocks */
+	struct mem_chunk_t *slabs;
+	struct mem_chunk_t *large;
+	size_t slab_size;
+
+	/* One of MEM_HUGE_PAGES_OFF, _TRANSPARENT or _EXPLICIT */
+	int huge_pages;
+
+	size_t reserved;
+	size_t huge_reserved;
+};
+
+/* The allocator of each thread, where NULL means malloc() */
+static __thread const struct mem_allocator_t *mem_current = NULL;
+
+/*
+ * Allocates memory with a header from the given allocator.
+ */
+void *mem_alloc_from (const struct mem_allocator_t *allocator, size_t size);
+
+/*
+ * Returns the size class of a block, which must be no larger than
+ * MEM_POOL_CLASS_MAX.
+ */
+int mem_pool_class (size_t size);
+
+/*
+ * Returns the size of the blocks of a class.
+ */
+size_t mem_pool_class_size (int class);
+
+/*
+ * Takes memory for a pool from the system, on the pool's node if it has one.
+ */
+void *mem_pool_system_alloc (mem_pool_t * pool, size_t size);
+
+/*
+ * Gives memory from mem_pool_system_alloc() back to the system.
+ */
+void mem_pool_system_free (mem_pool_t * pool, void *ptr, size_t size);
+
+/*
+ * Maps memory for a pool that uses huge pages, rounding size up to whole
+ * huge pages. Returns NULL if the memory cannot be mapped.
+ */
+void *mem_pool_huge_alloc (mem_pool_t * pool, size_t * size, int *source);
+
+/*
+ * Takes a slab or a large block of at least size bytes for a pool, in huge
+ * pages if huge is set and the pool uses them. The size of the chunk may
+ * be rounded up.
+ */
+struct mem_chunk_t *mem_pool_chunk_alloc (mem_pool_t * pool, size_t size, int huge);
+
+/*
+ * Gives a chunk from mem_pool_chunk_alloc() back to the system.
+ */
+void mem_pool_chunk_free (mem_pool_t * pool, struct mem_chunk_t *chunk);
+
+/*
+ * The alloc function of a pool's allocator.
+ */
+void *mem_pool_alloc (void *arg, size_t size);
+
+/*
+ * The free function of a pool's allocator.
+ */
+void mem_pool_free (void *arg, void *ptr, size_t size);
+
+/*
+ * Allocates memory with a header from the given allocator.
+ */
+void *mem_alloc_from (const struct mem_allocator_t *allocator, size_t size) {
+	struct mem_header_t *header;
+
+	if (size > SIZE_MAX - MEM_HEADER_SIZE)
+		return NULL;
+
+	if (allocator == NULL)
+		header = malloc (size + MEM_HEADER_SIZE);
+	else
+		header = allocator->alloc (allocator->arg, size + MEM_HEADER_SIZE);
+	if (header == NULL)
+		return NULL;
+
+	header->allocator = allocator;
+	header->size = size;
+	return (char *) header + MEM_HEADER_SIZE;
+}
+
+/*
+ * Allocates memory from the calling thread's allocator, or with malloc()
+ * if it has none. Returns NULL if the memory is not available.
+ */
+void *mem_alloc (size_t size) {
+	return mem_alloc_from (mem_current, size);
+}
+
+/*
+ * Allocates zeroed memory for count items from the calling thread's
+ * allocator.
+ */
+void *mem_calloc (size_t count, size_t size) {
+	void *ptr;
+
+	if (size != 0 && count > SIZE_MAX / size)
+		return NULL;
+	ptr = mem_alloc (count * size);
+	if (ptr != NULL)
+		memset (ptr, 0, count * size);
+	return ptr;
+}
+
+/*
+ * Resizes memory from mem_alloc(), keeping it with the allocator it came
+ * from. A NULL ptr allocates from the calling thread's allocator.
+ */
+void *mem_realloc (void *ptr, size_t size) {
+	struct mem_header_t *header;
+	void *new_ptr;
+
+	if (ptr == NULL)
+		return mem_alloc (size);
+
+	header = (struct mem_header_t *) ((char *) ptr - MEM_HEADER_SIZE);
+
+	/* Memory from malloc() can grow in place */
+	if (header->allocator == NULL) {
+		if (size > SIZE_MAX - MEM_HEADER_SIZE)
+			return NULL;
+		header = realloc (header, size + MEM_HEADER_SIZE);
+		if (header == NULL)
+			return NULL;
+		header->size = size;
+		return (char *) header + MEM_HEADER_SIZE;
+	}
+
+	/* Other memory cannot grow in place, so it is kept when it shrinks by
+	 * less than half, and grows by at least half, which makes a series of
+	 * small growth steps, such as those of an array, cost a copy only now
+	 * and then. The header records the size that was really allocated.
+	 */
+	if (size <= header->size && size >= header->size / 2)
+		return ptr;
+	if (size > header->size && size - header->size < header->size / 2
+	    && header->size <= SIZE_MAX / 2)
+		size = header->size + header->size / 2;
+
+	new_ptr = mem_alloc_from (header->allocator, size);
+	if (new_ptr == NULL)
+		return NULL;
+	memcpy (new_ptr, ptr, (header->size < size) ? header->size : size);
+	mem_free (ptr);
+	return new_ptr;
+}
+
+/*
+ * Gives memory from mem_alloc() back to the allocator it came from, on any
+ * thread. NULL is ignored.
+ */
+void mem_free (void *ptr) {
+	struct mem_header_t *header;
+
+	if (ptr == NULL)
+		return;
+
+	header = (struct mem_header_t *) ((char *) ptr - MEM_HEADER_SIZE);
+	if (header->allocator == NULL)
+		free (header);
+	else
+		header->allocator->free (header->allocator->arg, header, header->size + MEM_HEADER_SIZE);
+}
+
+/*
+ * Sets the allocator used by mem_alloc() on the calling thread, or the
+ * default malloc() one if allocator is NULL, and returns the previous one.
+ */
+const struct mem_allocator_t *mem_set_allocator (const struct mem_allocator_t *allocator) {
+	const struct mem_allocator_t *previous = mem_current;
+	mem_current = allocator;
+	return previous;
+}
+
+/*
+ * Returns the allocator used by mem_alloc() on the calling thread, or NULL
+ * for the default.
+ */
+const struct mem_allocator_t *mem_get_allocator (void) {
+	return mem_current;
+}
+
+/*
+ * Returns the NUMA node of the CPU the calling thread is running on, or -1
+ * if this is not known.
+ */
+int mem_current_node (void) {
+#ifdef HAVE_LIBNUMA
+	int cpu;
+
+	if (numa_available () < 0)
+		return -1;
+	cpu = sched_getcpu ();
+	if (cpu < 0)
+		return -1;
+	return numa_node_of_cpu (cpu);
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Returns the size class of a block, which must be no larger than
+ * MEM_POOL_CLASS_MAX.
+ */
+int mem_pool_class (size_t size) {
+	int class = MEM_POOL_SMALL_MAX / MEM_POOL_ALIGN;
+	size_t limit;
+
+	if (size <= MEM_POOL_SMALL_MAX)
+		return (size + MEM_POOL_ALIGN - 1) / MEM_POOL_ALIGN - 1;
+
+	for (limit = MEM_POOL_SMALL_MAX * 2; limit < size; limit *= 2)
+		class++;
+	return class;
+}
+
+/*
+ * Returns the size of the blocks of a class.
+ */
+size_t mem_pool_class_size (int class) {
+	if (class < MEM_POOL_SMALL_MAX / MEM_POOL_ALIGN)
+		return (size_t) (class + 1) * MEM_POOL_ALIGN;
+	return (size_t) MEM_POOL_SMALL_MAX << (class - MEM_POOL_SMALL_MAX / MEM_POOL_ALIGN + 1);
+}
+
+/*
+ * Takes memory for a pool from the system, on the pool's node if it has one.
+ */
+void *mem_pool_system_alloc (mem_pool_t * pool, size_t size) {
+	void *ptr;
+
+#ifdef HAVE_LIBNUMA
+	if (pool->node >= 0)
+		ptr = numa_alloc_onnode (size, pool->node);
+	else
+#endif
+		ptr = malloc (size);
+
+	if (ptr != NULL)
+		pool->reserved += size;
+	return ptr;
+}
+
+/*
+ * Gives memory from mem_pool_system_alloc() back to the system.
+ */
+void mem_pool_system_free (mem_pool_t * pool, void *ptr, size_t size) {
+	pool->reserved -= size;
+
+#ifdef HAVE_LIBNUMA
+	if (pool->node >= 0) {
+		numa_free (ptr, size);
+		return;
+	}
+#endif
+	free (ptr);
+}
+
+/*
+ * Maps memory for a pool that uses huge pages, rounding size up to whole
+ * huge pages. Returns NULL if the memory cannot be mapped.
+ */
+void *mem_pool_huge_alloc (mem_pool_t * pool, size_t * size, int *source) {
+	size_t length, skip;
+	char *ptr = MAP_FAILED;
+
+	if (*size > SIZE_MAX - 2 * MEM_HUGE_PAGE_SIZE)
+		return NULL;
+	length = (*size + MEM_HUGE_PAGE_SIZE - 1) & ~(MEM_HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+	/* Explicit huge pages only exist if the administrator reserved them */
+	if (pool->huge_pages == MEM_HUGE_PAGES_EXPLICIT) {
+		ptr = mmap (NULL, length, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			*source = MEM_SOURCE_HUGETLB;
+			pool->huge_reserved += length;
+		}
+	}
+#endif
+
+	/* Otherwise ask for transparent huge pages, which can only back
+	 * aligned huge pages, so the mapping is trimmed to be aligned.
+	 */
+	if (ptr == MAP_FAILED) {
+		ptr = mmap (NULL, length + MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return NULL;
+
+		skip = (MEM_HUGE_PAGE_SIZE - ((uintptr_t) ptr & (MEM_HUGE_PAGE_SIZE - 1))) & (MEM_HUGE_PAGE_SIZE - 1);
+		if (skip > 0)
+			munmap (ptr, skip);
+		munmap (ptr + skip + length, MEM_HUGE_PAGE_SIZE - skip);
+		ptr += skip;
+
+#ifdef MADV_HUGEPAGE
+		/* Failure only means the memory stays in small pages */
+		madvise (ptr, length, MADV_HUGEPAGE);
+#endif
+		*source = MEM_SOURCE_MMAP;
+	}
+
+#ifdef HAVE_LIBNUMA
+	if (pool->node >= 0)
+		numa_tonode_memory (ptr, length, pool->node);
+#endif
+
+	pool->reserved += length;
+	*size = length;
+	return ptr;
+}
+
+/*
+ * Takes a slab or a large block of at least size bytes for a pool, in huge
+ * pages if huge is set and the pool uses them. The size of the chunk may
+ * be rounded up.
+ */
+struct mem_chunk_t *mem_pool_chunk_alloc (mem_pool_t * pool, size_t size, int huge) {
+	struct mem_chunk_t *chunk = NULL;
+	int source = MEM_SOURCE_SYSTEM;
+
+	if (huge && pool->huge_pages != MEM_HUGE_PAGES_OFF)
+		chunk = mem_pool_huge_alloc (pool, &size, &source);
+
+	/* Fall back to the usual memory if no huge pages can be mapped */
+	if (chunk == NULL) {
+		source = MEM_SOURCE_SYSTEM;
+		chunk = mem_pool_system_alloc (pool, size);
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	chunk->size = size;
+	chunk->source = source;
+	chunk->prev = NULL;
+	chunk->next = NULL;
+	return chunk;
+}
+
+/*
+ * Gives a chunk from mem_pool_chunk_alloc() back to the system.
+ */
+void mem_pool_chunk_free (mem_pool_t * pool, struct mem_chunk_t *chunk) {
+	size_t size = chunk->size;
+
+	switch (chunk->source) {
+	case MEM_SOURCE_HUGETLB:
+		pool->huge_reserved -= size;
+		/* Fall through */
+	case MEM_SOURCE_MMAP:
+		pool->reserved -= size;
+		munmap (chunk, size);
+		break;
+	default:
+		mem_pool_system_free (pool, chunk, size);
+		break;
+	}
+}
+
+/*
+ * The alloc function of a pool's allocator.
+ */
+void *mem_pool_alloc (void *arg, size_t size) {
+	mem_pool_t *pool = (mem_pool_t *) arg;
+	struct mem_block_t *block;
+	struct mem_chunk_t *chunk;
+	size_t block_size;
+	int class;
+
+	/* Large blocks come straight from the system. Only those of at least
+	 * a huge page, such as the hashtable's bucket array, are put in huge
+	 * pages: smaller ones, such as the arrays of a session, would each pin
+	 * a whole huge page and cost several system calls as they grow.
+	 */
+	if (size > MEM_POOL_CLASS_MAX) {
+		if (size > SIZE_MAX - MEM_CHUNK_SIZE)
+			return NULL;
+		size += MEM_CHUNK_SIZE;
+		chunk = mem_pool_chunk_alloc (pool, size, size >= MEM_HUGE_PAGE_SIZE);
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = pool->large;
+		if (pool->large != NULL)
+			pool->large->prev = chunk;
+		pool->large = chunk;
+		return (char *) chunk + MEM_CHUNK_SIZE;
+	}
+
+	class = mem_pool_class (size);
+	block = pool->free_lists[class];
+	if (block != NULL) {
+		pool->free_lists[class] = block->next;
+		return block;
+	}
+
+	/* Cut a new block from the newest slab, starting a slab if needed */
+	block_size = mem_pool_class_size (class);
+	if (pool->left < block_size) {
+		chunk = mem_pool_chunk_alloc (pool, pool->slab_size, 1);
+		if (chunk == NULL)
+			return NULL;
+		chunk->next = pool->slabs;
+		pool->slabs = chunk;
+		pool->next = (char *) chunk + MEM_CHUNK_SIZE;
+		pool->left = chunk->size - MEM_CHUNK_SIZE;
+	}
+
+	block = (struct mem_block_t *) pool->next;
+	pool->next += block_size;
+	pool->left -= block_size;
+	return block;
+}
+
+/*
+ * The free function of a pool's allocator.
+ */
+void mem_pool_free (void *arg, void *ptr, size_t size) {
+	mem_pool_t *pool = (mem_pool_t *) arg;
+	struct mem_block_t *block = (struct mem_block_t *) ptr;
+	struct mem_chunk_t *chunk;
+	int class;
+
+	if (size > MEM_POOL_CLASS_MAX) {
+		chunk = (struct mem_chunk_t *) ((char *) ptr - MEM_CHUNK_SIZE);
+		if (chunk->prev != NULL)
+			chunk->prev->next = chunk->next;
+		else
+			pool->large = chunk->next;
+		if (chunk->next != NULL)
+			chunk->next->prev = chunk->prev;
+		mem_pool_chunk_free (pool, chunk);
+		return;
+	}
+
+	class = mem_pool_class (size);
+	block->next = pool->free_lists[class];
+	pool->free_lists[class] = block;
+}
+
+/*
+ * Creates a pool whose memory is bound to a NUMA node. A node of -1 uses
+ * the node of the calling thread, and without libnuma the node is ignored.
+ */
+mem_pool_t *mem_pool_create (int node) {
+	mem_pool_t pool_template, *pool;
+
+#ifdef HAVE_LIBNUMA
+	if (numa_available () < 0) {
+		node = -1;
+	} else if (node < 0) {
+		node = mem_current_node ();
+	} else if (node > numa_max_node ()) {
+		fprintf (stderr, "NUMA node %d does not exist\n", node);
+		return NULL;
+	}
+#else
+	node = -1;
+#endif
+
+	/* The pool itself is kept on its own node */
+	memset (&pool_template, 0, sizeof (pool_template));
+	pool_template.node = node;
+	pool = mem_pool_system_alloc (&pool_template, sizeof (mem_pool_t));
+	if (pool == NULL)
+		return NULL;
+	*pool = pool_template;
+
+	pool->allocator.alloc = &mem_pool_alloc;
+	pool->allocator.free = &mem_pool_free;
+	pool->allocator.arg = pool;
+	pool->slab_size = MEM_POOL_SLAB_SIZE;
+	pool->huge_pages = MEM_HUGE_PAGES_OFF;
+	return pool;
+}
+
+/*
+ * Frees a pool and all of the memory taken from it. Nothing allocated from
+ * the pool may be used afterwards.
+ */
+void mem_pool_destroy (mem_pool_t * pool) {
+	struct mem_chunk_t *chunk, *next;
+
+	if (pool == NULL)
+		return;
+
+	for (chunk = pool->slabs; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		mem_pool_chunk_free (pool, chunk);
+	}
+	for (chunk = pool->large; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		mem_pool_chunk_free (pool, chunk);
+	}
+
+	if (mem_current == &(pool->allocator))
+		mem_current = NULL;
+	mem_pool_system_free (pool, pool, sizeof (mem_pool_t));
+}
+
+/*
+ * Returns the allocator of a pool, for session_manager_create_with_allocator()
+ * or mem_set_allocator().
+ */
+const struct mem_allocator_t *mem_pool_allocator (mem_pool_t * pool) {
+	return &(pool->allocator);
+}
+
+/*
+ * Returns the NUMA node of a pool, or -1 if its memory is not bound.
+ */
+int mem_pool_node (mem_pool_t * pool) {
+	return pool->node;
+}
+
+/*
+ * Returns the number of bytes that a pool has taken from the system.
+ */
+size_t mem_pool_reserved (mem_pool_t * pool) {
+	return pool->reserved;
+}
+
+/*
+ * Sets whether the slabs and the blocks of at least a huge page that a
+ * pool takes from now on are backed by huge pages. Returns 0, or -1 if huge
+ * pages cannot be used on this system.
+ */
+int mem_pool_set_huge_pages (mem_pool_t * pool, int mode) {
+	if (mode < MEM_HUGE_PAGES_OFF || mode > MEM_HUGE_PAGES_EXPLICIT) {
+		fprintf (stderr, "Unknown huge page mode %d\n", mode);
+		return -1;
+	}
+
+#ifndef MAP_ANONYMOUS
+	if (mode != MEM_HUGE_PAGES_OFF) {
+		fprintf (stderr, "Huge pages are not supported on this system\n");
+		return -1;
+	}
+#endif
+
+	pool->huge_pages = mode;
+	pool->slab_size = (mode == MEM_HUGE_PAGES_OFF) ? MEM_POOL_SLAB_SIZE : MEM_HUGE_PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Returns the number of bytes of a pool that are in explicit huge pages.
+ */
+size_t mem_pool_huge_reserved (mem_pool_t * pool) {
+	return pool->huge_reserved;
+}
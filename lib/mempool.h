@@ -0,0 +1,164 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#ifndef MEMPOOL_H_
+#define MEMPOOL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An allocator that the sessions, the hashtable, the queues and the data of
+ * the modules are taken from. The free function is given the size that was
+ * asked of alloc.
+ */
+struct mem_allocator_t {
+	void *(*alloc) (void *arg, size_t size);
+	void (*free) (void *arg, void *ptr, size_t size);
+	void *arg;
+};
+
+/*
+ * Allocates memory from the calling thread's allocator, or with malloc()
+ * if it has none. Returns NULL if the memory is not available.
+ */
+void *mem_alloc (size_t size);
+
+/*
+ * Allocates zeroed memory for count items from the calling thread's
+ * allocator.
+ */
+void *mem_calloc (size_t count, size_t size);
+
+/*
+ * Resizes memory from mem_alloc(), keeping it with the allocator it came
+ * from. A NULL ptr allocates from the calling thread's allocator.
+ */
+void *mem_realloc (void *ptr, size_t size);
+
+/*
+ * Gives memory from mem_alloc() back to the allocator it came from, on any
+ * thread. NULL is ignored.
+ */
+void mem_free (void *ptr);
+
+/*
+ * Sets the allocator used by mem_alloc() on the calling thread, or the
+ * default malloc() one if allocator is NULL, and returns the previous one.
+ * The allocator must outlive any memory taken from it.
+ */
+const struct mem_allocator_t *mem_set_allocator (const struct mem_allocator_t *allocator);
+
+/*
+ * Returns the allocator used by mem_alloc() on the calling thread, or NULL
+ * for the default.
+ */
+const struct mem_allocator_t *mem_get_allocator (void);
+
+/*
+ * Returns the NUMA node of the CPU the calling thread is running on, or -1
+ * if this is not known, such as when libtcptools was built without libnuma.
+ */
+int mem_current_node (void);
+
+/*
+ * A pool keeps freed memory on lists by size, so that sessions and module
+ * data are reused rather than given back to malloc(). Its memory is taken
+ * in large slabs, bound to one NUMA node when libnuma is available.
+ *
+ * A pool is not locked: it is meant to belong to one thread, normally the
+ * one that runs the session managers using it. Memory from a pool should be
+ * freed on that thread, or once the thread has stopped using the pool.
+ */
+typedef struct mem_pool_t mem_pool_t;
+
+/*
+ * Creates a pool whose memory is bound to a NUMA node. A node of -1 uses
+ * the node of the calling thread, and without libnuma the node is ignored.
+ */
+mem_pool_t *mem_pool_create (int node);
+
+/*
+ * Frees a pool and all of the memory taken from it. Nothing allocated from
+ * the pool may be used afterwards.
+ */
+void mem_pool_destroy (mem_pool_t * pool);
+
+/*
+ * Returns the allocator of a pool, for session_manager_create_with_allocator()
+ * or mem_set_allocator().
+ */
+const struct mem_allocator_t *mem_pool_allocator (mem_pool_t * pool);
+
+/*
+ * Returns the NUMA node of a pool, or -1 if its memory is not bound.
+ */
+int mem_pool_node (mem_pool_t * pool);
+
+/*
+ * Returns the number of bytes that a pool has taken from the system.
+ */
+size_t mem_pool_reserved (mem_pool_t * pool);
+
+/*
+ * The huge page modes of a pool. With MEM_HUGE_PAGES_TRANSPARENT its
+ * memory is aligned and marked with madvise(MADV_HUGEPAGE) so that the
+ * kernel can back it with transparent huge pages. MEM_HUGE_PAGES_EXPLICIT
+ * first tries pages reserved with MAP_HUGETLB (see vm.nr_hugepages) and
+ * falls back to transparent ones, and either falls back to plain memory.
+ */
+#define MEM_HUGE_PAGES_OFF 0
+#define MEM_HUGE_PAGES_TRANSPARENT 1
+#define MEM_HUGE_PAGES_EXPLICIT 2
+
+/*
+ * Sets whether the slabs that a pool takes from now on, and the blocks of
+ * at least a huge page, such as a session manager's hashtable, are backed
+ * by huge pages. The slabs then grow to one huge page each. Other blocks
+ * too large for the slabs keep to ordinary pages. Returns 0, or -1 if huge
+ * pages cannot be used on this system.
+ */
+int mem_pool_set_huge_pages (mem_pool_t * pool, int mode);
+
+/*
+ * Returns the number of bytes of a pool that are in explicit huge pages.
+ */
+size_t mem_pool_huge_reserved (mem_pool_t * pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*MEMPOOL_H_ */
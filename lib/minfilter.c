@@ -0,0 +1,137 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+/*
+ * This is Kathleen Nichols' windowed min/max filter, as described in
+ * the BBR paper and implemented in the Linux kernel (lib/win_minmax.c),
+ * restricted to tracking a minimum.
+ *
+ * s[0] is the minimum over the window, s[1] is the minimum seen since
+ * a quarter of the window after s[0] and s[2] is the minimum seen since
+ * half a window after s[0]. When s[0] falls out of the window, the later
+ * samples are promoted so a new minimum is available straight away.
+ */
+
+#include "minfilter.h"
+
+/*
+ * Promotes samples when the best one has expired, or refreshes the
+ * later samples when they have not been updated for a while.
+ */
+uint32_t min_filter_subwindow_update (struct min_filter_t *filter, uint64_t window, struct min_filter_sample_t *sample);
+
+/*
+ * Resets all three samples to the given sample.
+ */
+uint32_t min_filter_reset (struct min_filter_t *filter, struct min_filter_sample_t *sample);
+
+/*
+ * Empties the filter.
+ */
+void min_filter_clear (struct min_filter_t *filter) {
+	int i;
+	for (i = 0; i < 3; i++) {
+		filter->s[i].time = 0;
+		filter->s[i].value = MIN_FILTER_NONE;
+	}
+}
+
+/*
+ * Resets all three samples to the given sample.
+ */
+uint32_t min_filter_reset (struct min_filter_t *filter, struct min_filter_sample_t *sample) {
+	filter->s[0] = filter->s[1] = filter->s[2] = *sample;
+	return filter->s[0].value;
+}
+
+/*
+ * Promotes samples when the best one has expired, or refreshes the
+ * later samples when they have not been updated for a while.
+ */
+uint32_t min_filter_subwindow_update (struct min_filter_t *filter, uint64_t window, struct min_filter_sample_t *sample) {
+	/* Signed, so that a sample slightly out of order does not expire all */
+	int64_t elapsed = (int64_t) (sample->time - filter->s[0].time);
+	int64_t length = (int64_t) window;
+
+	if (elapsed > length) {
+		/* The best sample has expired, so promote the second and third
+		 * best. If the new best has also expired, do it again.
+		 */
+		filter->s[0] = filter->s[1];
+		filter->s[1] = filter->s[2];
+		filter->s[2] = *sample;
+		if ((int64_t) (sample->time - filter->s[0].time) > length) {
+			filter->s[0] = filter->s[1];
+			filter->s[1] = filter->s[2];
+			filter->s[2] = *sample;
+		}
+	} else if (filter->s[1].time == filter->s[0].time && elapsed > length / 4) {
+		/* A quarter of the window has passed without a new second
+		 * best, so take one from the second quarter.
+		 */
+		filter->s[2] = filter->s[1] = *sample;
+	} else if (filter->s[2].time == filter->s[1].time && elapsed > length / 2) {
+		/* Likewise for the third best in the second half */
+		filter->s[2] = *sample;
+	}
+
+	return filter->s[0].value;
+}
+
+/*
+ * Adds a sample taken at the given time and returns the minimum over the
+ * window. The time and window must be in the same units, e.g. nanoseconds.
+ */
+uint32_t min_filter_update (struct min_filter_t *filter, uint64_t window, uint64_t time, uint32_t value) {
+	struct min_filter_sample_t sample;
+
+	sample.time = time;
+	sample.value = value;
+
+	/* A new minimum, or nothing in the window at all */
+	if (filter->s[0].value == MIN_FILTER_NONE || value <= filter->s[0].value || (int64_t) (time - filter->s[2].time) > (int64_t) window)
+		return min_filter_reset (filter, &sample);
+
+	if (value <= filter->s[1].value)
+		filter->s[2] = filter->s[1] = sample;
+	else if (value <= filter->s[2].value)
+		filter->s[2] = sample;
+
+	return min_filter_subwindow_update (filter, window, &sample);
+}
+
+/*
+ * Returns the current windowed minimum, or MIN_FILTER_NONE if the filter
+ * is empty.
+ */
+uint32_t min_filter_get (struct min_filter_t *filter) {
+	return filter->s[0].value;
+}
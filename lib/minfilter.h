@@ -0,0 +1,88 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef MINFILTER_H_
+#define MINFILTER_H_
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A windowed minimum filter tracks the smallest value seen within a
+ * sliding time window, e.g. the minimum RTT over the last 10 seconds as an
+ * estimate of the path propagation delay. It uses Kathleen Nichols'
+ * algorithm (as used by BBR and the Linux win_minmax filter), which keeps
+ * only three samples and so needs constant time and memory per sample: the
+ * best over the window, the best since a quarter of the window after it and
+ * the best since half a window after it. When the best expires the second
+ * is promoted, so with regular samples the new minimum is at most three
+ * quarters of a window old; if samples are sparse it can briefly be older
+ * than the window until the next one arrives.
+ */
+struct min_filter_sample_t {
+	uint64_t time;
+	uint32_t value;
+};
+
+/*
+ * The value of an empty filter.
+ */
+#define MIN_FILTER_NONE 0xffffffff
+
+struct min_filter_t {
+	struct min_filter_sample_t s[3];
+};
+
+/*
+ * Empties the filter.
+ */
+void min_filter_clear (struct min_filter_t *filter);
+
+/*
+ * Adds a sample taken at the given time and returns the minimum over the
+ * window. The time and window must be in the same units, e.g. nanoseconds.
+ */
+uint32_t min_filter_update (struct min_filter_t *filter, uint64_t window, uint64_t time, uint32_t value);
+
+/*
+ * Returns the current windowed minimum, or MIN_FILTER_NONE if the filter
+ * is empty.
+ */
+uint32_t min_filter_get (struct min_filter_t *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*MINFILTER_H_ */
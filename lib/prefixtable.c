@@ -0,0 +1,286 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "prefixtable.h"
+
+/* The number of nodes by which the node array grows */
+#define PREFIX_TABLE_INCREMENT 64
+
+/* The number of entries in a node, one for each value of a byte */
+#define PREFIX_TABLE_FANOUT 256
+
+/*
+ * An entry of a trie node. It holds the value of the longest prefix that
+ * ends within this byte, if any, and the node for the next byte. Node 0 is
+ * always a root, so a child of 0 means there is none.
+ */
+struct prefix_entry_t {
+	uint32_t child;
+	int32_t value;
+
+	/* The length of the prefix the value came from, or 0 for none */
+	uint8_t length;
+};
+
+struct prefix_node_t {
+	struct prefix_entry_t entries[PREFIX_TABLE_FANOUT];
+};
+
+/*
+ * One trie for each address family.
+ */
+struct prefix_trie_t {
+	struct prefix_node_t *nodes;
+	uint32_t count;
+	uint32_t size;
+
+	/* The value of the zero length prefix, which matches everything */
+	int32_t default_value;
+
+	/* The number of bytes in an address */
+	int bytes;
+};
+
+struct prefix_table_t {
+	struct prefix_trie_t v4;
+	struct prefix_trie_t v6;
+};
+
+/*
+ * Sets up an empty trie, with only a root node.
+ */
+void prefix_trie_init (struct prefix_trie_t *trie, int bytes);
+
+/*
+ * Adds a node to a trie and returns its index.
+ */
+uint32_t prefix_trie_new_node (struct prefix_trie_t *trie);
+
+/*
+ * Returns the trie of an address family, or NULL.
+ */
+struct prefix_trie_t *prefix_table_trie (prefix_table_t * table, int family);
+
+
+
+/*
+ * Sets up an empty trie, with only a root node.
+ */
+void prefix_trie_init (struct prefix_trie_t *trie, int bytes) {
+	trie->nodes = NULL;
+	trie->count = 0;
+	trie->size = 0;
+	trie->default_value = PREFIX_TABLE_NONE;
+	trie->bytes = bytes;
+	prefix_trie_new_node (trie);
+}
+
+/*
+ * Adds a node to a trie and returns its index.
+ */
+uint32_t prefix_trie_new_node (struct prefix_trie_t *trie) {
+	int i;
+	struct prefix_node_t *node;
+
+	if (trie->count == trie->size) {
+		trie->size += PREFIX_TABLE_INCREMENT;
+		trie->nodes = realloc (trie->nodes, trie->size * sizeof (struct prefix_node_t));
+	}
+
+	node = &(trie->nodes[trie->count]);
+	for (i = 0; i < PREFIX_TABLE_FANOUT; i++) {
+		node->entries[i].child = 0;
+		node->entries[i].value = PREFIX_TABLE_NONE;
+		node->entries[i].length = 0;
+	}
+	return trie->count++;
+}
+
+/*
+ * Returns the trie of an address family, or NULL.
+ */
+struct prefix_trie_t *prefix_table_trie (prefix_table_t * table, int family) {
+	if (family == AF_INET)
+		return &(table->v4);
+	if (family == AF_INET6)
+		return &(table->v6);
+	return NULL;
+}
+
+/*
+ * Creates an empty prefix table.
+ */
+prefix_table_t *prefix_table_create () {
+	prefix_table_t *table = malloc (sizeof (prefix_table_t));
+	prefix_trie_init (&(table->v4), 4);
+	prefix_trie_init (&(table->v6), 16);
+	return table;
+}
+
+/*
+ * Frees a prefix table.
+ */
+void prefix_table_destroy (prefix_table_t * table) {
+	free (table->v4.nodes);
+	free (table->v6.nodes);
+	free (table);
+}
+
+/*
+ * Adds a prefix given as the address bytes and a length in bits. The
+ * family is AF_INET or AF_INET6. The value must not be negative. Adding a
+ * prefix that is already present replaces its value. Returns 0 on success
+ * or -1 if the family or length is not valid.
+ */
+int prefix_table_add (prefix_table_t * table, int family, const uint8_t * addr, int length, int value) {
+	struct prefix_trie_t *trie = prefix_table_trie (table, family);
+	struct prefix_entry_t *entry;
+	uint32_t node = 0;
+	uint32_t child;
+	int depth, last, span, first, i;
+
+	if (trie == NULL || length < 0 || length > trie->bytes * 8 || value < 0)
+		return -1;
+
+	if (length == 0) {
+		trie->default_value = value;
+		return 0;
+	}
+
+	/* Walk down to the node for the last byte of the prefix */
+	last = (length - 1) / 8;
+	for (depth = 0; depth < last; depth++) {
+		child = trie->nodes[node].entries[addr[depth]].child;
+		if (child == 0) {
+			/* The node array may move, so look the entry up again */
+			child = prefix_trie_new_node (trie);
+			trie->nodes[node].entries[addr[depth]].child = child;
+		}
+		node = child;
+	}
+
+	/* Expand the prefix over every entry it covers in the last byte,
+	 * unless a longer prefix is already there.
+	 */
+	span = 1 << (8 * (last + 1) - length);
+	first = addr[last] & ~(span - 1);
+	for (i = first; i < first + span; i++) {
+		entry = &(trie->nodes[node].entries[i]);
+		if (entry->length <= length) {
+			entry->value = value;
+			entry->length = length;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Adds a prefix written as text, e.g. "10.0.0.0/8" or "2001:db8::/32". An
+ * address without a length is a host route. Returns 0 on success or -1 if
+ * the text cannot be parsed.
+ */
+int prefix_table_add_string (prefix_table_t * table, const char *prefix, int value) {
+	char buf[INET6_ADDRSTRLEN + 8];
+	uint8_t addr[16];
+	char *slash, *end;
+	int family, length;
+
+	if (strlen (prefix) >= sizeof (buf)) {
+		fprintf (stderr, "Prefix too long: %s\n", prefix);
+		return -1;
+	}
+	strcpy (buf, prefix);
+
+	family = (strchr (buf, ':') != NULL) ? AF_INET6 : AF_INET;
+	length = (family == AF_INET) ? 32 : 128;
+
+	slash = strchr (buf, '/');
+	if (slash != NULL) {
+		*slash = '\0';
+		length = strtol (slash + 1, &end, 10);
+		if (*(slash + 1) == '\0' || *end != '\0') {
+			fprintf (stderr, "Bad prefix length: %s\n", prefix);
+			return -1;
+		}
+	}
+
+	if (inet_pton (family, buf, addr) != 1) {
+		fprintf (stderr, "Bad prefix address: %s\n", prefix);
+		return -1;
+	}
+
+	if (prefix_table_add (table, family, addr, length, value) < 0) {
+		fprintf (stderr, "Bad prefix: %s\n", prefix);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns the value of the longest prefix that matches an address, or
+ * PREFIX_TABLE_NONE.
+ */
+int prefix_table_lookup (prefix_table_t * table, int family, const uint8_t * addr) {
+	struct prefix_trie_t *trie = prefix_table_trie (table, family);
+	struct prefix_entry_t *entry;
+	uint32_t node = 0;
+	int value, depth;
+
+	if (trie == NULL)
+		return PREFIX_TABLE_NONE;
+
+	/* Each byte can only give a longer match than the one before */
+	value = trie->default_value;
+	for (depth = 0; depth < trie->bytes; depth++) {
+		entry = &(trie->nodes[node].entries[addr[depth]]);
+		if (entry->length > 0)
+			value = entry->value;
+		if (entry->child == 0)
+			break;
+		node = entry->child;
+	}
+	return value;
+}
+
+/*
+ * The same as prefix_table_lookup() for an IPv4 address, as found in an
+ * IP header.
+ */
+int prefix_table_lookup_v4 (prefix_table_t * table, uint32_t addr) {
+	return prefix_table_lookup (table, AF_INET, (const uint8_t *) &addr);
+}
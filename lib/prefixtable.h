@@ -0,0 +1,98 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef PREFIXTABLE_H_
+#define PREFIXTABLE_H_
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A prefix table maps IPv4 and IPv6 prefixes to integer values and finds
+ * the value of the longest prefix matching an address. It is a multibit
+ * trie with a stride of 8 bits, so a lookup reads at most one node per
+ * byte of the address: 4 for IPv4 and 16 for IPv6. Prefixes that do not
+ * end on a byte boundary are expanded over the entries they cover.
+ *
+ * Addresses are in network byte order throughout.
+ */
+typedef struct prefix_table_t prefix_table_t;
+
+/*
+ * The value returned when no prefix matches.
+ */
+#define PREFIX_TABLE_NONE -1
+
+/*
+ * Creates an empty prefix table.
+ */
+prefix_table_t *prefix_table_create ();
+
+/*
+ * Frees a prefix table.
+ */
+void prefix_table_destroy (prefix_table_t * table);
+
+/*
+ * Adds a prefix given as the address bytes and a length in bits. The
+ * family is AF_INET or AF_INET6. The value must not be negative. Adding a
+ * prefix that is already present replaces its value. Returns 0 on success
+ * or -1 if the family or length is not valid.
+ */
+int prefix_table_add (prefix_table_t * table, int family, const uint8_t * addr, int length, int value);
+
+/*
+ * Adds a prefix written as text, e.g. "10.0.0.0/8" or "2001:db8::/32". An
+ * address without a length is a host route. Returns 0 on success or -1 if
+ * the text cannot be parsed.
+ */
+int prefix_table_add_string (prefix_table_t * table, const char *prefix, int value);
+
+/*
+ * Returns the value of the longest prefix that matches an address, or
+ * PREFIX_TABLE_NONE.
+ */
+int prefix_table_lookup (prefix_table_t * table, int family, const uint8_t * addr);
+
+/*
+ * The same as prefix_table_lookup() for an IPv4 address, as found in an
+ * IP header.
+ */
+int prefix_table_lookup_v4 (prefix_table_t * table, uint32_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*PREFIXTABLE_H_ */
@@ -36,6 +36,7 @@
 #include <inttypes.h>
 #include <assert.h>
 
+#include "mempool.h"
 #include "queue.h"
 
 /*
@@ -69,7 +70,7 @@ struct queue_t {
  * Allocates a new queue.
  */
 struct queue_t *queue_create () {
-	struct queue_t *queue = malloc (sizeof (struct queue_t));
+	struct queue_t *queue = mem_alloc (sizeof (struct queue_t));
 
 	queue->buffer_size = 0;
 	queue->ptr = NULL;
@@ -83,9 +84,9 @@ struct queue_t *queue_create () {
  * Frees the memory associated with a queue.
  */
 void queue_destroy (struct queue_t *array) {
-	free (array->ptr);
+	mem_free (array->ptr);
 	array->ptr = NULL;
-	free (array);
+	mem_free (array);
 }
 
 /*
@@ -104,16 +105,22 @@ void *queue_add (struct queue_t *array, struct queue_vars_t *vars, void *item) {
 		} else {
 			array->buffer_size = vars->buffer_size;
 		}
-		array->ptr = malloc (array->buffer_size * vars->item_size);
+		array->ptr = mem_alloc (array->buffer_size * vars->item_size);
 	} else if (vars->buffer_size == -1) {	/* We have an expanding queue */
 		if (array->length == array->buffer_size) {
 			char *new_ptr;
 			int bytes1;
 			int bytes2;
 
-			/* Allocate more space */
-			array->buffer_size += vars->buffer_increment;
-			new_ptr = malloc (array->buffer_size * vars->item_size);
+			/* Allocate more space. The queue grows by half, and by at
+			 * least the increment, so that a long queue, e.g. of many
+			 * sessions ending at once, is seldom copied.
+			 */
+			if (array->buffer_size / 2 > (uint32_t) vars->buffer_increment)
+				array->buffer_size += array->buffer_size / 2;
+			else
+				array->buffer_size += vars->buffer_increment;
+			new_ptr = mem_alloc (array->buffer_size * vars->item_size);
 
 			assert(array->lower_idx <= array->length);
 			assert(array->length <= array->buffer_size);
@@ -125,7 +132,7 @@ void *queue_add (struct queue_t *array, struct queue_vars_t *vars, void *item) {
 			memcpy (&(new_ptr[bytes1]), array->ptr, bytes2);
 
 			/* Free old memory */
-			free (array->ptr);
+			mem_free (array->ptr);
 			array->ptr = new_ptr;
 			array->lower_idx = 0;
 		}
@@ -180,6 +187,13 @@ void queue_clear (struct queue_t *array) {
 	array->lower_idx = 0;
 }
 
+/*
+ * Returns the number of elements in the queue.
+ */
+unsigned int queue_length (struct queue_t *array) {
+	return array->length;
+}
+
 /*
  * Returns the lowest element of the queue.
  */
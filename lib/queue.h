@@ -43,7 +43,8 @@ typedef struct queue_t queue_t;
 /*
  * The queue_vars struct holds the buffer size of the queue and how much the
  * buffer can be incremented by. An increment of -1 allows the queue to grow
- * indefinitely. The item size gives the size of the queue elements
+ * indefinitely, by half its size or the increment, whichever is larger. The
+ * item size gives the size of the queue elements
  */
 struct queue_vars_t {
 	int buffer_size;
@@ -85,6 +86,11 @@ void *queue_remove (struct queue_t *queue, struct queue_vars_t *vars);
  */
 void queue_clear (struct queue_t *queue);
 
+/*
+ * Returns the number of elements in the queue.
+ */
+unsigned int queue_length (struct queue_t *queue);
+
 /*
  * Returns the lowest element of the queue.
  */
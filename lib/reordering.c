@@ -33,17 +33,44 @@
 #include <libtrace.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "sessionmanager.h"
+#include "tcpsession.h"
 #include "rttmodule.h"
+#include "seqnum.h"
+#include "serialize.h"
+#include "mempool.h"
 #include "reordering.h"
 
 #define REORDERING_ARRAY_INCREMENT 20
 
+/* The most packet records a window holds, the range of its 16-bit indices */
+#define REORDERING_ARRAY_MAX 0xffff
+
+/* The TCP option kind of a SACK option and the most blocks it can hold */
+#define TCP_OPTION_SACK 5
+#define SACK_MAX_BLOCKS 4
+
+/* The number of segments that must be SACKed above a hole before the sender
+ * deems it lost, as DupThresh in RFC 6675.
+ */
+#define SACK_DUP_THRESH 3
+
+/* The number of recent arrivals kept for n-reordering, which includes the
+ * packet itself.
+ */
+#define REORDERING_RECENT (REORDERING_N_MAX + 1)
+
 #define RTT_FACTOR 0.9
 #define RTO_FACTOR 2.0
 
-/* The module used for the RTT calculation */
-struct rtt_module_t *rtt_module;
+/*
+ * The settings of a reordering module.
+ */
+struct reordering_config_t {
+	/* The module used for the RTT calculation */
+	struct rtt_module_t *rtt_module;
+};
 
 /* Allows useful output of the reordering */
 const char *reordering_messages[] = {
@@ -60,7 +87,9 @@ const char *reordering_messages[] = {
 	"network duplicate",
 
 	"unknown",					/* 10 */
-	"network reordering"
+	"network reordering",
+	"unneeded retransmission (already sacked)",	/* 12 */
+	"retransmission (sacked above)"
 };
 
 /*
@@ -70,8 +99,13 @@ struct packet_record_t {
 	/* The sequence number of the packet */
 	uint32_t seq;
 
-	/* The time the packet was sent */
-	double time;
+	/* The time the packet was sent, on the 32 bit microsecond clock */
+	uint32_t time;
+
+	/* The arrival index of the packet or, for a missing packet, of the
+	 * packet that showed it was missing.
+	 */
+	uint32_t arrival;
 
 	/* The IP ID of the packet */
 	uint16_t ip_id;
@@ -84,7 +118,12 @@ struct packet_record_t {
 
 	/* Holds if any misalignment occurs */
 	unsigned int is_misaligned:1;
-	unsigned int padding:6;
+
+	/* Holds if the receiver has selectively acknowledged all of the data
+	 * up to the next record. Runs of these are merged into one record.
+	 */
+	unsigned int is_sacked:1;
+	unsigned int padding:5;
 
 	/* Points to extra missing packets when they arrive. The problem that
 	 * this linked list solves is the following. Suppose packet 10 arrives,
@@ -117,8 +156,28 @@ struct sender_record_t {
 	 */
 	uint32_t expected_seq;
 
+	/* Holds if expected_seq has been set, either from a SYN or from the
+	 * first data packet of a session that was picked up part way through.
+	 */
+	uint8_t expected_valid;
+
 	/* This is used to see if the sender is in a recovery mode. */
 	uint8_t in_recovery;
+
+	/* The number of packets that have arrived, not counting duplicates,
+	 * which gives the arrival index of the next packet.
+	 */
+	uint32_t arrivals;
+
+	/* The sequence numbers of the most recent arrivals, for n-reordering,
+	 * with recent_idx the place of the next one.
+	 */
+	uint32_t recent[REORDERING_RECENT];
+	uint8_t recent_idx;
+	uint8_t recent_count;
+
+	/* The largest payload seen, as an estimate of the sender's MSS. */
+	uint16_t mss;
 };
 
 /*
@@ -128,7 +187,8 @@ struct reordering_t {
 	/* The packets from each half of the connection. */
 	struct sender_record_t record[2];
 
-	/* For RTT module */
+	/* For RTT module, which is fixed when the session is created */
+	struct rtt_module_t *rtt_module;
 	void *rtt_data;
 
 	/* Holds the minimum rtt */
@@ -137,7 +197,25 @@ struct reordering_t {
 	/* For meaningful output of the last packet. */
 	reordering_type_t last_packet;
 	int last_packet_message;
-	double time_lag;
+	uint32_t time_lag;		/* microseconds */
+
+	/* Per-session totals of the data packet classifications. */
+	uint32_t type_counts[LAST_REORDERING];
+	uint32_t message_counts[REORDERING_MESSAGE_COUNT];
+
+	/* Log-bucketed histograms of the time lag (in microseconds) and the
+	 * extent (in bytes below the expected sequence number) of late packets.
+	 */
+	uint32_t time_lag_histogram[REORDERING_HISTOGRAM_BUCKETS];
+	uint32_t extent_histogram[REORDERING_HISTOGRAM_BUCKETS];
+
+	/* The RFC 4737 and RFC 5236 metrics of each direction. */
+	struct {
+		uint32_t reordered;
+		uint32_t packet_extent[REORDERING_EXTENT_MAX + 1];
+		uint32_t n_reordering[REORDERING_N_MAX + 1];
+		uint32_t density[2 * REORDERING_DENSITY_THRESHOLD + 1];
+	} metrics[2];
 };
 
 
@@ -149,7 +227,7 @@ void packet_record_free_missing_links (struct packet_record_t *packet);
 /*
  * Adds a new record to the array of packet records.
  */
-struct packet_record_t *sender_record_add (struct sender_record_t *record, uint32_t seq, double time, uint16_t ip_id);
+struct packet_record_t *sender_record_add (struct sender_record_t *record, uint32_t seq, uint32_t time, uint16_t ip_id);
 
 /*
  * Acknowledges as many packets in the array as possible, freeing 
@@ -162,6 +240,57 @@ void sender_record_ack (struct sender_record_t *record, uint32_t ack);
  */
 struct packet_record_t *sender_record_find (struct sender_record_t *record, uint32_t seq);
 
+/*
+ * Marks the packet records that lie wholly within a SACK block as sacked,
+ * freeing their missing links. Returns 1 if any record was marked.
+ */
+int sender_record_sack (struct sender_record_t *record, uint32_t left, uint32_t right);
+
+/*
+ * Merges each run of sacked packet records into its first record, which
+ * shrinks the queue while keeping the sacked ranges known.
+ */
+void sender_record_compact (struct sender_record_t *record);
+
+/*
+ * Returns the number of bytes above seq that the receiver has sacked.
+ */
+uint32_t sender_record_sacked_above (struct sender_record_t *record, uint32_t seq);
+
+/*
+ * Reads the SACK blocks of an ACK into the record of the other direction.
+ */
+void reordering_process_sack (struct sender_record_t *record, const struct libtrace_tcp *tcp);
+
+/*
+ * Returns the histogram bucket for a value. Bucket 0 holds zero and bucket
+ * i holds values in [2^(i-1), 2^i), with the last bucket holding the rest.
+ */
+int reordering_histogram_bucket (uint32_t value);
+
+/*
+ * Counts the arrival of a packet that is not a duplicate and returns its
+ * arrival index.
+ */
+uint32_t sender_record_arrive (struct sender_record_t *record, uint32_t seq);
+
+/*
+ * Updates the reordering metrics of a direction with a packet that filled
+ * a gap, which arrived with the given arrival index. The earliest packet
+ * with a higher sequence number arrived with gap_arrival.
+ */
+void reordering_metrics_update (struct reordering_t *reordering, int direction, uint32_t seq, uint32_t arrival, uint32_t gap_arrival);
+
+/*
+ * Writes a packet record, and its chain of missing links, for a checkpoint.
+ */
+void packet_record_serialize (struct packet_record_t *packet, struct serial_t *serial);
+
+/*
+ * Reads a packet record, and its chain of missing links, from a checkpoint.
+ */
+void packet_record_deserialize (struct packet_record_t *packet, struct serial_t *serial);
+
 /*
  * Frees the missing links of a packet.
  */
@@ -170,7 +299,7 @@ void packet_record_free_missing_links (struct packet_record_t *packet) {
 
 	if (packet->missing_link != NULL) {
 		packet_record_free_missing_links (packet->missing_link);
-		free (packet->missing_link);
+		mem_free (packet->missing_link);
 		packet->missing_link = NULL;
 	}
 }
@@ -178,18 +307,34 @@ void packet_record_free_missing_links (struct packet_record_t *packet) {
 /*
  * Adds a new record to the array of packet records.
  */
-struct packet_record_t *sender_record_add (struct sender_record_t *record, uint32_t seq, double time, uint16_t ip_id) {
+struct packet_record_t *sender_record_add (struct sender_record_t *record, uint32_t seq, uint32_t time, uint16_t ip_id) {
 
-	int idx, i;
+	int idx, i, size;
 	struct packet_record_t *new_array = NULL;
 
+	/* A full window at the largest size, e.g. on a one-sided capture that
+	 * never sees the ACKs that drain it, retires its oldest record.
+	 */
+	if (record->length == REORDERING_ARRAY_MAX) {
+		packet_record_free_missing_links (&(record->array[record->lower_idx]));
+		record->lower_idx++;
+		if (record->lower_idx == record->array_size)
+			record->lower_idx = 0;
+		record->length--;
+	}
+
 	/* Check if there is space in the array */
 	if (record->length == record->array_size) {
 
-		/* No space, so need to increase the buffer. */
+		/* No space, so need to increase the buffer. It grows by half,
+		 * so that a long window of packets is not copied at every step.
+		 */
 
-		record->array_size += REORDERING_ARRAY_INCREMENT;
-		new_array = malloc (record->array_size * sizeof (struct packet_record_t));
+		size = record->array_size + record->array_size / 2;
+		if (size < record->array_size + REORDERING_ARRAY_INCREMENT)
+			size = record->array_size + REORDERING_ARRAY_INCREMENT;
+		record->array_size = (size > REORDERING_ARRAY_MAX) ? REORDERING_ARRAY_MAX : size;
+		new_array = mem_alloc (record->array_size * sizeof (struct packet_record_t));
 
 		i = 0;
 		idx = record->lower_idx;
@@ -200,11 +345,13 @@ struct packet_record_t *sender_record_add (struct sender_record_t *record, uint3
 			new_array[i].ip_id = record->array[idx].ip_id;
 			new_array[i].is_misaligned = record->array[idx].is_misaligned;
 			new_array[i].is_missing = record->array[idx].is_missing;
+			new_array[i].is_sacked = record->array[idx].is_sacked;
 			new_array[i].missing_link = record->array[idx].missing_link;
 			new_array[i].num_acks = record->array[idx].num_acks;
 			new_array[i].padding = record->array[idx].padding;
 			new_array[i].seq = record->array[idx].seq;
 			new_array[i].time = record->array[idx].time;
+			new_array[i].arrival = record->array[idx].arrival;
 
 			i++;
 			idx = (idx + 1) % record->length;
@@ -216,7 +363,7 @@ struct packet_record_t *sender_record_add (struct sender_record_t *record, uint3
 			new_array[i].seq = 0;
 		}
 
-		free (record->array);
+		mem_free (record->array);
 		record->array = new_array;
 		record->lower_idx = 0;
 	}
@@ -229,8 +376,10 @@ struct packet_record_t *sender_record_add (struct sender_record_t *record, uint3
 	record->array[idx].num_acks = 0;
 	record->array[idx].seq = seq;
 	record->array[idx].time = time;
+	record->array[idx].arrival = record->arrivals;
 	record->array[idx].ip_id = ip_id;
 	record->array[idx].is_missing = 0;
+	record->array[idx].is_sacked = 0;
 	record->array[idx].missing_link = NULL;
 
 	record->length++;
@@ -253,7 +402,7 @@ void sender_record_ack (struct sender_record_t *record, uint32_t ack) {
 		return;
 
 	/* Check that this ack can acknowledge at least the current minimum */
-	if (ack <= record->array[record->lower_idx].seq)
+	if (SEQ_LEQ (ack, record->array[record->lower_idx].seq))
 		return;
 
 	/* Store old lower index for clean up at end */
@@ -263,7 +412,7 @@ void sender_record_ack (struct sender_record_t *record, uint32_t ack) {
 	while (record->length > 1 && record->array_size > 0) {
 
 		/* Test the next record to see if it can be acknowledged */
-		if (ack <= record->array[(record->lower_idx + 1) % record->array_size].seq)
+		if (SEQ_LEQ (ack, record->array[(record->lower_idx + 1) % record->array_size].seq))
 			break;
 
 		/* Acknowledge current record by moving on */
@@ -278,7 +427,7 @@ void sender_record_ack (struct sender_record_t *record, uint32_t ack) {
 	/* Look for packet in linked list */
 	while (packet->missing_link != NULL) {
 		/* Test the next record to see if it can be acknowledged */
-		if (ack <= packet->missing_link->seq)
+		if (SEQ_LEQ (ack, packet->missing_link->seq))
 			break;
 
 		/* Acknowledge current record by moving on */
@@ -322,7 +471,7 @@ struct packet_record_t *sender_record_find (struct sender_record_t *record, uint
 	int counter=0;
 	for (counter = 0; counter < record->length; counter++) {
 
-		if (record->array[idx].seq > seq)
+		if (SEQ_GT (record->array[idx].seq, seq))
 			break;
 
 		packet = &(record->array[idx]);
@@ -342,7 +491,7 @@ struct packet_record_t *sender_record_find (struct sender_record_t *record, uint
 	while (packet->missing_link != NULL) {
 		/* Go through list */
 
-		if (packet->missing_link->seq > seq)
+		if (SEQ_GT (packet->missing_link->seq, seq))
 			break;
 
 		packet = packet->missing_link;
@@ -351,13 +500,206 @@ struct packet_record_t *sender_record_find (struct sender_record_t *record, uint
 	return packet;
 }
 
+/*
+ * Marks the packet records that lie wholly within a SACK block as sacked,
+ * freeing their missing links. Returns 1 if any record was marked.
+ */
+int sender_record_sack (struct sender_record_t *record, uint32_t left, uint32_t right) {
+	struct packet_record_t *packet;
+	uint32_t end;
+	int idx = record->lower_idx, next, counter, marked = 0;
+
+	for (counter = 0; counter < record->length; counter++) {
+		packet = &(record->array[idx]);
+		if (SEQ_GEQ (packet->seq, right))
+			break;
+
+		next = idx + 1;
+		if (next == record->array_size)
+			next = 0;
+
+		/* A record covers the data up to the next record */
+		end = (counter + 1 < record->length) ? record->array[next].seq : record->expected_seq;
+
+		if (!packet->is_sacked && SEQ_GEQ (packet->seq, left) && SEQ_LEQ (end, right)) {
+			packet->is_sacked = 1;
+			packet_record_free_missing_links (packet);
+			marked = 1;
+		}
+		idx = next;
+	}
+	return marked;
+}
+
+/*
+ * Merges each run of sacked packet records into its first record, which
+ * shrinks the queue while keeping the sacked ranges known.
+ */
+void sender_record_compact (struct sender_record_t *record) {
+	int from = record->lower_idx, to = record->lower_idx;
+	int counter, length = record->length;
+
+	if (length == 0)
+		return;
+
+	/* The first record is always kept */
+	for (counter = 1; counter < length; counter++) {
+		from++;
+		if (from == record->array_size)
+			from = 0;
+
+		if (record->array[from].is_sacked && record->array[to].is_sacked) {
+			record->length--;
+			continue;
+		}
+
+		to++;
+		if (to == record->array_size)
+			to = 0;
+		if (to != from) {
+			record->array[to] = record->array[from];
+			record->array[from].missing_link = NULL;
+		}
+	}
+}
+
+/*
+ * Returns the number of bytes above seq that the receiver has sacked.
+ */
+uint32_t sender_record_sacked_above (struct sender_record_t *record, uint32_t seq) {
+	struct packet_record_t *packet;
+	uint32_t end, sacked = 0;
+	int idx = record->lower_idx, next, counter;
+
+	for (counter = 0; counter < record->length; counter++) {
+		packet = &(record->array[idx]);
+		next = idx + 1;
+		if (next == record->array_size)
+			next = 0;
+
+		if (packet->is_sacked && SEQ_GT (packet->seq, seq)) {
+			end = (counter + 1 < record->length) ? record->array[next].seq : record->expected_seq;
+			sacked += end - packet->seq;
+		}
+		idx = next;
+	}
+	return sacked;
+}
+
+/*
+ * Reads the SACK blocks of an ACK into the record of the other direction.
+ */
+void reordering_process_sack (struct sender_record_t *record, const struct libtrace_tcp *tcp) {
+	unsigned char *pkt = (unsigned char *) tcp + sizeof (*tcp);
+	int plen = tcp->doff * 4 - sizeof (*tcp);
+	unsigned char type = 0, optlen = 0, *optdata = NULL;
+	uint32_t ack = ntohl (tcp->ack_seq), left, right;
+	int i, blocks, marked = 0;
+
+	if (record->length == 0 || plen <= 0)
+		return;
+
+	while (trace_get_next_option (&pkt, &plen, &type, &optlen, &optdata)) {
+		if (type != TCP_OPTION_SACK || optlen < 10)
+			continue;
+
+		blocks = (optlen - 2) / 8;
+		if (blocks > SACK_MAX_BLOCKS)
+			blocks = SACK_MAX_BLOCKS;
+
+		for (i = 0; i < blocks; i++) {
+			memcpy (&left, optdata + i * 8, sizeof (left));
+			memcpy (&right, optdata + i * 8 + 4, sizeof (right));
+			left = ntohl (left);
+			right = ntohl (right);
+
+			/* Skip D-SACK blocks and blocks that make no sense */
+			if (SEQ_LEQ (right, ack) || !SEQ_LT (left, right))
+				continue;
+			marked |= sender_record_sack (record, left, right);
+		}
+	}
+
+	if (marked)
+		sender_record_compact (record);
+}
+
+/*
+ * Counts the arrival of a packet that is not a duplicate and returns its
+ * arrival index.
+ */
+uint32_t sender_record_arrive (struct sender_record_t *record, uint32_t seq) {
+	record->recent[record->recent_idx] = seq;
+	record->recent_idx = (record->recent_idx + 1) % REORDERING_RECENT;
+	if (record->recent_count < REORDERING_RECENT)
+		record->recent_count++;
+	return record->arrivals++;
+}
+
+/*
+ * Updates the reordering metrics of a direction with a packet that filled
+ * a gap, which arrived with the given arrival index. The earliest packet
+ * with a higher sequence number arrived with gap_arrival.
+ */
+void reordering_metrics_update (struct reordering_t *reordering, int direction, uint32_t seq, uint32_t arrival, uint32_t gap_arrival) {
+	struct sender_record_t *record = &(reordering->record[direction]);
+	uint32_t extent = arrival - gap_arrival;
+	uint32_t early, *density = reordering->metrics[direction].density;
+	int n, idx;
+
+	reordering->metrics[direction].reordered++;
+
+	/* RFC 4737 reordering extent: how many packets it arrived after the
+	 * earliest packet with a higher sequence number.
+	 */
+	reordering->metrics[direction].packet_extent[extent < REORDERING_EXTENT_MAX ? extent : REORDERING_EXTENT_MAX]++;
+
+	/* RFC 4737 n-reordering: how many of the packets that arrived just
+	 * before it had higher sequence numbers. The packet itself is the
+	 * most recent entry.
+	 */
+	idx = (record->recent_idx + REORDERING_RECENT - 1) % REORDERING_RECENT;
+	for (n = 0; n + 1 < record->recent_count; n++) {
+		idx = (idx + REORDERING_RECENT - 1) % REORDERING_RECENT;
+		if (!SEQ_GT (record->recent[idx], seq))
+			break;
+	}
+	reordering->metrics[direction].n_reordering[n]++;
+
+	/* RFC 5236 reorder density: the packet is displaced late by its
+	 * extent, and each packet that overtook it was counted as on time but
+	 * arrived one place early. Displacements beyond the threshold are
+	 * treated as losses and not counted.
+	 */
+	if (extent <= REORDERING_DENSITY_THRESHOLD) {
+		density[REORDERING_DENSITY_THRESHOLD + extent]++;
+		early = (density[REORDERING_DENSITY_THRESHOLD] < extent) ? density[REORDERING_DENSITY_THRESHOLD] : extent;
+		density[REORDERING_DENSITY_THRESHOLD] -= early;
+		density[REORDERING_DENSITY_THRESHOLD - 1] += early;
+	}
+}
+
+/*
+ * Returns the histogram bucket for a value. Bucket 0 holds zero and bucket
+ * i holds values in [2^(i-1), 2^i), with the last bucket holding the rest.
+ */
+int reordering_histogram_bucket (uint32_t value) {
+	int bucket = 0;
+
+	while (value != 0 && bucket < REORDERING_HISTOGRAM_BUCKETS - 1) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
 /*
  * Allocates and initialises a new data structure for a new tcp session.
  * Nothing is allocated to the packet record until data starts moving.
  * This is more efficient in both memory and time.
  */
-void *reordering_create () {
-	struct reordering_t *reordering = malloc (sizeof (struct reordering_t));
+void *reordering_create (void *config) {
+	struct reordering_t *reordering = mem_alloc (sizeof (struct reordering_t));
 	int i;
 	for (i = 0; i < 2; i++) {
 		reordering->record[i].lower_idx = 0;
@@ -365,12 +707,28 @@ void *reordering_create () {
 		reordering->record[i].array_size = 0;
 		reordering->record[i].array = NULL;
 		reordering->record[i].expected_seq = 0;
+		reordering->record[i].expected_valid = 0;
 		reordering->record[i].in_recovery = 0;		
+		reordering->record[i].arrivals = 0;
+		reordering->record[i].recent_idx = 0;
+		reordering->record[i].recent_count = 0;
+		reordering->record[i].mss = 0;
 	}
 
-	reordering->rtt_data = rtt_module->session_module.create ();
+	/* Without an RTT scheme the RTT stays unknown */
+	reordering->rtt_module = ((struct reordering_config_t *) config)->rtt_module;
+	reordering->rtt_data = NULL;
+	if (reordering->rtt_module != NULL)
+		reordering->rtt_data = reordering->rtt_module->session_module.create (
+				reordering->rtt_module->session_module.config);
 
 	reordering->min_rtt=-1.0;
+
+	memset (reordering->type_counts, 0, sizeof (reordering->type_counts));
+	memset (reordering->message_counts, 0, sizeof (reordering->message_counts));
+	memset (reordering->time_lag_histogram, 0, sizeof (reordering->time_lag_histogram));
+	memset (reordering->extent_histogram, 0, sizeof (reordering->extent_histogram));
+	memset (reordering->metrics, 0, sizeof (reordering->metrics));
 	
 	return reordering;
 }
@@ -383,7 +741,8 @@ void reordering_destroy (void *data) {
 	int i;
 
 	/* Free RTT first */
-	rtt_module->session_module.destroy (reordering->rtt_data);
+	if (reordering->rtt_module != NULL)
+		reordering->rtt_module->session_module.destroy (reordering->rtt_data);
 	reordering->rtt_data = NULL;
 
 	/* Free missing links */
@@ -394,77 +753,89 @@ void reordering_destroy (void *data) {
 		packet_record_free_missing_links (&(reordering->record[1].array[i]));
 	}
 
-	free (reordering->record[0].array);
-	free (reordering->record[1].array);
-	free (data);
+	mem_free (reordering->record[0].array);
+	mem_free (reordering->record[1].array);
+	mem_free (data);
 }
 
 /*
  * Updates the the reordering given a new packet belonging to the flow.
  */
-void reordering_update (void *data, struct libtrace_packet_t *packet) {
+int reordering_update (void *data, const struct session_packet_t *packet) {
 	struct reordering_t *reordering = (struct reordering_t *) data;
-	double time_lag, rtt, rto, inside_rtt, outside_rtt;
+	double inside_rtt, outside_rtt;
+	int64_t rtt, rto;
+	uint32_t time_lag, arrival;
 	struct packet_record_t *packet_record, *prev_packet_record, *next_packet_record;
 	int payload;
 	uint32_t seq;
 	uint16_t ip_id;
-	struct libtrace_ip *ip = NULL;
-	struct libtrace_tcp *tcp = NULL;
+	const struct libtrace_ip *ip = packet->ip;
+	const struct libtrace_tcp *tcp = packet->tcp;
 	int direction;
-	double time;
+	uint32_t time;
 	struct sender_record_t *record = NULL;
 
-	ip = trace_get_ip ((struct libtrace_packet_t *)packet);
-	tcp = trace_get_tcp ((struct libtrace_packet_t *)packet);
-	direction = trace_get_direction (packet);
-	time = trace_get_seconds (packet);
-	payload = ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	direction = packet->direction;
+	time = TCP_TIME_USEC32 (packet->time);
+	payload = packet->payload;
 	seq = ntohl (tcp->seq);
 	ip_id = ntohs (ip->ip_id);
 	
 	if (direction < 0 || direction > 1)
-		return;
+		return SM_WANT_ALL;
 
 	record = &(reordering->record[direction]);
 
-	/* Update RTT first */
-	rtt_module->session_module.update (reordering->rtt_data, packet);
-
-	/* Get RTT and RTO */
-	rtt = -1.0;
-	rto = -1.0;
-	inside_rtt = rtt_module->inside_rtt (reordering->rtt_data);
-	outside_rtt = rtt_module->outside_rtt (reordering->rtt_data);
+	/* Get RTT and RTO, in microseconds to compare with the time lag */
+	rtt = -1;
+	rto = -1;
+	inside_rtt = -1.0;
+	outside_rtt = -1.0;
+	if (reordering->rtt_module != NULL) {
+		/* Update RTT first */
+		reordering->rtt_module->session_module.update (reordering->rtt_data, packet);
+		inside_rtt = reordering->rtt_module->inside_rtt (reordering->rtt_data);
+		outside_rtt = reordering->rtt_module->outside_rtt (reordering->rtt_data);
+	}
 	if ((inside_rtt >= 0.0) && (outside_rtt >= 0.0)) {
-		rtt = inside_rtt + outside_rtt;
-		rto = RTO_FACTOR * rtt;
+		rto = (int64_t) (RTO_FACTOR * (inside_rtt + outside_rtt) * 1e6);
 		/* Update minimum RTT */
-		if((reordering->min_rtt < rtt) || (reordering->min_rtt < 0.0)) {
-			reordering->min_rtt=rtt;
+		if((reordering->min_rtt > inside_rtt + outside_rtt) || (reordering->min_rtt < 0.0)) {
+			reordering->min_rtt = inside_rtt + outside_rtt;
 		}
-		rtt = RTT_FACTOR*reordering->min_rtt;
+		rtt = (int64_t) (RTT_FACTOR * reordering->min_rtt * 1e6);
 	}
 
 	/* Assume current packet is in order */
 	reordering->last_packet = INORDER;
 	reordering->last_packet_message = 0;
-	reordering->time_lag = 0.0;
+	reordering->time_lag = 0;
 
 	/* If packet is a SYN, then set the  ACK */
 	if (tcp->syn) {
 		record->expected_seq = seq + 1;
-		return;
+		record->expected_valid = 1;
+		return SM_WANT_ALL;
 	}
 	/* Check if it's a data packet */
 	if (payload > 0) {
 
+		if (payload > record->mss)
+			record->mss = (payload > 0xffff) ? 0xffff : payload;
+
+		/* Without a SYN, the first packet seen sets the expected_seq */
+		if (!record->expected_valid) {
+			record->expected_seq = seq;
+			record->expected_valid = 1;
+		}
+
 		/* Check expected_seq against actual */
-		if (seq > record->expected_seq) {
+		if (SEQ_GT (seq, record->expected_seq)) {
 			/*printf ("Too high\n"); */
 			reordering->last_packet = HIGH;
 			reordering->last_packet_message = 1;
-			reordering->time_lag = 0.0;
+			reordering->time_lag = 0;
 
 			/* Make two records, one corresponding to the missing packet
 			 * the other corresponding to the packet seen
@@ -477,6 +848,8 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 
 			/* Second record */
 			sender_record_add (record, seq, time, ip_id);
+			sender_record_arrive (record, seq);
+			reordering->metrics[direction].density[REORDERING_DENSITY_THRESHOLD]++;
 
 			/* Change expected_seq */
 			record->expected_seq = seq + payload;
@@ -494,6 +867,8 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 
 			/* Add details to array */
 			sender_record_add (record, seq, time, ip_id);
+			sender_record_arrive (record, seq);
+			reordering->metrics[direction].density[REORDERING_DENSITY_THRESHOLD]++;
 
 			/* Change expected_seq */
 			record->expected_seq += payload;
@@ -506,7 +881,7 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 				/*printf ("OO: unneeded retransmission (not found. Data: expected=%8x observed=%8x minimum=%8x)\n", record->expected_seq, seq, record->array[record->lower_idx].seq); */
 				reordering->last_packet = RETRANSMISSION;
 				reordering->last_packet_message = 2;
-				reordering->time_lag = 0.0;
+				reordering->time_lag = 0;
 			} else {
 
 				/* Find time lag */
@@ -517,6 +892,10 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 					/*printf ("OO: unneeded retransmission (already acked)\n"); */
 					reordering->last_packet = RETRANSMISSION;
 					reordering->last_packet_message = 3;
+				} else if (packet_record->is_sacked) {
+					/* printf ("OO: unneeded retransmission (already sacked)\n"); */
+					reordering->last_packet = RETRANSMISSION;
+					reordering->last_packet_message = 12;
 				} else {
 					prev_packet_record = sender_record_find (record, seq - 1);
 					if (prev_packet_record == NULL) {
@@ -526,6 +905,12 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 					} else {
 						int dup_acks = prev_packet_record->num_acks;
 
+						/* With SACK, the sender deems the packet lost once enough
+						 * data above it has been sacked, as in RFC 6675.
+						 */
+						int sack_lost = record->mss > 0 && sender_record_sacked_above (record, seq) >
+								(uint32_t) (SACK_DUP_THRESH - 1) * record->mss;
+
 						/* printf("Time lag=%.6f \t RTT=%.6f \t RTO=%.6f\n", time_lag, rtt, rto); */
 
 						if (packet_record->is_missing == 0) {
@@ -547,7 +932,7 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 5;
 								record->in_recovery = 1;
-							} else if ((rto >= 0.0) && (time_lag > rto)) {
+							} else if ((rto >= 0) && (time_lag > rto)) {
 								/* printf ("OO: retransmission (time_lag > rto)"); */
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 6;
@@ -557,11 +942,16 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 7;
 								record->in_recovery = 1;
+							} else if (sack_lost) {
+								/* printf ("OO: retransmission (sacked above)\n"); */
+								reordering->last_packet = RETRANSMISSION;
+								reordering->last_packet_message = 13;
+								record->in_recovery = 1;
 							} else if (record->in_recovery) {
 								/* printf ("OO: retransmission (in recovery)\n"); */
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 8;
-							} else if ((rtt >= 0.0) && (time_lag < rtt)) {
+							} else if ((rtt >= 0) && (time_lag < rtt)) {
 								/* printf ("OO: network duplicate\n"); */
 								reordering->last_packet = NETWORK_DUPLICATE;
 								reordering->last_packet_message = 9;
@@ -580,9 +970,10 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 								if (next_packet_record->seq == seq) {
 									/* next 'not found', so create missing link */
 									/* printf ("Missing link created for %8x\n", seq + payload); */
-									next_packet_record = malloc (sizeof (struct packet_record_t));
+									next_packet_record = mem_alloc (sizeof (struct packet_record_t));
 									next_packet_record->ip_id = 0;
 									next_packet_record->is_missing = 1;
+									next_packet_record->is_sacked = 0;
 									next_packet_record->missing_link = packet_record->missing_link;
 									next_packet_record->num_acks = 0;
 									next_packet_record->seq = seq + payload;
@@ -592,6 +983,7 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 									 * but it is not yet known if the missing packet is size 20
 									 */
 									next_packet_record->time = packet_record->time;
+									next_packet_record->arrival = packet_record->arrival;
 									packet_record->missing_link = next_packet_record;
 								}
 							} else {
@@ -603,7 +995,12 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 7;
 								record->in_recovery = 1;
-							} else if ((rto >= 0.0) && (time_lag > rto)) {
+							} else if (sack_lost) {
+								/* printf ("OO: retransmission (sacked above)\n"); */
+								reordering->last_packet = RETRANSMISSION;
+								reordering->last_packet_message = 13;
+								record->in_recovery = 1;
+							} else if ((rto >= 0) && (time_lag > rto)) {
 								/* printf ("OO: retransmission (time_lag > rto)"); */
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 6;
@@ -612,7 +1009,7 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 								/* printf ("OO: retransmission (in recovery)\n"); */
 								reordering->last_packet = RETRANSMISSION;
 								reordering->last_packet_message = 8;
-							} else if ((rtt >= 0.0) && (time_lag < rtt)) {
+							} else if ((rtt >= 0) && (time_lag < rtt)) {
 								/* printf ("OO: network reordering\n"); */
 								reordering->last_packet = NETWORK_REORDERING;
 								reordering->last_packet_message = 11;
@@ -625,13 +1022,219 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
 					} /* END prev packet record not null */
 				} /* END else already acked */
 			} /* END else packet_record is not NULL */
+
+			/* A packet that filled a gap counts as an arrival. Retransmissions
+			 * were sent late rather than reordered.
+			 */
+			if (packet_record != NULL && packet_record->is_missing) {
+				arrival = sender_record_arrive (record, seq);
+				if (reordering->last_packet != RETRANSMISSION)
+					reordering_metrics_update (reordering, direction, seq, arrival, packet_record->arrival);
+			}
+
+			/* Record how late the packet was */
+			reordering->time_lag_histogram[reordering_histogram_bucket (reordering->time_lag)]++;
+			reordering->extent_histogram[reordering_histogram_bucket (record->expected_seq - seq)]++;
 		} /* END else sequence is too low */
 
+		/* Keep the per-session totals */
+		reordering->type_counts[reordering->last_packet]++;
+		reordering->message_counts[reordering->last_packet_message]++;
+
 	} /* END if (payload > 0) */
 	/* Process acknowledgement */
 	record = &(reordering->record[1 - direction]);
 	sender_record_ack (record, ntohl (tcp->ack_seq));
+	if (tcp->ack && tcp->doff > 5)
+		reordering_process_sack (record, tcp);
+
+	return SM_WANT_ALL;
+}
+
+/*
+ * Records a SYN that was held in the SYN cache, as update would have done
+ * had it seen the SYN, and passes it on to the RTT module.
+ */
+void reordering_syn (void *data, const struct tcp_syn_t *syn) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+
+	if (syn->direction > 1)
+		return;
+
+	reordering->record[syn->direction].expected_seq = syn->seq + 1;
+	reordering->record[syn->direction].expected_valid = 1;
+
+	if (reordering->rtt_module != NULL && reordering->rtt_module->session_module.syn != NULL)
+		reordering->rtt_module->session_module.syn (reordering->rtt_data, syn);
+}
+
+/*
+ * Writes a packet record, and its chain of missing links, for a checkpoint.
+ */
+void packet_record_serialize (struct packet_record_t *packet, struct serial_t *serial) {
+	struct packet_record_t *link;
+	uint16_t links = 0;
+	uint8_t flags;
+
+	for (link = packet->missing_link; link != NULL; link = link->missing_link)
+		links++;
+	SERIAL_PUT (serial, links);
+
+	for (link = packet; link != NULL; link = link->missing_link) {
+		flags = link->is_missing | (link->is_misaligned << 1) | (link->is_sacked << 2);
+		SERIAL_PUT (serial, link->seq);
+		SERIAL_PUT (serial, link->time);
+		SERIAL_PUT (serial, link->arrival);
+		SERIAL_PUT (serial, link->ip_id);
+		SERIAL_PUT (serial, link->num_acks);
+		SERIAL_PUT (serial, flags);
+	}
+}
+
+/*
+ * Reads a packet record, and its chain of missing links, from a checkpoint.
+ */
+void packet_record_deserialize (struct packet_record_t *packet, struct serial_t *serial) {
+	struct packet_record_t *link = packet;
+	uint16_t links, i;
+	uint8_t flags;
+
+	SERIAL_GET (serial, links);
+
+	for (i = 0; i <= links && !serial->error; i++) {
+		if (i > 0) {
+			link->missing_link = mem_alloc (sizeof (struct packet_record_t));
+			link = link->missing_link;
+		}
+		SERIAL_GET (serial, link->seq);
+		SERIAL_GET (serial, link->time);
+		SERIAL_GET (serial, link->arrival);
+		SERIAL_GET (serial, link->ip_id);
+		SERIAL_GET (serial, link->num_acks);
+		SERIAL_GET (serial, flags);
+		link->is_missing = flags & 1;
+		link->is_misaligned = (flags >> 1) & 1;
+		link->is_sacked = (flags >> 2) & 1;
+		link->padding = 0;
+		link->missing_link = NULL;
+	}
+}
+
+/*
+ * Writes the data of a session into a buffer for a checkpoint.
+ */
+size_t reordering_serialize (void *data, char *buf, size_t len) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	struct sender_record_t *record;
+	struct serial_t serial;
+	uint32_t rtt_len = 0;
+	char *rtt_buf;
+	int i, j, idx;
+
+	serial_writer_init (&serial, buf, len);
+
+	for (i = 0; i < 2; i++) {
+		record = &(reordering->record[i]);
+		SERIAL_PUT (&serial, record->expected_seq);
+		SERIAL_PUT (&serial, record->expected_valid);
+		SERIAL_PUT (&serial, record->in_recovery);
+		SERIAL_PUT (&serial, record->arrivals);
+		SERIAL_PUT (&serial, record->recent);
+		SERIAL_PUT (&serial, record->recent_idx);
+		SERIAL_PUT (&serial, record->recent_count);
+		SERIAL_PUT (&serial, record->mss);
+		SERIAL_PUT (&serial, record->length);
+
+		idx = record->lower_idx;
+		for (j = 0; j < record->length; j++) {
+			packet_record_serialize (&(record->array[idx]), &serial);
+			idx++;
+			if (idx == record->array_size)
+				idx = 0;
+		}
+	}
+
+	SERIAL_PUT (&serial, reordering->min_rtt);
+	SERIAL_PUT (&serial, reordering->type_counts);
+	SERIAL_PUT (&serial, reordering->message_counts);
+	SERIAL_PUT (&serial, reordering->time_lag_histogram);
+	SERIAL_PUT (&serial, reordering->extent_histogram);
+	SERIAL_PUT (&serial, reordering->metrics);
+
+	/* The RTT module's data is nested, if it can be serialized */
+	if (reordering->rtt_module != NULL && reordering->rtt_module->session_module.serialize != NULL)
+		rtt_len = reordering->rtt_module->session_module.serialize (reordering->rtt_data, NULL, 0);
+	SERIAL_PUT (&serial, rtt_len);
+	rtt_buf = serial_space (&serial, rtt_len);
+	if (rtt_len > 0 && rtt_buf != NULL)
+		reordering->rtt_module->session_module.serialize (reordering->rtt_data, rtt_buf, rtt_len);
+
+	return serial.pos;
+}
+
+/*
+ * Rebuilds the data of a session from a checkpoint.
+ */
+void *reordering_deserialize (void *config, const char *buf, size_t len) {
+	struct reordering_t *reordering = reordering_create (config);
+	struct sender_record_t *record;
+	struct serial_t serial;
+	uint32_t rtt_len;
+	uint16_t length;
+	const char *rtt_buf;
+	void *rtt_data = NULL;
+	int i, j;
+
+	serial_reader_init (&serial, buf, len);
+
+	for (i = 0; i < 2 && !serial.error; i++) {
+		record = &(reordering->record[i]);
+		SERIAL_GET (&serial, record->expected_seq);
+		SERIAL_GET (&serial, record->expected_valid);
+		SERIAL_GET (&serial, record->in_recovery);
+		SERIAL_GET (&serial, record->arrivals);
+		SERIAL_GET (&serial, record->recent);
+		SERIAL_GET (&serial, record->recent_idx);
+		SERIAL_GET (&serial, record->recent_count);
+		SERIAL_GET (&serial, record->mss);
+		if (record->recent_idx >= REORDERING_RECENT || record->recent_count > REORDERING_RECENT)
+			serial.error = 1;
+		SERIAL_GET (&serial, length);
+
+		for (j = 0; j < length && !serial.error; j++) {
+			struct packet_record_t *packet = sender_record_add (record, 0, 0, 0);
+			packet_record_deserialize (packet, &serial);
+		}
+	}
+
+	SERIAL_GET (&serial, reordering->min_rtt);
+	SERIAL_GET (&serial, reordering->type_counts);
+	SERIAL_GET (&serial, reordering->message_counts);
+	SERIAL_GET (&serial, reordering->time_lag_histogram);
+	SERIAL_GET (&serial, reordering->extent_histogram);
+	SERIAL_GET (&serial, reordering->metrics);
+
+	SERIAL_GET (&serial, rtt_len);
+	rtt_buf = serial_skip (&serial, rtt_len);
+	if (rtt_len > 0 && rtt_buf != NULL && reordering->rtt_module != NULL
+	    && reordering->rtt_module->session_module.deserialize != NULL) {
+		rtt_data = reordering->rtt_module->session_module.deserialize (
+				reordering->rtt_module->session_module.config, rtt_buf, rtt_len);
+		if (rtt_data == NULL)
+			serial.error = 1;
+	}
 
+	if (serial.error) {
+		reordering_destroy (reordering);
+		return NULL;
+	}
+
+	/* Replace the fresh RTT data with the restored one */
+	if (rtt_data != NULL) {
+		reordering->rtt_module->session_module.destroy (reordering->rtt_data);
+		reordering->rtt_data = rtt_data;
+	}
+	return reordering;
 }
 
 /*
@@ -639,17 +1242,27 @@ void reordering_update (void *data, struct libtrace_packet_t *packet) {
  */
 struct session_module_t *reordering_module () {
 	struct session_module_t *module = malloc (sizeof (struct session_module_t));
+	struct reordering_config_t *config = malloc (sizeof (struct reordering_config_t));
+
+	config->rtt_module = NULL;
+
+	module->config = config;
 	module->create = &reordering_create;
 	module->destroy = &reordering_destroy;
 	module->update = &reordering_update;
+	module->serialize = &reordering_serialize;
+	module->deserialize = &reordering_deserialize;
+	module->syn = &reordering_syn;
 	return module;
 }
 
 /*
- * Allows the rtt measurement scheme to be customised.
+ * Allows the rtt measurement scheme of a reordering module to be
+ * customised. Sessions already created keep the scheme they started with.
  */
-void reordering_set_rtt_module (struct rtt_module_t *module) {
-	rtt_module = module;
+void reordering_set_rtt_module (struct session_module_t *module, struct rtt_module_t *rtt) {
+	struct reordering_config_t *config = (struct reordering_config_t *) module->config;
+	config->rtt_module = rtt;
 }
 
 /*
@@ -682,7 +1295,157 @@ const char *reordering_get_message (void *data) {
  */
 double reordering_get_time_lag (void *data) {
 	struct reordering_t *reordering = (struct reordering_t *) data;
-	return reordering->time_lag;
+	return TCP_USEC_TO_SEC (reordering->time_lag);
+}
+
+/*
+ * Returns the number of data packets in the session that were classified
+ * as the given reordering type.
+ */
+uint32_t reordering_get_type_count (void *data, reordering_type_t type) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (type < 0 || type >= LAST_REORDERING)
+		return 0;
+	return reordering->type_counts[type];
+}
+
+/*
+ * Returns the number of data packets in the session that were classified
+ * as retransmissions, e.g. for a top-K tracker.
+ */
+uint64_t reordering_retransmissions (void *data) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	return reordering->type_counts[RETRANSMISSION];
+}
+
+/*
+ * Returns the number of data packets in the session, of every type.
+ */
+uint64_t reordering_data_packets (void *data) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < LAST_REORDERING; i++)
+		total += reordering->type_counts[i];
+	return total;
+}
+
+/*
+ * Returns the number of data packets in the session that were classified
+ * for the given reason, i.e. with the given message code.
+ */
+uint32_t reordering_get_message_count (void *data, int message) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (message < 0 || message >= REORDERING_MESSAGE_COUNT)
+		return 0;
+	return reordering->message_counts[message];
+}
+
+/*
+ * Returns the text for a message code.
+ */
+const char *reordering_get_message_text (int message) {
+	if (message < 0 || message >= REORDERING_MESSAGE_COUNT)
+		return NULL;
+	return reordering_messages[message];
+}
+
+/*
+ * Returns the count in one bucket of the time lag histogram.
+ */
+uint32_t reordering_get_time_lag_histogram (void *data, int bucket) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (bucket < 0 || bucket >= REORDERING_HISTOGRAM_BUCKETS)
+		return 0;
+	return reordering->time_lag_histogram[bucket];
+}
+
+/*
+ * Returns the number of packets sent in one direction that arrived, not
+ * counting duplicates.
+ */
+uint32_t reordering_get_arrivals (void *data, int direction) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1)
+		return 0;
+	return reordering->record[direction].arrivals;
+}
+
+/*
+ * Returns the number of packets sent in one direction that were reordered.
+ */
+uint32_t reordering_get_reordered (void *data, int direction) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1)
+		return 0;
+	return reordering->metrics[direction].reordered;
+}
+
+/*
+ * Returns the fraction of the packets of one direction that were
+ * reordered, or -1.0 if none have arrived.
+ */
+double reordering_get_reordered_ratio (void *data, int direction) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1 || reordering->record[direction].arrivals == 0)
+		return -1.0;
+	return (double) reordering->metrics[direction].reordered / reordering->record[direction].arrivals;
+}
+
+/*
+ * Returns the number of reordered packets of one direction with the given
+ * reordering extent.
+ */
+uint32_t reordering_get_packet_extent (void *data, int direction, int extent) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1 || extent < 1 || extent > REORDERING_EXTENT_MAX)
+		return 0;
+	return reordering->metrics[direction].packet_extent[extent];
+}
+
+/*
+ * Returns the number of reordered packets of one direction that were
+ * n-reordered for the given n but no larger.
+ */
+uint32_t reordering_get_n_reordering (void *data, int direction, int n) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1 || n < 0 || n > REORDERING_N_MAX)
+		return 0;
+	return reordering->metrics[direction].n_reordering[n];
+}
+
+/*
+ * Returns the number of packets of one direction with the given
+ * displacement in the reorder density.
+ */
+uint32_t reordering_get_density (void *data, int direction, int displacement) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1 || displacement < -REORDERING_DENSITY_THRESHOLD
+			|| displacement > REORDERING_DENSITY_THRESHOLD)
+		return 0;
+	return reordering->metrics[direction].density[displacement + REORDERING_DENSITY_THRESHOLD];
+}
+
+/*
+ * Returns the number of packet records kept for one direction, which is
+ * the part of the sequence space not yet cumulatively acknowledged.
+ */
+uint32_t reordering_get_window (void *data, int direction) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (direction < 0 || direction > 1)
+		return 0;
+	return reordering->record[direction].length;
+}
+
+/*
+ * Returns the count in one bucket of the extent histogram.
+ */
+uint32_t reordering_get_extent_histogram (void *data, int bucket) {
+	struct reordering_t *reordering = (struct reordering_t *) data;
+	if (bucket < 0 || bucket >= REORDERING_HISTOGRAM_BUCKETS)
+		return 0;
+	return reordering->extent_histogram[bucket];
 }
 			/*
 
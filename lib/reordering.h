@@ -40,15 +40,48 @@ enum reordering_type_t { INORDER, HIGH, RETRANSMISSION, NETWORK_REORDERING,
 
 typedef enum reordering_type_t reordering_type_t;
 
+/*
+ * The number of different messages (reasons) used to classify a packet.
+ */
+#define REORDERING_MESSAGE_COUNT 14
+
+/*
+ * The number of buckets in the time lag and extent histograms. Bucket 0
+ * counts packets with a value of zero and bucket i counts packets with a
+ * value in [2^(i-1), 2^i). The last bucket also counts all larger values.
+ */
+#define REORDERING_HISTOGRAM_BUCKETS 24
+
+/*
+ * The limits of the RFC 4737 and RFC 5236 metrics. Extents and n of at
+ * least REORDERING_EXTENT_MAX and REORDERING_N_MAX are counted as those
+ * values. Displacements beyond REORDERING_DENSITY_THRESHOLD are not
+ * counted in the reorder density.
+ */
+#define REORDERING_EXTENT_MAX 32
+#define REORDERING_N_MAX 8
+#define REORDERING_DENSITY_THRESHOLD 8
+
 /*
  * This returns the session module for use by the session manager.
  */
 struct session_module_t *reordering_module ();
 
 /*
- * Allows the rtt measurement scheme to be customised.
+ * The update function of the module, which a pipeline built with
+ * sessionpipeline.h can call directly.
+ */
+struct session_packet_t;
+int reordering_update (void *data, const struct session_packet_t *packet);
+
+/*
+ * Allows the rtt measurement scheme of a module returned by
+ * reordering_module() to be customised. This must be called before the
+ * module is added to a session manager. Without a scheme the RTT is taken
+ * as unknown, and reorderings are classified as before an RTT is measured.
  */
-void reordering_set_rtt_module (struct rtt_module_t *module);
+struct rtt_module_t;
+void reordering_set_rtt_module (struct session_module_t *module, struct rtt_module_t *rtt);
 
 /*
  * Returns the reordering type of the last packet.
@@ -74,4 +107,100 @@ const char *reordering_get_message (void *data);
  */
 double reordering_get_time_lag (void *data);
 
+/*
+ * Returns the number of data packets in the session that were classified
+ * as the given reordering type.
+ */
+uint32_t reordering_get_type_count (void *data, reordering_type_t type);
+
+/*
+ * Returns the number of data packets in the session that were classified
+ * as retransmissions, e.g. for a top-K tracker.
+ */
+uint64_t reordering_retransmissions (void *data);
+
+/*
+ * Returns the number of data packets in the session, of every type.
+ */
+uint64_t reordering_data_packets (void *data);
+
+/*
+ * Returns the number of data packets in the session that were classified
+ * for the given reason, i.e. with the given message code. The message codes
+ * range from 0 to REORDERING_MESSAGE_COUNT - 1.
+ */
+uint32_t reordering_get_message_count (void *data, int message);
+
+/*
+ * Returns the text for a message code, or NULL if the code is invalid.
+ */
+const char *reordering_get_message_text (int message);
+
+/*
+ * Returns the count in one bucket of the histogram of time lags, measured
+ * in microseconds, for packets that arrived below the expected sequence
+ * number.
+ */
+uint32_t reordering_get_time_lag_histogram (void *data, int bucket);
+
+/*
+ * Returns the count in one bucket of the histogram of reordering extents
+ * for packets that arrived below the expected sequence number. The extent
+ * is the number of bytes between the packet and the expected sequence number.
+ */
+uint32_t reordering_get_extent_histogram (void *data, int bucket);
+
+/*
+ * The following give the RFC 4737 and RFC 5236 metrics of the packets
+ * sent in one direction, 0 or 1, counting packets by their arrival index.
+ * A packet is reordered if it fills a gap, i.e. arrives after a packet
+ * with a higher sequence number, and was not classified as a
+ * retransmission. Duplicates are not counted.
+ */
+
+/*
+ * Returns the number of packets that arrived, not counting duplicates.
+ */
+uint32_t reordering_get_arrivals (void *data, int direction);
+
+/*
+ * Returns the number of reordered packets.
+ */
+uint32_t reordering_get_reordered (void *data, int direction);
+
+/*
+ * Returns the fraction of the packets that were reordered, or -1.0 if none
+ * have arrived.
+ */
+double reordering_get_reordered_ratio (void *data, int direction);
+
+/*
+ * Returns the number of reordered packets with the given reordering
+ * extent, from 1 to REORDERING_EXTENT_MAX: how many places after the
+ * earliest packet with a higher sequence number the packet arrived.
+ */
+uint32_t reordering_get_packet_extent (void *data, int direction, int extent);
+
+/*
+ * Returns the number of reordered packets that were n-reordered for the
+ * given n, from 0 to REORDERING_N_MAX, but not for n + 1: the n packets
+ * that arrived just before each had a higher sequence number.
+ */
+uint32_t reordering_get_n_reordering (void *data, int direction, int n);
+
+/*
+ * Returns the number of packets with the given displacement, from
+ * -REORDERING_DENSITY_THRESHOLD to REORDERING_DENSITY_THRESHOLD, in the
+ * reorder density. A late packet is displaced by its extent and each packet
+ * that overtook it by -1, which matches RFC 5236 for separate reorderings.
+ */
+uint32_t reordering_get_density (void *data, int direction, int displacement);
+
+/*
+ * Returns the number of packet records kept for one direction, which is
+ * the part of the sequence space not yet cumulatively acknowledged. Runs of
+ * records that the receiver has SACKed count as one.
+ */
+uint32_t reordering_get_window (void *data, int direction);
+
 #endif							/*REORDERING_H_ */
@@ -41,18 +41,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "sessionmanager.h"
+#include "tcpsession.h"
 #include "rttmodule.h"
+#include "serialize.h"
+#include "mempool.h"
 #include "rtthandshake.h"
 
 /*
  * This struct stores the necessary data for recording the RTT of a handshake.
  */
 struct rtt_handshake_record_t {
-	// The rtt for the inside part of the session
-	double rtt_in;
+	// The rtt for the inside part of the session, in nanoseconds. While
+	// the handshake is in progress this holds minus the time of the
+	// packet being waited on.
+	int64_t rtt_in;
 
-	// The rtt for the outside part of the session
-	double rtt_out;
+	// The rtt for the outside part of the session, in nanoseconds
+	int64_t rtt_out;
 
 	// Records if a session has been established or not
 	uint8_t established;
@@ -61,10 +66,12 @@ struct rtt_handshake_record_t {
 /*
  * Allocates and initialises a new data structure for a new tcp session.
  */
-void *rtt_handshake_create () {
-	struct rtt_handshake_record_t *record = malloc (sizeof (struct rtt_handshake_record_t));
-	record->rtt_in = -1.0;
-	record->rtt_out = -1.0;
+void *rtt_handshake_create (void *config) {
+	struct rtt_handshake_record_t *record = mem_alloc (sizeof (struct rtt_handshake_record_t));
+
+	(void) config;
+	record->rtt_in = -1;
+	record->rtt_out = -1;
 	record->established = 0;
 	return record;
 }
@@ -73,32 +80,29 @@ void *rtt_handshake_create () {
  * Frees the data structure of a closed tcp session.
  */
 void rtt_handshake_destroy (void *data) {
-	free (data);
+	mem_free (data);
 }
 
 /*
  * Updates the RTT estimates given a new packet belonging to the flow.
  */
-void rtt_handshake_update (void *data, struct libtrace_packet_t *packet) {
+int rtt_handshake_update (void *data, const struct session_packet_t *packet) {
 
 	struct rtt_handshake_record_t *record = (struct rtt_handshake_record_t *) data;
-	struct libtrace_tcp *tcp;
+	const struct libtrace_tcp *tcp = packet->tcp;
 
-	double time;
+	int64_t time;
 	int direction;
 
 	// If a session has been established then skip all calculations.
 	if (!record->established) {
 
-		if ((tcp = trace_get_tcp (packet)) == NULL)
-			return;
-
-		time = trace_get_seconds (packet);
-		direction = trace_get_direction (packet);
+		time = (int64_t) packet->time;
+		direction = packet->direction;
 
 		// Check that the direction is ok
 		if(!(direction==0 || direction==1))
-			return;
+			return SM_WANT_ALL;
 
 
 		// Check if the packet is a SYN, a SYN/ACK or an ACK
@@ -109,12 +113,12 @@ void rtt_handshake_update (void *data, struct libtrace_packet_t *packet) {
 				// update the rtt to the origin of the SYN/ACK but 
 				// only to the destination.
 				if (direction == 0) {	//outbound, so incoming syn
-					if(record->rtt_in < 0.0) { // Do not update if rtt already set
+					if(record->rtt_in < 0) { // Do not update if rtt already set
 						record->rtt_in += time;
 					}
 					record->rtt_out = -time;
 				} else {
-					if(record->rtt_out < 0.0) {
+					if(record->rtt_out < 0) {
 						record->rtt_out += time;
 					}
 					record->rtt_in = -time;
@@ -139,6 +143,57 @@ void rtt_handshake_update (void *data, struct libtrace_packet_t *packet) {
 
 	}
 
+	// Once established there is nothing more to measure
+	if (record->established)
+		return SM_WANT_NONE;
+	return SM_WANT_ALL;
+}
+
+/*
+ * Records a SYN that was held in the SYN cache, as update would have done
+ * had it seen the SYN.
+ */
+void rtt_handshake_syn (void *data, const struct tcp_syn_t *syn) {
+	struct rtt_handshake_record_t *record = (struct rtt_handshake_record_t *) data;
+
+	if (syn->direction == 0) {
+		record->rtt_out = -(int64_t) syn->time;
+	} else {
+		record->rtt_in = -(int64_t) syn->time;
+	}
+}
+
+/*
+ * Writes the data of a session into a buffer for a checkpoint.
+ */
+size_t rtt_handshake_serialize (void *data, char *buf, size_t len) {
+	struct rtt_handshake_record_t *record = (struct rtt_handshake_record_t *) data;
+	struct serial_t serial;
+
+	serial_writer_init (&serial, buf, len);
+	SERIAL_PUT (&serial, record->rtt_in);
+	SERIAL_PUT (&serial, record->rtt_out);
+	SERIAL_PUT (&serial, record->established);
+	return serial.pos;
+}
+
+/*
+ * Rebuilds the data of a session from a checkpoint.
+ */
+void *rtt_handshake_deserialize (void *config, const char *buf, size_t len) {
+	struct rtt_handshake_record_t *record = rtt_handshake_create (config);
+	struct serial_t serial;
+
+	serial_reader_init (&serial, buf, len);
+	SERIAL_GET (&serial, record->rtt_in);
+	SERIAL_GET (&serial, record->rtt_out);
+	SERIAL_GET (&serial, record->established);
+
+	if (serial.error) {
+		rtt_handshake_destroy (record);
+		return NULL;
+	}
+	return record;
 }
 
 /*
@@ -146,9 +201,13 @@ void rtt_handshake_update (void *data, struct libtrace_packet_t *packet) {
  */
 struct session_module_t *rtt_handshake_module () {
 	struct session_module_t *module = malloc (sizeof (struct session_module_t));
+	module->config = NULL;
 	module->create = &rtt_handshake_create;
 	module->destroy = &rtt_handshake_destroy;
 	module->update = &rtt_handshake_update;
+	module->serialize = &rtt_handshake_serialize;
+	module->deserialize = &rtt_handshake_deserialize;
+	module->syn = &rtt_handshake_syn;
 	return module;
 }
 
@@ -157,9 +216,13 @@ struct session_module_t *rtt_handshake_module () {
  */
 struct rtt_module_t *rtt_handshake_rtt_module () {
 	struct rtt_module_t *module = malloc (sizeof (struct rtt_module_t));
+	module->session_module.config = NULL;
 	module->session_module.create = &rtt_handshake_create;
 	module->session_module.destroy = &rtt_handshake_destroy;
 	module->session_module.update = &rtt_handshake_update;
+	module->session_module.serialize = &rtt_handshake_serialize;
+	module->session_module.deserialize = &rtt_handshake_deserialize;
+	module->session_module.syn = &rtt_handshake_syn;
 	module->inside_rtt = &(rtt_handshake_inside);
 	module->outside_rtt = &(rtt_handshake_outside);
 	return module;
@@ -175,7 +238,7 @@ double rtt_handshake_total (void *data) {
 	if (record->established == 0)
 		return -1.0;
 	else
-		return record->rtt_in + record->rtt_out;
+		return TCP_NSEC_TO_SEC (record->rtt_in + record->rtt_out);
 }
 
 /*
@@ -183,8 +246,8 @@ double rtt_handshake_total (void *data) {
  */
 double rtt_handshake_inside (void *data) {
 	struct rtt_handshake_record_t *record = (struct rtt_handshake_record_t *) data;
-	if(record->rtt_in > 0.0)
-		return record->rtt_in;
+	if(record->rtt_in > 0)
+		return TCP_NSEC_TO_SEC (record->rtt_in);
 	else
 		return -1.0;
 }
@@ -194,8 +257,8 @@ double rtt_handshake_inside (void *data) {
  */
 double rtt_handshake_outside (void *data) {
 	struct rtt_handshake_record_t *record = (struct rtt_handshake_record_t *) data;
-	if(record->rtt_out > 0.0)
-		return record->rtt_out;
+	if(record->rtt_out > 0)
+		return TCP_NSEC_TO_SEC (record->rtt_out);
 	else
 		return -1.0;
 }
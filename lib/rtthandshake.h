@@ -41,6 +41,13 @@ extern "C" {
  */
 struct session_module_t *rtt_handshake_module ();
 
+/*
+ * The update function of the module, which a pipeline built with
+ * sessionpipeline.h can call directly.
+ */
+struct session_packet_t;
+int rtt_handshake_update (void *data, const struct session_packet_t *packet);
+
 /*
  * This returns the rtt module for use by the reordering module.
  */
@@ -38,28 +38,53 @@
  * 
  * 20 s rtt timeout
  * 
- * Smooth = (3*old + new) / 4
+ * Smooth = (7*old + new) / 8, variation = (3*old + |error|) / 4
+ *
+ * All times are integers: packet records keep a 32 bit microsecond clock
+ * and the estimates are kept in microseconds, scaled as in TCP itself so
+ * that the smoothing needs only shifts.
  */
 
 #include <libtrace.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "sessionmanager.h"
+#include "tcpsession.h"
 #include "rttmodule.h"
 #include "queue.h"
+#include "seqnum.h"
+#include "rttsketch.h"
+#include "minfilter.h"
+#include "serialize.h"
+#include "mempool.h"
 #include "rttnsequence.h"
 
-/* Moving RTT params. */
-#define SMOOTH 0.875
-#define VARSMOOTH 0.75
+/* Moving RTT params, as shifts. The smoothed rtt is kept scaled by 8 and
+ * the variation by 4.
+ */
+#define SMOOTH_SHIFT 3
+#define VARSMOOTH_SHIFT 2
+
+/* Upper bound for RTT sample value in microseconds, anything bigger is
+ * discarded.
+ */
+#define RTT_N_SEQUENCE_MAX_RTT 20000000
 
-/* Upper bound for RTT sample value, anything bigger is discarded. */
-#define RTT_N_SEQUENCE_MAX_RTT 20
+/* Default length, in seconds, of the window for the minimum RTT. */
+#define RTT_N_SEQUENCE_MIN_RTT_WINDOW 10.0
 
-/* This allows our queue of ack/time pairs to grow indefinitely.
- * There is a function which allows the buffer to be set to prevent this.
+/*
+ * The settings of an rtt_n_sequence module.
  */
-struct queue_vars_t rtt_n_queue_vars = { -1, 0, 0 };
+struct rtt_n_config_t {
+  /* This allows our queue of ack/time pairs to grow indefinitely.
+   * There is a function which allows the buffer to be set to prevent this.
+   */
+  struct queue_vars_t queue_vars;
+
+  /* The length of the window over which the minimum RTT is taken, in ns. */
+  uint64_t min_rtt_window;
+};
 
 /*
  * This struct is an item of the queue. We need to store the acks expected
@@ -67,7 +92,7 @@ struct queue_vars_t rtt_n_queue_vars = { -1, 0, 0 };
  */
 struct rtt_n_item_t {
 	uint32_t expected_ack;
-	double time;
+	uint32_t time;		/* 32 bit microsecond clock */
 };
 
 /*
@@ -75,6 +100,9 @@ struct rtt_n_item_t {
  * stores the sequence/time queues for both directions.
  */
 struct rtt_n_t {
+  /* The settings of the module that created this session. */
+  struct rtt_n_config_t *config;
+
   /*
    * We need one set of variables for each direction.
    */
@@ -86,47 +114,62 @@ struct rtt_n_t {
     struct queue_t *queue;
     
     /*
-     * This is the current rtt estimate for the half connection.
+     * This is the current rtt estimate for the half connection, in
+     * microseconds scaled by 8, and its variation scaled by 4. These
+     * are only valid once count is non-zero.
      */
-    double rtt;
+    uint32_t rtt;
     
-    double rtt_var;
+    uint32_t rtt_var;
     
     /*
      * These vairables together store the average rtt for the
-     * session.
+     * session, in microseconds.
      */
-    double total;
+    uint64_t total;
     int count;
+
+    /*
+     * The distribution of the rtt samples, allocated when the first
+     * sample is taken.
+     */
+    rtt_sketch_t *sketch;
+
+    /*
+     * The minimum rtt over a sliding window.
+     */
+    struct min_filter_t min_rtt;
     
   } dir[2];			/* 0 = outside, 1 = inside */
 
-  /* Last RTT sample or -1.0 if not avail. */
-  double last_rtt;
+  /* Last RTT sample in microseconds or -1 if not avail. */
+  int32_t last_rtt;
 };
 
 
 /*
  * Allocates and initialises a new data structure for a new tcp session.
  */
-void *rtt_n_sequence_create () {
-  struct rtt_n_t *rtt_n = malloc (sizeof (struct rtt_n_t));
+void *rtt_n_sequence_create (void *config) {
+  struct rtt_n_t *rtt_n = mem_alloc (sizeof (struct rtt_n_t));
   int i;
-	
-  /* Guess that a buffer_increment of 10 will do. */
-  rtt_n_queue_vars.buffer_increment = 10;
-  rtt_n_queue_vars.item_size = sizeof (struct rtt_n_item_t);
+
+  rtt_n->config = (struct rtt_n_config_t *) config;
 
   /* Initialise the variables for both directions. */
   for (i = 0; i < 2; i++) {
     
-    rtt_n->dir[i].queue = queue_create (&rtt_n_queue_vars);
+    rtt_n->dir[i].queue = queue_create (&rtt_n->config->queue_vars);
     
-    rtt_n->dir[i].rtt = -1.0;
-    rtt_n->dir[i].rtt_var = -1.0;
+    rtt_n->dir[i].rtt = 0;
+    rtt_n->dir[i].rtt_var = 0;
     
-    rtt_n->dir[i].total = 0.0;
+    rtt_n->dir[i].total = 0;
     rtt_n->dir[i].count = 0;
+
+    rtt_n->dir[i].sketch = NULL;
+
+    min_filter_clear (&(rtt_n->dir[i].min_rtt));
   }
   
   return rtt_n;
@@ -139,13 +182,17 @@ void rtt_n_sequence_destroy (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
   queue_destroy (rtt_n->dir[0].queue);
   queue_destroy (rtt_n->dir[1].queue);
-  free (rtt_n);
+  if (rtt_n->dir[0].sketch != NULL)
+    rtt_sketch_destroy (rtt_n->dir[0].sketch);
+  if (rtt_n->dir[1].sketch != NULL)
+    rtt_sketch_destroy (rtt_n->dir[1].sketch);
+  mem_free (rtt_n);
 }
 
 /*
  * Updates the RTT estimates given a new packet belonging to the flow.
  */
-void rtt_n_sequence_update (void *data, struct libtrace_packet_t *packet) {
+int rtt_n_sequence_update (void *data, const struct session_packet_t *packet) {
 
   /* Algorithm:
    * 
@@ -160,26 +207,27 @@ void rtt_n_sequence_update (void *data, struct libtrace_packet_t *packet) {
   struct queue_t *queue;
   struct rtt_n_item_t *item;
   
-  struct libtrace_ip *ip = trace_get_ip ((libtrace_packet_t *)packet);
-  struct libtrace_tcp *tcp = trace_get_tcp ((libtrace_packet_t *)packet);
-  int direction = trace_get_direction (packet);
-  double time = trace_get_seconds (packet);
+  const struct libtrace_tcp *tcp = packet->tcp;
+  int direction = packet->direction;
+  uint64_t now = packet->time;
+  uint32_t time = TCP_TIME_USEC32 (now);
   
   struct queue_itr_t itr;
   uint32_t ack;
-  double rtt;
+  int64_t rtt;
+  int32_t error;
   
   int payload;
 
   // reset on each packet for this flow, will only have valid
   // value right after a packet update that creates a new sample
-  rtt_n->last_rtt = -1.0;
+  rtt_n->last_rtt = -1;
 
   /* Check that the direction is ok */
   if(!(direction==0 || direction==1))
-    return;
+    return SM_WANT_ALL;
 
-  payload = ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+  payload = packet->payload;
 
   /* Only if the packet has data do we record it. */
   if (payload > 0) {
@@ -187,16 +235,16 @@ void rtt_n_sequence_update (void *data, struct libtrace_packet_t *packet) {
 
     queue = rtt_n->dir[1 - direction].queue;
 
-    item = queue_top (queue, &(rtt_n_queue_vars));
+    item = queue_top (queue, &(rtt_n->config->queue_vars));
 
     /* The current packet is a retransmit if the queue is not empty 
      * and 'expected' is not the highest element in the queue.
      */
-    if ((item == NULL) || (expected > item->expected_ack)) {
+    if ((item == NULL) || (SEQ_GT (expected, item->expected_ack))) {
       struct rtt_n_item_t new_item;
       new_item.expected_ack = expected;
       new_item.time = time;
-      queue_add (queue, &rtt_n_queue_vars, &new_item);
+      queue_add (queue, &rtt_n->config->queue_vars, &new_item);
     } else {
       /* Clear queue so that we start measuring rtt from
        * scratch.
@@ -210,41 +258,52 @@ void rtt_n_sequence_update (void *data, struct libtrace_packet_t *packet) {
 
   /* Use the acknowledgement, generating an rtt in the process */
   ack = ntohl (tcp->ack_seq);
-  rtt = -1.0;
+  rtt = -1;
 
   /* Iterate through the queue, breaking when we cannot ack any more
    * elements.
    */
-  item = queue_itr_begin (queue, &rtt_n_queue_vars, &itr);
+  item = queue_itr_begin (queue, &rtt_n->config->queue_vars, &itr);
   while (item != NULL) {
-    if (ack >= item->expected_ack) {
+    if (SEQ_GEQ (ack, item->expected_ack)) {
       /* Get estimated RTT and remove acked record. */
-      rtt = time - item->time;
+      rtt = (uint32_t) (time - item->time);
       queue_itr_remove (queue, &itr);
     } else {
       break;
     }
-    item = queue_itr_next (queue, &rtt_n_queue_vars, &itr);
+    item = queue_itr_next (queue, &rtt_n->config->queue_vars, &itr);
   }
   
   if (rtt > 0) {
     /* If rtt is too big, do not use it. */
     if (rtt > RTT_N_SEQUENCE_MAX_RTT)
-      return;
+      return SM_WANT_ALL;
 
     rtt_n->last_rtt = rtt;
     rtt_n->dir[direction].total += rtt;
-    rtt_n->dir[direction].count++;
+
+    if (rtt_n->dir[direction].sketch == NULL)
+      rtt_n->dir[direction].sketch = rtt_sketch_create ();
+    rtt_sketch_add_usec (rtt_n->dir[direction].sketch, rtt);
+
+    min_filter_update (&(rtt_n->dir[direction].min_rtt), rtt_n->config->min_rtt_window, now, rtt);
 
     /* Update rtt estimate */
-    if (rtt_n->dir[direction].rtt < 0) {
-      rtt_n->dir[direction].rtt = rtt;
-      rtt_n->dir[direction].rtt_var = rtt / 2;
+    if (rtt_n->dir[direction].count == 0) {
+      rtt_n->dir[direction].rtt = rtt << SMOOTH_SHIFT;
+      rtt_n->dir[direction].rtt_var = (rtt / 2) << VARSMOOTH_SHIFT;
     } else {				/* Smooth */
-      rtt_n->dir[direction].rtt = (SMOOTH * rtt_n->dir[direction].rtt) + ((1 - SMOOTH) * rtt);
-      rtt_n->dir[direction].rtt_var = (VARSMOOTH * rtt_n->dir[direction].rtt) + ((1 - VARSMOOTH) * abs(rtt_n->dir[direction].rtt - rtt));
+      error = rtt - (rtt_n->dir[direction].rtt >> SMOOTH_SHIFT);
+      rtt_n->dir[direction].rtt += error;
+      if (error < 0)
+        error = -error;
+      rtt_n->dir[direction].rtt_var += error - (int32_t) (rtt_n->dir[direction].rtt_var >> VARSMOOTH_SHIFT);
     }
+    rtt_n->dir[direction].count++;
   }
+
+  return SM_WANT_ALL;
 }
 
 /*
@@ -252,19 +311,36 @@ void rtt_n_sequence_update (void *data, struct libtrace_packet_t *packet) {
  * remember at one time. A value of -1 is used to specify that there is no
  * limit on the buffer size and it can grow to accommodate the packets.
  */
-void rtt_n_sequence_set_buffer_size (int size) {
+void rtt_n_sequence_set_buffer_size (struct session_module_t *module, int size) {
+  struct rtt_n_config_t *config = (struct rtt_n_config_t *) module->config;
+
   if ((size == -1) || ((size > 0) && (size < 65536))) {
-    rtt_n_queue_vars.buffer_size = size;
+    config->queue_vars.buffer_size = size;
   } else {
-    rtt_n_queue_vars.buffer_size = -1;
+    config->queue_vars.buffer_size = -1;
     fprintf (stderr, "rtt_n_sequence: Buffer size out of range\n");
   }
 }
 
+/*
+ * Sets the length, in seconds, of the window over which the minimum RTT
+ * is taken. The default is 10 seconds.
+ */
+void rtt_n_sequence_set_min_rtt_window (struct session_module_t *module, double window) {
+  struct rtt_n_config_t *config = (struct rtt_n_config_t *) module->config;
+
+  if (window > 0.0) {
+    config->min_rtt_window = TCP_SEC_TO_NSEC (window);
+  } else {
+    config->min_rtt_window = TCP_SEC_TO_NSEC (RTT_N_SEQUENCE_MIN_RTT_WINDOW);
+    fprintf (stderr, "rtt_n_sequence: Minimum RTT window out of range\n");
+  }
+}
+
 double rtt_n_sequence_variation (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
-  if ((rtt_n->dir[0].rtt >= 0) && (rtt_n->dir[1].rtt >= 0))
-    return rtt_n->dir[0].rtt_var + rtt_n->dir[1].rtt_var;
+  if ((rtt_n->dir[0].count > 0) && (rtt_n->dir[1].count > 0))
+    return TCP_USEC_TO_SEC ((rtt_n->dir[0].rtt_var >> VARSMOOTH_SHIFT) + (rtt_n->dir[1].rtt_var >> VARSMOOTH_SHIFT));
   else
     return -1.0;
 }
@@ -274,8 +350,8 @@ double rtt_n_sequence_variation (void *data) {
  */
 double rtt_n_sequence_total (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
-  if ((rtt_n->dir[0].rtt >= 0) && (rtt_n->dir[1].rtt >= 0))
-    return rtt_n->dir[0].rtt + rtt_n->dir[1].rtt;
+  if ((rtt_n->dir[0].count > 0) && (rtt_n->dir[1].count > 0))
+    return TCP_USEC_TO_SEC ((rtt_n->dir[0].rtt >> SMOOTH_SHIFT) + (rtt_n->dir[1].rtt >> SMOOTH_SHIFT));
   else
     return -1.0;
 }
@@ -285,7 +361,10 @@ double rtt_n_sequence_total (void *data) {
  */
 double rtt_n_sequence_last_sample(void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
-  return rtt_n->last_rtt;
+  if (rtt_n->last_rtt >= 0)
+    return TCP_USEC_TO_SEC (rtt_n->last_rtt);
+  else
+    return -1.0;
 }
 
 /*
@@ -293,8 +372,8 @@ double rtt_n_sequence_last_sample(void *data) {
  */
 double rtt_n_sequence_inside (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
-  if (rtt_n->dir[0].rtt >= 0)
-    return rtt_n->dir[0].rtt;
+  if (rtt_n->dir[0].count > 0)
+    return TCP_USEC_TO_SEC (rtt_n->dir[0].rtt >> SMOOTH_SHIFT);
   else
     return -1.0;
 }
@@ -304,8 +383,8 @@ double rtt_n_sequence_inside (void *data) {
  */
 double rtt_n_sequence_outside (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
-  if (rtt_n->dir[1].rtt >= 0)
-    return rtt_n->dir[1].rtt;
+  if (rtt_n->dir[1].count > 0)
+    return TCP_USEC_TO_SEC (rtt_n->dir[1].rtt >> SMOOTH_SHIFT);
   else
     return -1.0;
 }
@@ -316,19 +395,187 @@ double rtt_n_sequence_outside (void *data) {
 double rtt_n_sequence_average (void *data) {
   struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
   if ((rtt_n->dir[0].total > 0) && (rtt_n->dir[1].total > 0))
-    return (rtt_n->dir[0].total / rtt_n->dir[0].count + rtt_n->dir[1].total / rtt_n->dir[1].count);
+    return TCP_USEC_TO_SEC (rtt_n->dir[0].total / rtt_n->dir[0].count + rtt_n->dir[1].total / rtt_n->dir[1].count);
+  else
+    return -1.0;
+}
+
+/*
+ * Return the minimum RTT within the window for the inside half of the
+ * connection.
+ */
+double rtt_n_sequence_inside_min (void *data) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  uint32_t min = min_filter_get (&(rtt_n->dir[0].min_rtt));
+  if (min != MIN_FILTER_NONE)
+    return TCP_USEC_TO_SEC (min);
+  else
+    return -1.0;
+}
+
+/*
+ * Return the minimum RTT within the window for the outside half of the
+ * connection.
+ */
+double rtt_n_sequence_outside_min (void *data) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  uint32_t min = min_filter_get (&(rtt_n->dir[1].min_rtt));
+  if (min != MIN_FILTER_NONE)
+    return TCP_USEC_TO_SEC (min);
+  else
+    return -1.0;
+}
+
+/*
+ * Return the q-quantile of the RTT samples for the inside half of the
+ * connection.
+ */
+double rtt_n_sequence_inside_quantile (void *data, double q) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  if (rtt_n->dir[0].sketch != NULL)
+    return rtt_sketch_quantile (rtt_n->dir[0].sketch, q);
+  else
+    return -1.0;
+}
+
+/*
+ * Return the q-quantile of the RTT samples for the outside half of the
+ * connection.
+ */
+double rtt_n_sequence_outside_quantile (void *data, double q) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  if (rtt_n->dir[1].sketch != NULL)
+    return rtt_sketch_quantile (rtt_n->dir[1].sketch, q);
   else
     return -1.0;
 }
 
+/*
+ * Return the sketch of the RTT samples for the inside half of the
+ * connection, or NULL if there are no samples yet.
+ */
+rtt_sketch_t *rtt_n_sequence_inside_sketch (void *data) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  return rtt_n->dir[0].sketch;
+}
+
+/*
+ * Return the sketch of the RTT samples for the outside half of the
+ * connection, or NULL if there are no samples yet.
+ */
+rtt_sketch_t *rtt_n_sequence_outside_sketch (void *data) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  return rtt_n->dir[1].sketch;
+}
+
+/*
+ * Writes the data of a session into a buffer for a checkpoint.
+ */
+size_t rtt_n_sequence_serialize (void *data, char *buf, size_t len) {
+  struct rtt_n_t *rtt_n = (struct rtt_n_t *) data;
+  struct serial_t serial;
+  struct queue_itr_t itr;
+  struct rtt_n_item_t *item;
+  uint32_t length;
+  uint8_t has_sketch;
+  int i;
+
+  serial_writer_init (&serial, buf, len);
+
+  for (i = 0; i < 2; i++) {
+    /* The unacknowledged packets, oldest first */
+    length = queue_length (rtt_n->dir[i].queue);
+    SERIAL_PUT (&serial, length);
+    item = queue_itr_begin (rtt_n->dir[i].queue, &rtt_n->config->queue_vars, &itr);
+    while (item != NULL) {
+      SERIAL_PUT (&serial, item->expected_ack);
+      SERIAL_PUT (&serial, item->time);
+      item = queue_itr_next (rtt_n->dir[i].queue, &rtt_n->config->queue_vars, &itr);
+    }
+
+    SERIAL_PUT (&serial, rtt_n->dir[i].rtt);
+    SERIAL_PUT (&serial, rtt_n->dir[i].rtt_var);
+    SERIAL_PUT (&serial, rtt_n->dir[i].total);
+    SERIAL_PUT (&serial, rtt_n->dir[i].count);
+    SERIAL_PUT (&serial, rtt_n->dir[i].min_rtt);
+
+    has_sketch = (rtt_n->dir[i].sketch != NULL);
+    SERIAL_PUT (&serial, has_sketch);
+    if (has_sketch)
+      rtt_sketch_serialize (rtt_n->dir[i].sketch, &serial);
+  }
+
+  return serial.pos;
+}
+
+/*
+ * Rebuilds the data of a session from a checkpoint.
+ */
+void *rtt_n_sequence_deserialize (void *config, const char *buf, size_t len) {
+  struct rtt_n_t *rtt_n = rtt_n_sequence_create (config);
+  struct serial_t serial;
+  struct rtt_n_item_t item;
+  uint32_t length, j;
+  uint8_t has_sketch;
+  int i;
+
+  serial_reader_init (&serial, buf, len);
+
+  for (i = 0; i < 2 && !serial.error; i++) {
+    SERIAL_GET (&serial, length);
+    for (j = 0; j < length && !serial.error; j++) {
+      SERIAL_GET (&serial, item.expected_ack);
+      SERIAL_GET (&serial, item.time);
+      queue_add (rtt_n->dir[i].queue, &rtt_n->config->queue_vars, &item);
+    }
+
+    SERIAL_GET (&serial, rtt_n->dir[i].rtt);
+    SERIAL_GET (&serial, rtt_n->dir[i].rtt_var);
+    SERIAL_GET (&serial, rtt_n->dir[i].total);
+    SERIAL_GET (&serial, rtt_n->dir[i].count);
+    SERIAL_GET (&serial, rtt_n->dir[i].min_rtt);
+
+    SERIAL_GET (&serial, has_sketch);
+    if (has_sketch) {
+      rtt_n->dir[i].sketch = rtt_sketch_deserialize (&serial);
+      if (rtt_n->dir[i].sketch == NULL)
+        serial.error = 1;
+    }
+  }
+
+  if (serial.error) {
+    rtt_n_sequence_destroy (rtt_n);
+    return NULL;
+  }
+  return rtt_n;
+}
+
+/*
+ * Allocates the settings of a new module, with the defaults.
+ */
+struct rtt_n_config_t *rtt_n_sequence_config () {
+  struct rtt_n_config_t *config = malloc (sizeof (struct rtt_n_config_t));
+
+  /* Guess that a buffer_increment of 10 will do. */
+  config->queue_vars.buffer_size = -1;
+  config->queue_vars.buffer_increment = 10;
+  config->queue_vars.item_size = sizeof (struct rtt_n_item_t);
+  config->min_rtt_window = TCP_SEC_TO_NSEC (RTT_N_SEQUENCE_MIN_RTT_WINDOW);
+  return config;
+}
+
 /*
  * This returns the session module for use by the session manager.
  */
 struct session_module_t *rtt_n_sequence_module () {
   struct session_module_t *module = malloc (sizeof (struct session_module_t));
+  module->config = rtt_n_sequence_config ();
   module->create = &rtt_n_sequence_create;
   module->destroy = &rtt_n_sequence_destroy;
   module->update = &rtt_n_sequence_update;
+  module->serialize = &rtt_n_sequence_serialize;
+  module->deserialize = &rtt_n_sequence_deserialize;
+  module->syn = NULL;
   return module;
 }
 
@@ -337,9 +584,13 @@ struct session_module_t *rtt_n_sequence_module () {
  */
 struct rtt_module_t *rtt_n_sequence_rtt_module () {
   struct rtt_module_t *module = malloc (sizeof (struct rtt_module_t));
+  module->session_module.config = rtt_n_sequence_config ();
   module->session_module.create = &rtt_n_sequence_create;
   module->session_module.destroy = &rtt_n_sequence_destroy;
   module->session_module.update = &rtt_n_sequence_update;
+  module->session_module.serialize = &rtt_n_sequence_serialize;
+  module->session_module.deserialize = &rtt_n_sequence_deserialize;
+  module->session_module.syn = NULL;
   module->inside_rtt = &(rtt_n_sequence_inside);
   module->outside_rtt = &(rtt_n_sequence_outside);
   return module;
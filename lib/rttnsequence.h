@@ -32,6 +32,8 @@
 #ifndef RTTNSEQUENCE_H_
 #define RTTNSEQUENCE_H_
 
+#include "rttsketch.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,8 +42,17 @@ extern "C" {
  * The buffer size corresponds to how many unacknowledged packets we can
  * remember at one time. A value of -1 is used to specify that there is no
  * limit on the buffer size and it can grow to accommodate the packets.
+ * The module is one returned by rtt_n_sequence_module(), or the
+ * session_module of one returned by rtt_n_sequence_rtt_module().
+ */
+void rtt_n_sequence_set_buffer_size (struct session_module_t *module, int size);
+
+/*
+ * Sets the length, in seconds, of the sliding window over which the minimum
+ * RTT is taken. The default is 10 seconds. The module is as for
+ * rtt_n_sequence_set_buffer_size().
  */
-void rtt_n_sequence_set_buffer_size (int size);
+void rtt_n_sequence_set_min_rtt_window (struct session_module_t *module, double window);
 
 /*
  * Returns a valid RTT (>0) if the last update created a new sample,
@@ -70,11 +81,58 @@ double rtt_n_sequence_outside (void *data);
  */
 double rtt_n_sequence_average (void *data);
 
+/*
+ * Return the minimum RTT within the window for the inside half of the
+ * connection, or -1.0 if there are no samples. This estimates the
+ * propagation delay of the path.
+ */
+double rtt_n_sequence_inside_min (void *data);
+
+/*
+ * Return the minimum RTT within the window for the outside half of the
+ * connection, or -1.0 if there are no samples.
+ */
+double rtt_n_sequence_outside_min (void *data);
+
+/*
+ * Return the q-quantile of the RTT samples for the inside half of the
+ * connection, e.g. q = 0.5, 0.9 or 0.99 for the median, 90th or 99th
+ * percentile. Returns -1.0 if there are no samples.
+ */
+double rtt_n_sequence_inside_quantile (void *data, double q);
+
+/*
+ * Return the q-quantile of the RTT samples for the outside half of the
+ * connection. Returns -1.0 if there are no samples.
+ */
+double rtt_n_sequence_outside_quantile (void *data, double q);
+
+/*
+ * Return the sketch of the RTT samples for the inside half of the
+ * connection, or NULL if there are no samples yet. The sketch belongs to
+ * the session and can be merged into another sketch with rtt_sketch_merge()
+ * to summarise many sessions.
+ */
+rtt_sketch_t *rtt_n_sequence_inside_sketch (void *data);
+
+/*
+ * Return the sketch of the RTT samples for the outside half of the
+ * connection, or NULL if there are no samples yet.
+ */
+rtt_sketch_t *rtt_n_sequence_outside_sketch (void *data);
+
 /*
  * This returns the session module for use by the session manager.
  */
 struct session_module_t *rtt_n_sequence_module ();
 
+/*
+ * The update function of the module, which a pipeline built with
+ * sessionpipeline.h can call directly.
+ */
+struct session_packet_t;
+int rtt_n_sequence_update (void *data, const struct session_packet_t *packet);
+
 /*
  * This returns the rtt module for use by the reordering module.
  */
@@ -0,0 +1,261 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+/*
+ * The bucket index of a sample is found from its value in microseconds. 
+ * Values below 16 have a bucket each. Above that, the position of the
+ * highest set bit selects a group of 16 buckets and the next four bits
+ * select the bucket within the group. This is the same scheme as used by
+ * HDR histograms and needs no floating point logarithms.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "serialize.h"
+#include "mempool.h"
+#include "rttsketch.h"
+
+/* Number of bits used to select a bucket within a power of two */
+#define RTT_SKETCH_SUB_BITS 4
+#define RTT_SKETCH_SUB_BUCKETS (1 << RTT_SKETCH_SUB_BITS)
+
+/* The highest power of two of microseconds that gets its own buckets */
+#define RTT_SKETCH_MAX_EXPONENT 24
+
+#define RTT_SKETCH_BUCKETS ((RTT_SKETCH_MAX_EXPONENT - RTT_SKETCH_SUB_BITS + 2) * RTT_SKETCH_SUB_BUCKETS)
+
+struct rtt_sketch_t {
+	/* The total number of samples */
+	uint64_t count;
+
+	/* The number of samples in each bucket, as wide as count so that
+	 * merging many sketches cannot overflow a bucket
+	 */
+	uint64_t buckets[RTT_SKETCH_BUCKETS];
+};
+
+/*
+ * Returns the bucket index for a value in microseconds.
+ */
+int rtt_sketch_bucket (uint32_t usec);
+
+/*
+ * Returns the value in microseconds that represents a bucket, which is the
+ * middle of the range of values counted in the bucket.
+ */
+double rtt_sketch_bucket_value (int bucket);
+
+/*
+ * Returns the bucket index for a value in microseconds.
+ */
+int rtt_sketch_bucket (uint32_t usec) {
+	int exponent = 0;
+	uint32_t value;
+
+	if (usec < RTT_SKETCH_SUB_BUCKETS)
+		return usec;
+
+	/* Find the position of the highest set bit */
+	for (value = usec; value >= 2; value >>= 1)
+		exponent++;
+
+	if (exponent > RTT_SKETCH_MAX_EXPONENT)
+		return RTT_SKETCH_BUCKETS - 1;
+
+	return (exponent - RTT_SKETCH_SUB_BITS + 1) * RTT_SKETCH_SUB_BUCKETS +
+		((usec >> (exponent - RTT_SKETCH_SUB_BITS)) & (RTT_SKETCH_SUB_BUCKETS - 1));
+}
+
+/*
+ * Returns the value in microseconds that represents a bucket, which is the
+ * middle of the range of values counted in the bucket.
+ */
+double rtt_sketch_bucket_value (int bucket) {
+	int exponent, sub;
+	double width;
+
+	if (bucket < RTT_SKETCH_SUB_BUCKETS)
+		return bucket;
+
+	exponent = bucket / RTT_SKETCH_SUB_BUCKETS + RTT_SKETCH_SUB_BITS - 1;
+	sub = bucket % RTT_SKETCH_SUB_BUCKETS;
+	width = (double) (1 << (exponent - RTT_SKETCH_SUB_BITS));
+
+	return (double) (1 << exponent) + (sub + 0.5) * width;
+}
+
+/*
+ * Allocates a new, empty sketch.
+ */
+rtt_sketch_t *rtt_sketch_create () {
+	rtt_sketch_t *sketch = mem_alloc (sizeof (rtt_sketch_t));
+	rtt_sketch_clear (sketch);
+	return sketch;
+}
+
+/*
+ * Frees the memory associated with a sketch.
+ */
+void rtt_sketch_destroy (rtt_sketch_t * sketch) {
+	mem_free (sketch);
+}
+
+/*
+ * Removes all samples from the sketch.
+ */
+void rtt_sketch_clear (rtt_sketch_t * sketch) {
+	sketch->count = 0;
+	memset (sketch->buckets, 0, sizeof (sketch->buckets));
+}
+
+/*
+ * Adds an RTT sample, given in seconds, to the sketch.
+ */
+void rtt_sketch_add (rtt_sketch_t * sketch, double rtt) {
+	uint32_t usec;
+
+	if (rtt < 0.0)
+		return;
+
+	/* Anything that does not fit in 32 bits belongs in the last bucket */
+	if (rtt >= 4294.0)
+		usec = 0xffffffff;
+	else
+		usec = (uint32_t) (rtt * 1000000.0);
+
+	rtt_sketch_add_usec (sketch, usec);
+}
+
+/*
+ * Adds an RTT sample, given in microseconds, to the sketch.
+ */
+void rtt_sketch_add_usec (rtt_sketch_t * sketch, uint32_t usec) {
+	sketch->buckets[rtt_sketch_bucket (usec)]++;
+	sketch->count++;
+}
+
+/*
+ * Adds all the samples of the source sketch to the destination sketch.
+ * A NULL source is treated as an empty sketch.
+ */
+void rtt_sketch_merge (rtt_sketch_t * dest, const rtt_sketch_t * source) {
+	int i;
+
+	if (source == NULL)
+		return;
+
+	for (i = 0; i < RTT_SKETCH_BUCKETS; i++)
+		dest->buckets[i] += source->buckets[i];
+	dest->count += source->count;
+}
+
+/*
+ * Returns the number of samples in the sketch.
+ */
+uint64_t rtt_sketch_count (const rtt_sketch_t * sketch) {
+	return sketch->count;
+}
+
+/*
+ * Returns the estimated q-quantile (0 <= q <= 1) of the samples in seconds,
+ * e.g. q = 0.99 for the 99th percentile, or -1.0 if the sketch is empty.
+ */
+double rtt_sketch_quantile (const rtt_sketch_t * sketch, double q) {
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (sketch->count == 0)
+		return -1.0;
+
+	if (q < 0.0)
+		q = 0.0;
+	if (q > 1.0)
+		q = 1.0;
+
+	/* The rank of the sample we are looking for, counting from zero */
+	rank = (uint64_t) (q * (sketch->count - 1));
+
+	for (i = 0; i < RTT_SKETCH_BUCKETS; i++) {
+		seen += sketch->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	return rtt_sketch_bucket_value (i) / 1000000.0;
+}
+
+/*
+ * Writes the sketch into a serial buffer. Only the range of buckets that
+ * hold samples is written.
+ */
+void rtt_sketch_serialize (const rtt_sketch_t * sketch, struct serial_t *serial) {
+	uint16_t first = 0, last = 0;
+
+	if (sketch->count > 0) {
+		first = 0;
+		while (sketch->buckets[first] == 0)
+			first++;
+		last = RTT_SKETCH_BUCKETS - 1;
+		while (sketch->buckets[last] == 0)
+			last--;
+		last++;
+	}
+
+	SERIAL_PUT (serial, sketch->count);
+	SERIAL_PUT (serial, first);
+	SERIAL_PUT (serial, last);
+	serial_write (serial, &(sketch->buckets[first]), (last - first) * sizeof (sketch->buckets[0]));
+}
+
+/*
+ * Reads a sketch written by rtt_sketch_serialize(), returning NULL if the
+ * buffer is not valid.
+ */
+rtt_sketch_t *rtt_sketch_deserialize (struct serial_t *serial) {
+	rtt_sketch_t *sketch = rtt_sketch_create ();
+	uint16_t first, last;
+
+	SERIAL_GET (serial, sketch->count);
+	SERIAL_GET (serial, first);
+	SERIAL_GET (serial, last);
+
+	if (serial->error || first > last || last > RTT_SKETCH_BUCKETS) {
+		rtt_sketch_destroy (sketch);
+		return NULL;
+	}
+
+	serial_read (serial, &(sketch->buckets[first]), (last - first) * sizeof (sketch->buckets[0]));
+	if (serial->error) {
+		rtt_sketch_destroy (sketch);
+		return NULL;
+	}
+	return sketch;
+}
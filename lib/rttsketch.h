@@ -0,0 +1,115 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef RTTSKETCH_H_
+#define RTTSKETCH_H_
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An RTT sketch is a small, fixed-size summary of a stream of RTT samples
+ * that can answer quantile queries. Samples are counted in log-linear
+ * buckets: every power of two of microseconds is split into 16 equal
+ * buckets, so a quantile is reported with a relative error of at most
+ * 1/32 (about 3%). Samples above 2^25 microseconds (33 seconds) are counted
+ * in the last bucket.
+ *
+ * All sketches share the same bucket layout, so two sketches can be merged
+ * by adding their counts. This allows quantiles to be computed over many
+ * sessions without keeping the samples themselves.
+ */
+typedef struct rtt_sketch_t rtt_sketch_t;
+
+/*
+ * Allocates a new, empty sketch.
+ */
+rtt_sketch_t *rtt_sketch_create ();
+
+/*
+ * Frees the memory associated with a sketch.
+ */
+void rtt_sketch_destroy (rtt_sketch_t * sketch);
+
+/*
+ * Removes all samples from the sketch.
+ */
+void rtt_sketch_clear (rtt_sketch_t * sketch);
+
+/*
+ * Adds an RTT sample, given in seconds, to the sketch.
+ */
+void rtt_sketch_add (rtt_sketch_t * sketch, double rtt);
+
+/*
+ * Adds an RTT sample, given in microseconds, to the sketch.
+ */
+void rtt_sketch_add_usec (rtt_sketch_t * sketch, uint32_t usec);
+
+/*
+ * Adds all the samples of the source sketch to the destination sketch.
+ * A NULL source is treated as an empty sketch.
+ */
+void rtt_sketch_merge (rtt_sketch_t * dest, const rtt_sketch_t * source);
+
+/*
+ * Returns the number of samples in the sketch.
+ */
+uint64_t rtt_sketch_count (const rtt_sketch_t * sketch);
+
+/*
+ * Returns the estimated q-quantile (0 <= q <= 1) of the samples in seconds,
+ * e.g. q = 0.99 for the 99th percentile, or -1.0 if the sketch is empty.
+ */
+double rtt_sketch_quantile (const rtt_sketch_t * sketch, double q);
+
+struct serial_t;
+
+/*
+ * Writes the sketch into a serial buffer. Only the range of buckets that
+ * hold samples is written.
+ */
+void rtt_sketch_serialize (const rtt_sketch_t * sketch, struct serial_t *serial);
+
+/*
+ * Reads a sketch written by rtt_sketch_serialize(), returning NULL if the
+ * buffer is not valid.
+ */
+rtt_sketch_t *rtt_sketch_deserialize (struct serial_t *serial);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*RTTSKETCH_H_ */
@@ -41,24 +41,40 @@
  * 		estimate > 20s
  * 
  * Smoothing function rtt = (new + rtt*3) /4
+ *
+ * Times are integers: the queues keep a 32 bit microsecond clock and the
+ * estimates are in microseconds, scaled by 4 so the smoothing is a shift.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <libtrace.h>
 #include "sessionmanager.h"
+#include "tcpsession.h"
 #include "rttmodule.h"
 #include "queue.h"
+#include "seqnum.h"
+#include "minfilter.h"
+#include "serialize.h"
+#include "mempool.h"
 #include "rtttimestamp.h"
 
 #define RTT_MULT 5
-#define MAX_RTT 20
-#define SMOOTH 0.75
+#define MAX_RTT 20000000
+#define SMOOTH_SHIFT 2
 
 #define DATA_PACKETS_ONLY 1
 
-// This allows our queue of timestamp/time pairs to grow indefinitely.
-struct queue_vars_t rtt_timestamp_queue_vars = { -1, 0, 0 };
+// Default length, in seconds, of the window for the minimum RTT
+#define MIN_RTT_WINDOW 10.0
+
+/*
+ * The settings of an rtt_timestamp module.
+ */
+struct rtt_timestamp_config_t {
+	// The length of the window over which the minimum RTT is taken, in ns.
+	uint64_t min_rtt_window;
+};
 
 /*
  * This struct is an item of the queue. We need to store the timestamps
@@ -66,37 +82,43 @@ struct queue_vars_t rtt_timestamp_queue_vars = { -1, 0, 0 };
  */
 struct rtt_timestamp_item_t {
 	uint32_t timestamp;
-	double time;
+	uint32_t time;		// 32 bit microsecond clock
 };
 
+// This allows our queue of timestamp/time pairs to grow indefinitely.
+// Guess that an increment of 10 will do. It is never changed, so it is
+// shared by every module.
+struct queue_vars_t rtt_timestamp_queue_vars = { -1, 10, sizeof (struct rtt_timestamp_item_t) };
+
 /*
  * This struct keeps track of the average rtt over the session and also
  * stores the timestamp/time queues for both directions.
  */
 struct rtt_timestamp_t {
+	struct rtt_timestamp_config_t *config;
 	struct queue_t *queue[2];
-	double estimates[2];
-	double totals[2];
+	uint32_t estimates[2];	// microseconds scaled by 4, valid once counts is set
+	uint64_t totals[2];		// microseconds
 	int counts[2];
+	struct min_filter_t min_rtt[2];
 };
 
 /*
  * Allocates and initialises a new data structure for a new tcp session.
  */
-void *rtt_timestamp_create () {
-	struct rtt_timestamp_t *rtt_data = malloc (sizeof (struct rtt_timestamp_t));
+void *rtt_timestamp_create (void *config) {
+	struct rtt_timestamp_t *rtt_data = mem_alloc (sizeof (struct rtt_timestamp_t));
 	int i;
 
-	// Guess that an increment of 10 will do
-	rtt_timestamp_queue_vars.buffer_increment = 10;
-	rtt_timestamp_queue_vars.item_size = sizeof (struct rtt_timestamp_item_t);
+	rtt_data->config = (struct rtt_timestamp_config_t *) config;
 
 	// Initialise the variables for both directions.
 	for (i = 0; i < 2; i++) {
 		rtt_data->queue[i] = queue_create (&rtt_timestamp_queue_vars);
-		rtt_data->estimates[i] = -1.0;
+		rtt_data->estimates[i] = 0;
 		rtt_data->counts[i] = 0;
-		rtt_data->totals[i] = 0.0;
+		rtt_data->totals[i] = 0;
+		min_filter_clear (&(rtt_data->min_rtt[i]));
 	}
 	return rtt_data;
 }
@@ -108,84 +130,87 @@ void rtt_timestamp_destroy (void *data) {
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 	queue_destroy (rtt_data->queue[0]);
 	queue_destroy (rtt_data->queue[1]);
-	free (rtt_data);
+	mem_free (rtt_data);
 }
 
 /*
  * Updates the RTT estimates given a new packet belonging to the flow.
  */
-void rtt_timestamp_update (void *data, struct libtrace_packet_t *packet) {
+int rtt_timestamp_update (void *data, const struct session_packet_t *packet) {
 
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 
-	struct libtrace_tcp *tcpptr = trace_get_tcp (packet);
-	struct libtrace_ip *ipptr = trace_get_ip (packet);
+	const struct libtrace_tcp *tcpptr = packet->tcp;
 
 	struct queue_itr_t itr;
 	struct queue_t *queue;
 	struct rtt_timestamp_item_t *item;
 
-	double now, diff;
+	uint64_t time;
+	uint32_t now, diff;
 
 	unsigned char *pkt = NULL;
 	int plen;
 	unsigned char type = 0, optlen = 0, *optdata = NULL;
 	
-	int direction = trace_get_direction (packet);
+	int direction = packet->direction;
 	int reverse = 1 - direction;
 
 	// Check that the direction is ok
 	if(!(direction==0 || direction==1))
-		return;
+		return SM_WANT_ALL;
 
-	now = trace_get_seconds (packet);
+	time = packet->time;
+	now = TCP_TIME_USEC32 (time);
 
 	// Search for the timestamp option.
 	pkt = (unsigned char *) tcpptr + sizeof (*tcpptr);
 	plen = (tcpptr->doff * 4 - sizeof *tcpptr);
 
 	while (trace_get_next_option (&pkt, &plen, &type, &optlen, &optdata)) {
-		uint32_t *ts = NULL;
-		uint32_t *tsecho = NULL;
+		uint32_t ts;
+		uint32_t tsecho;
 
 		// Ignore non timestamp options
 		if (type != 8) {
 			continue;
 		}
 
-		ts = (uint32_t *) & optdata[0];
-		tsecho = (uint32_t *) & optdata[4];
+		// Timestamps wrap, so keep them in host order for comparisons
+		ts = ntohl (*(uint32_t *) & optdata[0]);
+		tsecho = ntohl (*(uint32_t *) & optdata[4]);
 
 		// Look for timestamp of reverse direction of which this is an echo
 		queue = rtt_data->queue[reverse];
 		item = queue_itr_begin (queue, &rtt_timestamp_queue_vars, &itr);
 		while (item != NULL) {
-			if (*tsecho > item->timestamp) {
+			if (SEQ_GT (tsecho, item->timestamp)) {
 
 				// Remove elements from queue.
 				queue_itr_remove (queue, &itr);
 				item = queue_itr_next (queue, &rtt_timestamp_queue_vars, &itr);
 
-			} else if (*tsecho == item->timestamp) {
+			} else if (tsecho == item->timestamp) {
 
 				// Update RTT.
 				diff = now - item->time;
 				if (diff < MAX_RTT) {
 					// Record value for average measurement
 					rtt_data->totals[reverse] += diff;
-					rtt_data->counts[reverse]++;
+					min_filter_update (&(rtt_data->min_rtt[reverse]), rtt_data->config->min_rtt_window, time, diff);
 
-					if (rtt_data->estimates[reverse] == -1.0) {
-						rtt_data->estimates[reverse] = diff;
+					if (rtt_data->counts[reverse] == 0) {
+						rtt_data->estimates[reverse] = diff << SMOOTH_SHIFT;
 					} else {	// smooth
 						if(RTT_MULT) {
-							if(rtt_data->estimates[reverse]*5 < diff)
-								rtt_data->estimates[reverse] = (SMOOTH * rtt_data->estimates[reverse]) + ((1 - SMOOTH) * diff);
+							if((uint64_t) (rtt_data->estimates[reverse] >> SMOOTH_SHIFT) * RTT_MULT < diff)
+								rtt_data->estimates[reverse] += diff - (rtt_data->estimates[reverse] >> SMOOTH_SHIFT);
 						} else {
-							rtt_data->estimates[reverse] = (SMOOTH * rtt_data->estimates[reverse]) + ((1 - SMOOTH) * diff);
+							rtt_data->estimates[reverse] += diff - (rtt_data->estimates[reverse] >> SMOOTH_SHIFT);
 						}
 
 					}
+					rtt_data->counts[reverse]++;
 				}
 				break;
 
@@ -196,11 +221,11 @@ void rtt_timestamp_update (void *data, struct libtrace_packet_t *packet) {
 		}
 
 		// Add this packet's timestamp to the queue
-		if (*ts) {
+		if (ts) {
 
 			if(DATA_PACKETS_ONLY) {
-				if((ntohs (ipptr->ip_len) - ((ipptr->ip_hl + tcpptr->doff) << 2)) == 0) {
-					return;
+				if(packet->payload == 0) {
+					return SM_WANT_ALL;
 				}
 			}
 
@@ -209,7 +234,7 @@ void rtt_timestamp_update (void *data, struct libtrace_packet_t *packet) {
 			item = queue_itr_begin (queue, &rtt_timestamp_queue_vars, &itr);
 			while (item != NULL) {
 				// If item is found, update time and then break
-				if (item->timestamp == *ts) {
+				if (item->timestamp == ts) {
 					item->time = now;
 					break;
 				} else {
@@ -221,11 +246,13 @@ void rtt_timestamp_update (void *data, struct libtrace_packet_t *packet) {
 				// Not found, so add new timestamp
 				struct rtt_timestamp_item_t new_item;
 				new_item.time = now;
-				new_item.timestamp = *ts;
+				new_item.timestamp = ts;
 				queue_add (queue, &rtt_timestamp_queue_vars, &new_item);
 			}
 		}
 	}
+
+	return SM_WANT_ALL;
 }
 
 /*
@@ -234,8 +261,8 @@ void rtt_timestamp_update (void *data, struct libtrace_packet_t *packet) {
 double rtt_timestamp_total (void *data) {
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 
-	if (rtt_data->estimates[1] > 0.0 && rtt_data->estimates[0] > 0.0)
-		return rtt_data->estimates[1] + rtt_data->estimates[0];
+	if (rtt_data->estimates[1] > 0 && rtt_data->estimates[0] > 0)
+		return TCP_USEC_TO_SEC ((rtt_data->estimates[1] >> SMOOTH_SHIFT) + (rtt_data->estimates[0] >> SMOOTH_SHIFT));
 	else
 		return -1.0;
 }
@@ -246,8 +273,8 @@ double rtt_timestamp_total (void *data) {
 double rtt_timestamp_inside (void *data) {
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 
-	if (rtt_data->estimates[1] > 0.0)
-		return rtt_data->estimates[1];
+	if (rtt_data->estimates[1] > 0)
+		return TCP_USEC_TO_SEC (rtt_data->estimates[1] >> SMOOTH_SHIFT);
 	else
 		return -1.0;
 }
@@ -258,8 +285,8 @@ double rtt_timestamp_inside (void *data) {
 double rtt_timestamp_outside (void *data) {
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 
-	if (rtt_data->estimates[0] > 0.0)
-		return rtt_data->estimates[0];
+	if (rtt_data->estimates[0] > 0)
+		return TCP_USEC_TO_SEC (rtt_data->estimates[0] >> SMOOTH_SHIFT);
 	else
 		return -1.0;
 }
@@ -270,21 +297,141 @@ double rtt_timestamp_outside (void *data) {
 double rtt_timestamp_average (void *data) {
 	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
 
-	if ((rtt_data->totals[1] > 0.0) && (rtt_data->totals[0] > 0.0)) {
-		return (rtt_data->totals[0] / rtt_data->counts[0]) + (rtt_data->totals[1] / rtt_data->counts[1]);
+	if ((rtt_data->totals[1] > 0) && (rtt_data->totals[0] > 0)) {
+		return TCP_USEC_TO_SEC ((rtt_data->totals[0] / rtt_data->counts[0]) + (rtt_data->totals[1] / rtt_data->counts[1]));
 	} else {
 		return -1.0;
 	}
 }
 
+/*
+ * Return the minimum RTT within the window for the inside half of the
+ * connection.
+ */
+double rtt_timestamp_inside_min (void *data) {
+	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
+	uint32_t min = min_filter_get (&(rtt_data->min_rtt[1]));
+	if (min != MIN_FILTER_NONE)
+		return TCP_USEC_TO_SEC (min);
+	else
+		return -1.0;
+}
+
+/*
+ * Return the minimum RTT within the window for the outside half of the
+ * connection.
+ */
+double rtt_timestamp_outside_min (void *data) {
+	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
+	uint32_t min = min_filter_get (&(rtt_data->min_rtt[0]));
+	if (min != MIN_FILTER_NONE)
+		return TCP_USEC_TO_SEC (min);
+	else
+		return -1.0;
+}
+
+/*
+ * Sets the length, in seconds, of the window over which the minimum RTT
+ * is taken. The default is 10 seconds.
+ */
+void rtt_timestamp_set_min_rtt_window (struct session_module_t *module, double window) {
+	struct rtt_timestamp_config_t *config = (struct rtt_timestamp_config_t *) module->config;
+
+	if (window > 0.0) {
+		config->min_rtt_window = TCP_SEC_TO_NSEC (window);
+	} else {
+		config->min_rtt_window = TCP_SEC_TO_NSEC (MIN_RTT_WINDOW);
+		fprintf (stderr, "rtt_timestamp: Minimum RTT window out of range\n");
+	}
+}
+
+/*
+ * Writes the data of a session into a buffer for a checkpoint.
+ */
+size_t rtt_timestamp_serialize (void *data, char *buf, size_t len) {
+	struct rtt_timestamp_t *rtt_data = (struct rtt_timestamp_t *) data;
+	struct serial_t serial;
+	struct queue_itr_t itr;
+	struct rtt_timestamp_item_t *item;
+	uint32_t length;
+	int i;
+
+	serial_writer_init (&serial, buf, len);
+
+	for (i = 0; i < 2; i++) {
+		// The outstanding timestamps, oldest first
+		length = queue_length (rtt_data->queue[i]);
+		SERIAL_PUT (&serial, length);
+		item = queue_itr_begin (rtt_data->queue[i], &rtt_timestamp_queue_vars, &itr);
+		while (item != NULL) {
+			SERIAL_PUT (&serial, item->timestamp);
+			SERIAL_PUT (&serial, item->time);
+			item = queue_itr_next (rtt_data->queue[i], &rtt_timestamp_queue_vars, &itr);
+		}
+
+		SERIAL_PUT (&serial, rtt_data->estimates[i]);
+		SERIAL_PUT (&serial, rtt_data->totals[i]);
+		SERIAL_PUT (&serial, rtt_data->counts[i]);
+		SERIAL_PUT (&serial, rtt_data->min_rtt[i]);
+	}
+
+	return serial.pos;
+}
+
+/*
+ * Rebuilds the data of a session from a checkpoint.
+ */
+void *rtt_timestamp_deserialize (void *config, const char *buf, size_t len) {
+	struct rtt_timestamp_t *rtt_data = rtt_timestamp_create (config);
+	struct serial_t serial;
+	struct rtt_timestamp_item_t item;
+	uint32_t length, j;
+	int i;
+
+	serial_reader_init (&serial, buf, len);
+
+	for (i = 0; i < 2 && !serial.error; i++) {
+		SERIAL_GET (&serial, length);
+		for (j = 0; j < length && !serial.error; j++) {
+			SERIAL_GET (&serial, item.timestamp);
+			SERIAL_GET (&serial, item.time);
+			queue_add (rtt_data->queue[i], &rtt_timestamp_queue_vars, &item);
+		}
+
+		SERIAL_GET (&serial, rtt_data->estimates[i]);
+		SERIAL_GET (&serial, rtt_data->totals[i]);
+		SERIAL_GET (&serial, rtt_data->counts[i]);
+		SERIAL_GET (&serial, rtt_data->min_rtt[i]);
+	}
+
+	if (serial.error) {
+		rtt_timestamp_destroy (rtt_data);
+		return NULL;
+	}
+	return rtt_data;
+}
+
+/*
+ * Allocates the settings of a new module, with the defaults.
+ */
+struct rtt_timestamp_config_t *rtt_timestamp_config () {
+	struct rtt_timestamp_config_t *config = malloc (sizeof (struct rtt_timestamp_config_t));
+	config->min_rtt_window = TCP_SEC_TO_NSEC (MIN_RTT_WINDOW);
+	return config;
+}
+
 /*
  * This returns the session module for use by the session manager.
  */
 struct session_module_t *rtt_timestamp_module () {
 	struct session_module_t *session_module = (struct session_module_t *) malloc (sizeof (struct session_module_t));
+	session_module->config = rtt_timestamp_config ();
 	session_module->create = &rtt_timestamp_create;
 	session_module->destroy = &rtt_timestamp_destroy;
 	session_module->update = &rtt_timestamp_update;
+	session_module->serialize = &rtt_timestamp_serialize;
+	session_module->deserialize = &rtt_timestamp_deserialize;
+	session_module->syn = NULL;
 
 	return session_module;
 }
@@ -294,9 +441,13 @@ struct session_module_t *rtt_timestamp_module () {
  */
 struct rtt_module_t *rtt_timestamp_rtt_module () {
 	struct rtt_module_t *module = malloc (sizeof (struct rtt_module_t));
+	module->session_module.config = rtt_timestamp_config ();
 	module->session_module.create = &rtt_timestamp_create;
 	module->session_module.destroy = &rtt_timestamp_destroy;
 	module->session_module.update = &rtt_timestamp_update;
+	module->session_module.serialize = &rtt_timestamp_serialize;
+	module->session_module.deserialize = &rtt_timestamp_deserialize;
+	module->session_module.syn = NULL;
 	module->inside_rtt = &(rtt_timestamp_inside);
 	module->outside_rtt = &(rtt_timestamp_outside);
 	return module;
@@ -37,6 +37,13 @@
  */
 struct session_module_t *rtt_timestamp_module ();
 
+/*
+ * The update function of the module, which a pipeline built with
+ * sessionpipeline.h can call directly.
+ */
+struct session_packet_t;
+int rtt_timestamp_update (void *data, const struct session_packet_t *packet);
+
 /*
  * This returns the rtt module for use by the reordering module.
  */
@@ -62,4 +69,25 @@ double rtt_timestamp_outside (void *data);
  */
 double rtt_timestamp_average (void *data);
 
+/*
+ * Return the minimum RTT within the window for the inside half of the
+ * connection, or -1.0 if there are no samples. This estimates the
+ * propagation delay of the path.
+ */
+double rtt_timestamp_inside_min (void *data);
+
+/*
+ * Return the minimum RTT within the window for the outside half of the
+ * connection, or -1.0 if there are no samples.
+ */
+double rtt_timestamp_outside_min (void *data);
+
+/*
+ * Sets the length, in seconds, of the sliding window over which the minimum
+ * RTT is taken. The default is 10 seconds. The module is one returned by
+ * rtt_timestamp_module(), or the session_module of one returned by
+ * rtt_timestamp_rtt_module().
+ */
+void rtt_timestamp_set_min_rtt_window (struct session_module_t *module, double window);
+
 #endif							/*RTTTIMESTAMP_H_ */
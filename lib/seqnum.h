@@ -0,0 +1,50 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef SEQNUM_H_
+#define SEQNUM_H_
+
+#include <inttypes.h>
+
+/*
+ * Comparisons of 32-bit TCP sequence numbers (and other values that wrap,
+ * such as acknowledgements and timestamps) using serial number arithmetic
+ * as described in RFC 1982. The difference between the two values is
+ * taken modulo 2^32 and interpreted as signed, so a value just after a
+ * wrap compares as greater than a value just before it. This is correct
+ * as long as the two values are less than 2^31 apart.
+ */
+#define SEQ_LT(a, b)	((int32_t) ((uint32_t) (a) - (uint32_t) (b)) < 0)
+#define SEQ_LEQ(a, b)	((int32_t) ((uint32_t) (a) - (uint32_t) (b)) <= 0)
+#define SEQ_GT(a, b)	((int32_t) ((uint32_t) (a) - (uint32_t) (b)) > 0)
+#define SEQ_GEQ(a, b)	((int32_t) ((uint32_t) (a) - (uint32_t) (b)) >= 0)
+
+#endif							/*SEQNUM_H_ */
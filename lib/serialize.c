@@ -0,0 +1,107 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <string.h>
+#include "serialize.h"
+
+/*
+ * Prepares to write into buf, which is len bytes long. buf may be NULL
+ * to only measure the number of bytes needed.
+ */
+void serial_writer_init (struct serial_t *serial, char *buf, size_t len) {
+	serial->out = buf;
+	serial->in = NULL;
+	serial->len = (buf == NULL) ? 0 : len;
+	serial->pos = 0;
+	serial->error = 0;
+}
+
+/*
+ * Prepares to read from buf, which is len bytes long.
+ */
+void serial_reader_init (struct serial_t *serial, const char *buf, size_t len) {
+	serial->out = NULL;
+	serial->in = buf;
+	serial->len = len;
+	serial->pos = 0;
+	serial->error = 0;
+}
+
+/*
+ * Appends size bytes to the buffer.
+ */
+void serial_write (struct serial_t *serial, const void *data, size_t size) {
+	char *space = serial_space (serial, size);
+	if (space != NULL)
+		memcpy (space, data, size);
+}
+
+/*
+ * Reads size bytes from the buffer.
+ */
+void serial_read (struct serial_t *serial, void *data, size_t size) {
+	const char *bytes = serial_skip (serial, size);
+	if (bytes != NULL)
+		memcpy (data, bytes, size);
+	else
+		memset (data, 0, size);
+}
+
+/*
+ * Reserves size bytes when writing and returns a pointer to them, or NULL
+ * if the buffer is too small.
+ */
+char *serial_space (struct serial_t *serial, size_t size) {
+	char *space = NULL;
+
+	if (serial->out != NULL && serial->pos + size <= serial->len)
+		space = serial->out + serial->pos;
+
+	serial->pos += size;
+	return space;
+}
+
+/*
+ * Skips over size bytes when reading and returns a pointer to them, or NULL
+ * if the buffer is too short.
+ */
+const char *serial_skip (struct serial_t *serial, size_t size) {
+	const char *bytes;
+
+	if (serial->error || serial->in == NULL || serial->pos + size > serial->len) {
+		serial->error = 1;
+		return NULL;
+	}
+
+	bytes = serial->in + serial->pos;
+	serial->pos += size;
+	return bytes;
+}
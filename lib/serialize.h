@@ -0,0 +1,107 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A serial buffer is used by modules to write their state into, and read
+ * it back from, a session snapshot. Values are copied in host byte order
+ * as snapshots are only meant to be read back on the same machine.
+ *
+ * When writing, the position keeps advancing even when the buffer is too
+ * small (or NULL), so after writing everything the position holds the
+ * number of bytes needed. When reading, running past the end of the
+ * buffer sets the error flag and leaves the values zeroed.
+ */
+struct serial_t {
+	/* The buffer being written to, or NULL when reading or measuring */
+	char *out;
+
+	/* The buffer being read from, or NULL when writing */
+	const char *in;
+
+	/* The size of the buffer */
+	size_t len;
+
+	/* The number of bytes written or read so far */
+	size_t pos;
+
+	/* Set when a read runs past the end of the buffer */
+	int error;
+};
+
+/*
+ * Prepares to write into buf, which is len bytes long. buf may be NULL
+ * to only measure the number of bytes needed.
+ */
+void serial_writer_init (struct serial_t *serial, char *buf, size_t len);
+
+/*
+ * Prepares to read from buf, which is len bytes long.
+ */
+void serial_reader_init (struct serial_t *serial, const char *buf, size_t len);
+
+/*
+ * Appends size bytes to the buffer.
+ */
+void serial_write (struct serial_t *serial, const void *data, size_t size);
+
+/*
+ * Reads size bytes from the buffer.
+ */
+void serial_read (struct serial_t *serial, void *data, size_t size);
+
+/*
+ * Reserves size bytes when writing, or skips over size bytes when reading,
+ * and returns a pointer to them. Returns NULL if the bytes are not
+ * available, e.g. when only measuring.
+ */
+char *serial_space (struct serial_t *serial, size_t size);
+const char *serial_skip (struct serial_t *serial, size_t size);
+
+/*
+ * Write or read a single variable or struct member.
+ */
+#define SERIAL_PUT(serial, value) serial_write ((serial), &(value), sizeof (value))
+#define SERIAL_GET(serial, value) serial_read ((serial), &(value), sizeof (value))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*SERIALIZE_H_ */
@@ -32,6 +32,9 @@
 
 #define SM_MODULE_ARRAY_LENGTH 5
 
+/* The number of sessions the reclaim list starts with, and grows by at least */
+#define SM_RECLAIM_INCREMENT 1024
+
 #define SM_OUTBOUND 0
 #define SM_INBOUND 1
 
@@ -43,12 +46,40 @@
 #define SM_TCP_SYN_TIMEOUT 60
 #define SM_TIME_WAIT_TIMEOUT 60
 
+/*
+ * The expected_ack of a session whose SYN/ACK has not been seen yet.
+ */
+#define SM_NO_EXPECTED_ACK 0xffffffff
+
+/*
+ * Snapshot files start with this magic string and version. The byte order
+ * mark catches snapshots moved to a machine of a different byte order.
+ */
+#define SM_SNAPSHOT_MAGIC "TCPTSNAP"
+#define SM_SNAPSHOT_VERSION 3
+#define SM_SNAPSHOT_BYTE_ORDER 0x01020304
+
+/*
+ * The length written for a module that could not be serialized.
+ */
+#define SM_SNAPSHOT_NO_DATA 0xffffffff
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <libtrace.h>
 #include "tcpsession.h"
 #include "hashtable.h"
+#include "seqnum.h"
+#include "queue.h"
+#include "mempool.h"
 #include "sessionmanager.h"
+#include "syncache.h"
+#include "topk.h"
+#include "aggregate.h"
+
+/* The reclaim list holds pointers to ended sessions and can grow. */
+struct queue_vars_t session_manager_reclaim_vars = { -1, SM_RECLAIM_INCREMENT, sizeof (tcp_session_t *) };
 
 /*
  * This struct holds the state of a session manager.
@@ -88,6 +119,72 @@ struct session_manager_t {
    * should only be freed on the next call of the update function.
    */
   tcp_session_t *closed_session;
+
+  /*
+   * The function called with each session before it is freed, if any.
+   */
+  session_close_callback_t close_callback;
+  void *close_arg;
+
+  /*
+   * Ended sessions whose module data is still to be freed, and how many
+   * of them to free per packet. A budget of 0 frees sessions at once.
+   */
+  struct queue_t *reclaim;
+  int reclaim_budget;
+
+  /*
+   * Flow sampling: a session is tracked if the keyed hash of its ID is
+   * no more than the threshold. The rate is 1 when sampling is off.
+   */
+  uint32_t sample_rate;
+  uint32_t sample_threshold;
+  uint64_t sample_key;
+
+  /*
+   * The cache of bare SYNs, or NULL if SYNs create sessions straight away.
+   */
+  syn_cache_t *syn_cache;
+
+  /*
+   * The inside prefixes used to set the direction of packets, or NULL.
+   */
+  prefix_table_t *inside;
+
+  /*
+   * Set if packets of untracked sessions are ignored.
+   */
+  int follow_only;
+
+  /*
+   * The time in seconds after which idle sessions expire, or 0.
+   */
+  uint32_t idle_timeout;
+
+  /*
+   * The specialised update of the modules, if any, and how many modules
+   * it was built for.
+   */
+  session_pipeline_t pipeline;
+  int pipeline_count;
+
+  /*
+   * The top-K trackers kept up to date with the sessions.
+   */
+  struct top_k_t **top_k;
+  int top_k_count;
+
+  /*
+   * The aggregate tables fed from the sessions.
+   */
+  struct aggregate_t **aggregates;
+  int aggregate_count;
+
+  /*
+   * The allocator of the sessions and their data, or NULL to use
+   * malloc().
+   */
+  const struct mem_allocator_t *allocator;
 };
 
 /*
@@ -95,11 +192,62 @@ struct session_manager_t {
  */
 void session_manager_free_session (session_manager_t * manager, tcp_session_t * session);
 
+/*
+ * Updates the session of a packet whose headers have been found, for
+ * session_manager_update() and session_manager_update_raw().
+ */
+tcp_session_t *session_manager_update_packet (session_manager_t * manager, const struct session_packet_t *pkt);
+
+/*
+ * Allocates a session with fresh module data and adds it to the hashtable.
+ * The caller sets the state.
+ */
+tcp_session_t *session_manager_new_session (session_manager_t * manager, tcp_session_id_t * id, uint64_t timestamp);
+
+/*
+ * Sets the direction of a packet from the inside prefixes, if there are any.
+ */
+void session_manager_classify (session_manager_t * manager, struct session_packet_t *pkt);
+
+/*
+ * Passes a packet that has no session to the SYN cache. Bare SYNs are
+ * cached, and a SYN/ACK that answers a cached SYN creates the session,
+ * which is returned in *session. Returns 1 if the packet was cached and
+ * needs no further processing, otherwise 0.
+ */
+int session_manager_syn_cache_update (session_manager_t * manager, tcp_session_id_t * id, const struct libtrace_tcp *tcp, int direction, uint64_t timestamp, tcp_session_t ** session);
+
+/*
+ * Reads the details of a SYN, including its options, into syn.
+ */
+void session_manager_parse_syn (const struct libtrace_tcp *tcp, int direction, uint64_t timestamp, struct tcp_syn_t *syn);
+
 /*
  * Frees the data associated with the modules for a session.
  */
 void session_manager_free_module_data (session_manager_t * manager, tcp_session_t * session);
 
+/*
+ * Records which packets a module wants from a session.
+ */
+void session_manager_set_wants (tcp_session_t * session, int module, int wants);
+
+/*
+ * Passes a session that is about to be freed to the close callback.
+ */
+void session_manager_notify_close (session_manager_t * manager, tcp_session_t * session);
+
+/*
+ * Frees a session that has already been removed from the hashtable, either
+ * now or later from the reclaim list.
+ */
+void session_manager_dispose (session_manager_t * manager, tcp_session_t * session);
+
+/*
+ * Frees the module data of a session and the session itself.
+ */
+void session_manager_release (session_manager_t * manager, tcp_session_t * session);
+
 /*
  * The cleanup routine to remove sessions in the SYN_RCVD or SYN_SENT state
  * due to unsolicited traffic.
@@ -123,21 +271,85 @@ void timer_queue_free (session_manager_t * manager, uint32_t current_time);
  */
 void timer_queue_free_early (session_manager_t * manager, tcp_session_t * session);
 
+/*
+ * Checks whether an acknowledgement number covers the expected_ack of a
+ * session, allowing for sequence number wraparound.
+ */
+int session_manager_is_acked (tcp_session_t * session, uint32_t ack);
 
+/*
+ * The header at the start of a snapshot file.
+ */
+struct snapshot_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t module_count;
+	uint32_t session_count;
+	uint32_t last_access;
+	uint32_t last_clean;
+};
+
+/*
+ * The fixed part of each session in a snapshot file, followed by a length
+ * and the serialized data for each module.
+ */
+struct snapshot_session_t {
+	tcp_session_id_t id;
+	uint32_t state;
+	uint32_t expected_ack;
+	uint8_t waiting;
+	uint8_t last_access;
+	uint8_t padding[6];
+	uint64_t start_time;
+	uint64_t end_time;
+};
+
+/*
+ * Writes one session to a snapshot file, using buf as scratch space for
+ * the module data. Returns 0 on success or -1 on a write error.
+ */
+int session_manager_write_session (session_manager_t * manager, tcp_session_t * session, FILE * file, char **buf, size_t * buf_len);
+
+/*
+ * Reads one session from a snapshot file. Returns NULL on error.
+ */
+tcp_session_t *session_manager_read_session (session_manager_t * manager, FILE * file, char **buf, size_t * buf_len);
+
+
+
+/*
+ * Zeroes a session module struct, leaving every optional member NULL, for
+ * modules that are not allocated with calloc().
+ */
+void session_module_init (struct session_module_t *module) {
+	memset (module, 0, sizeof (struct session_module_t));
+}
 
 /*
  * Creates and initialises a session manager.
  */
 session_manager_t *session_manager_create () {
+	return session_manager_create_with_allocator (NULL);
+}
+
+/*
+ * Creates a session manager whose memory, including that of its sessions
+ * and their module data, comes from the given allocator.
+ */
+session_manager_t *session_manager_create_with_allocator (const struct mem_allocator_t *allocator) {
 	int i;
+	session_manager_t *manager;
+	const struct mem_allocator_t *previous = mem_set_allocator (allocator);
 
 	/* Allocate and initialise memory */
 
-	session_manager_t *manager = (session_manager_t *) malloc (sizeof (session_manager_t));
+	manager = (session_manager_t *) mem_alloc (sizeof (session_manager_t));
+	manager->allocator = allocator;
 
 	manager->hashtable = hashtable_create ();
 
-	manager->modules = (struct session_module_t **) malloc (SM_MODULE_ARRAY_LENGTH * sizeof (struct session_module_t *));
+	manager->modules = (struct session_module_t **) mem_alloc (SM_MODULE_ARRAY_LENGTH * sizeof (struct session_module_t *));
 
 	for (i = 0; i < SM_MODULE_ARRAY_LENGTH; i++)
 		manager->modules[i] = NULL;
@@ -158,6 +370,30 @@ session_manager_t *session_manager_create () {
 
 	manager->closed_session = NULL;
 
+	manager->close_callback = NULL;
+	manager->close_arg = NULL;
+
+	manager->reclaim = queue_create ();
+	manager->reclaim_budget = 0;
+
+	manager->sample_rate = 1;
+	manager->sample_threshold = 0xffffffff;
+	manager->sample_key = 0;
+
+	manager->syn_cache = NULL;
+
+	manager->inside = NULL;
+
+	manager->follow_only = 0;
+	manager->idle_timeout = 0;
+	manager->pipeline = NULL;
+	manager->pipeline_count = 0;
+	manager->top_k = NULL;
+	manager->top_k_count = 0;
+	manager->aggregates = NULL;
+	manager->aggregate_count = 0;
+
+	mem_set_allocator (previous);
 	return manager;
 }
 
@@ -174,11 +410,25 @@ void session_manager_destroy (session_manager_t * manager) {
 		/* Remove entry from hashtable */
 		hashtable_iterator_remove (itr);
 		/* Free memory associated with session */
+		session_manager_notify_close (manager, session);
 		session_manager_free_module_data (manager, session);
 		/* Free session itself */
-		free (session);
+		mem_free (session);
 	}
-        free(itr);
+        mem_free (itr);
+
+	/* Free sessions still waiting to be reclaimed */
+	session_manager_reclaim (manager, -1);
+	queue_destroy (manager->reclaim);
+
+	if (manager->syn_cache != NULL)
+		syn_cache_destroy (manager->syn_cache);
+
+	hashtable_destroy (manager->hashtable);
+	mem_free (manager->modules);
+	mem_free (manager->top_k);
+	mem_free (manager->aggregates);
+	mem_free (manager);
 }
 
 /*
@@ -201,7 +451,7 @@ int session_manager_register_module (session_manager_t * manager, struct session
 	/* If the list is full, make more room */
 	if ((count % SM_MODULE_ARRAY_LENGTH) == 0) {
 		count += SM_MODULE_ARRAY_LENGTH;
-		manager->modules = (struct session_module_t **) realloc (manager->modules, count * sizeof (struct session_module_t *));
+		manager->modules = (struct session_module_t **) mem_realloc (manager->modules, count * sizeof (struct session_module_t *));
 	}
 
 	return manager->module_count - 1;
@@ -213,19 +463,113 @@ int session_manager_register_module (session_manager_t * manager, struct session
  * with the packet.
  */
 tcp_session_t *session_manager_update (session_manager_t * manager, struct libtrace_packet_t * packet) {
+  struct session_packet_t pkt;
+  const struct mem_allocator_t *previous;
+  tcp_session_t *session;
+
+  pkt.packet = packet;
+  pkt.time = tcp_packet_time (packet);
+  pkt.direction = trace_get_direction (packet);
+  pkt.ip = trace_get_ip (packet);
+  pkt.tcp = trace_get_tcp (packet);
+  pkt.payload = 0;
+  if (pkt.ip != NULL && pkt.tcp != NULL)
+    pkt.payload = ntohs (pkt.ip->ip_len) - ((pkt.ip->ip_hl + pkt.tcp->doff) << 2);
+
+  session_manager_classify (manager, &pkt);
+
+  /* New sessions and module data come from the manager's allocator */
+  previous = mem_set_allocator (manager->allocator);
+  session = session_manager_update_packet (manager, &pkt);
+  mem_set_allocator (previous);
+  return session;
+}
+
+/*
+ * The same as session_manager_update(), for packets that are not libtrace
+ * packets, e.g. those read straight from a capture ring. The buffer starts
+ * at the IPv4 header and holds caplen bytes, which must include the whole
+ * TCP header. The time is in nanoseconds and direction is 0 for outbound
+ * and 1 for inbound. The buffer is used in place and must stay valid, and
+ * unchanged, until the call returns.
+ */
+tcp_session_t *session_manager_update_raw (session_manager_t * manager, const uint8_t * l3, size_t caplen, uint64_t ts_ns, int direction) {
+  struct session_packet_t pkt;
+  const struct libtrace_ip *ip = (const struct libtrace_ip *) l3;
+  const struct libtrace_tcp *tcp;
+  size_t headers;
+  const struct mem_allocator_t *previous;
+  tcp_session_t *session;
+
+  pkt.packet = NULL;
+  pkt.time = ts_ns;
+  pkt.direction = direction;
+  pkt.ip = NULL;
+  pkt.tcp = NULL;
+  pkt.payload = 0;
+
+  /* Only the first fragment of an IPv4 TCP packet carries the TCP header */
+  if (caplen >= sizeof (struct libtrace_ip) && ip->ip_v == 4 && ip->ip_hl >= 5) {
+    pkt.ip = ip;
+    headers = ip->ip_hl << 2;
+    if (ip->ip_p == 6 && (ntohs (ip->ip_off) & 0x1fff) == 0 && headers + sizeof (struct libtrace_tcp) <= caplen) {
+      tcp = (const struct libtrace_tcp *) (l3 + headers);
+      headers += tcp->doff << 2;
+      if (tcp->doff >= 5 && headers <= caplen && headers <= ntohs (ip->ip_len)) {
+        pkt.tcp = tcp;
+        pkt.payload = ntohs (ip->ip_len) - headers;
+      }
+    }
+  }
+
+  session_manager_classify (manager, &pkt);
+
+  previous = mem_set_allocator (manager->allocator);
+  session = session_manager_update_packet (manager, &pkt);
+  mem_set_allocator (previous);
+  return session;
+}
+
+/*
+ * Sets the direction of a packet from the inside prefixes, if there are any.
+ */
+void session_manager_classify (session_manager_t * manager, struct session_packet_t *pkt) {
+  int src_inside, dst_inside;
+
+  if (manager->inside == NULL || pkt->ip == NULL)
+    return;
+
+  src_inside = prefix_table_lookup_v4 (manager->inside, pkt->ip->ip_src.s_addr) > 0;
+  dst_inside = prefix_table_lookup_v4 (manager->inside, pkt->ip->ip_dst.s_addr) > 0;
+
+  if (src_inside && !dst_inside)
+    pkt->direction = SM_OUTBOUND;
+  else if (dst_inside && !src_inside)
+    pkt->direction = SM_INBOUND;
+}
+
+/*
+ * Updates the session of a packet whose headers have been found, for
+ * session_manager_update() and session_manager_update_raw().
+ */
+tcp_session_t *session_manager_update_packet (session_manager_t * manager, const struct session_packet_t *pkt) {
 
   int i;
   tcp_session_id_t id;
-  struct libtrace_ip *ip;
-  struct libtrace_tcp *tcp;
-  int direction;
+  const struct libtrace_ip *ip = pkt->ip;
+  const struct libtrace_tcp *tcp = pkt->tcp;
+  int direction = pkt->direction;
+  int payload = pkt->payload;
+  uint32_t mask;
   
   tcp_session_t *session;
   
   /* Check if there are any waiting sessions needing to be freed. The
    * sessions freed here are those in the TIME_WAIT state.
    */
-  uint32_t current_time = (uint32_t) (trace_get_erf_timestamp (packet) >> 32);
+  uint64_t timestamp = pkt->time;
+  uint32_t current_time = (uint32_t) (timestamp / TCP_NSEC_PER_SEC);
+
   if (current_time != manager->last_access) {
     manager->last_access = current_time;
     timer_queue_free (manager, current_time);
@@ -250,15 +594,14 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
     manager->last_clean = current_time;
     session_manager_cleanup (manager);
   }
+
+  /* Free a few of the sessions that have ended */
+  if (manager->reclaim_budget > 0)
+    session_manager_reclaim (manager, manager->reclaim_budget);
   
-  if ((ip = trace_get_ip ((libtrace_packet_t*)packet)) == NULL)
-    return NULL;
-  
-  if ((tcp = trace_get_tcp ((libtrace_packet_t*)packet)) == NULL)
+  if (ip == NULL || tcp == NULL)
     return NULL;
 
-  direction = trace_get_direction (packet);
-
   /* Initialise id. The lowest IP address is used as ip_a, and this
    * ensures that packets in both directions will be matched to the
    * same session.
@@ -275,32 +618,27 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
     id.port_b = htons (tcp->source);
   }
 
+  /* Drop sessions that are not in the sample */
+  if (manager->sample_rate > 1 && tcp_session_id_hash (&id, manager->sample_key) > manager->sample_threshold)
+    return NULL;
+
   /* Find session */
   session = hashtable_retrieve (manager->hashtable, &id);
+
+  if (session == NULL && manager->follow_only)
+    return NULL;
+
+  /* Hold bare SYNs in the SYN cache until they are answered */
+  if (session == NULL && manager->syn_cache != NULL) {
+    if (session_manager_syn_cache_update (manager, &id, tcp, direction, timestamp, &session))
+      return NULL;
+  }
   
   /* What follows is the processing of the TCP session state. */
   if (session == NULL) {
     if (!tcp->rst && !tcp->fin) {      
       /* Allocate a new session */
-      session = malloc (sizeof (tcp_session_t));
-	    
-      /* Give it its id */
-      session->id.ip_a = id.ip_a;
-      session->id.ip_b = id.ip_b;
-      session->id.port_a = id.port_a;
-      session->id.port_b = id.port_b;
-    
-      /* Clear flags */
-      session->waiting = 0;
-    
-      /* Allocate modules' storage */
-      session->data = malloc (manager->module_count * sizeof (void *));
-      for (i = 0; i < manager->module_count; i++) {
-	session->data[i] = manager->modules[i]->create (session);
-      }
-    
-      /* Add the session to the hashtable */
-      hashtable_insert (manager->hashtable, session);
+      session = session_manager_new_session (manager, &id, timestamp);
     
       /* Figure out the state */
       if (tcp->syn && !(tcp->ack)) {
@@ -308,10 +646,10 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
 	if (direction == SM_OUTBOUND) {
 	  /* Outbound, so SYN was sent */
 	  session->state = SYN_SENT;
-	  session->expected_ack = ntohl (tcp->seq) + ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	  session->expected_ack = ntohl (tcp->seq) + payload;
 	} else {
 	  session->state = SYN_RCVD;
-	  session->expected_ack = 0xffffffff;
+	  session->expected_ack = SM_NO_EXPECTED_ACK;
 	}
       }	else if (tcp->syn && tcp->ack) {
 	// probably just missed in the initial syn
@@ -323,7 +661,7 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
 	   * packet.
 	   */
 	  session->state = SYN_RCVD;
-	  session->expected_ack = ntohl (tcp->seq) + ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	  session->expected_ack = ntohl (tcp->seq) + payload;
 	} else {
 	  // can't check the expected_ack, just assume established
 	  session->state = ESTABLISHED;
@@ -353,10 +691,10 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
 	   * it against the incoming ACK
 	   * packet.
 	   */
-	  session->expected_ack = ntohl (tcp->seq) + ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	  session->expected_ack = ntohl (tcp->seq) + payload;
 	}
       } else {
-	if (tcp->ack && ntohl (tcp->ack_seq) >= session->expected_ack) {
+	if (tcp->ack && session_manager_is_acked (session, ntohl (tcp->ack_seq))) {
 	  session->state = ESTABLISHED;
 	}
       }
@@ -366,7 +704,7 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
       if (direction == SM_INBOUND) {
 	if (tcp->syn) {
 	  if (tcp->ack) {
-	    if (ntohl (tcp->ack_seq) >= session->expected_ack) {
+	    if (session_manager_is_acked (session, ntohl (tcp->ack_seq))) {
 	      session->state = ESTABLISHED;
 	    }
 	    /* Else invalid ACK,
@@ -383,7 +721,7 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
     case ESTABLISHED:{
       if (direction == SM_OUTBOUND && tcp->fin) {
 	session->state = FIN_WAIT_1;
-	session->expected_ack = ntohl (tcp->seq) + ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	session->expected_ack = ntohl (tcp->seq) + payload;
       } else if (direction == SM_INBOUND && tcp->fin) {
 	session->state = CLOSE_WAIT;
       }
@@ -391,7 +729,7 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
     }
     case FIN_WAIT_1:{
       if (direction == SM_INBOUND) {
-	if (tcp->ack && ntohl (tcp->ack_seq) >= session->expected_ack) {
+	if (tcp->ack && session_manager_is_acked (session, ntohl (tcp->ack_seq))) {
 	  if (tcp->fin) {
 	    session->state = TIME_WAIT;
 	    session->waiting = 1;
@@ -416,7 +754,7 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
       break;
     }
     case CLOSING:{
-      if (direction == SM_INBOUND && tcp->ack && ntohl (tcp->ack_seq) >= session->expected_ack) {
+      if (direction == SM_INBOUND && tcp->ack && session_manager_is_acked (session, ntohl (tcp->ack_seq))) {
 	session->state = TIME_WAIT;
 	session->waiting = 1;
 	timer_queue_add (manager, session, current_time);
@@ -429,19 +767,19 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
 	 * new one 
 	 */
 	timer_queue_free_early (manager, session);
-	return session_manager_update (manager, packet);
+	return session_manager_update_packet (manager, pkt);
       }
       break;
     }
     case CLOSE_WAIT:{
       if (direction == SM_OUTBOUND && tcp->fin) {
-	session->expected_ack = ntohl (tcp->seq) + ntohs (ip->ip_len) - ((ip->ip_hl + tcp->doff) << 2);
+	session->expected_ack = ntohl (tcp->seq) + payload;
 	session->state = LAST_ACK;
       }
       break;
     }
     case LAST_ACK:{
-      if (direction == SM_INBOUND && tcp->ack && ntohl (tcp->ack_seq) >= session->expected_ack) {
+      if (direction == SM_INBOUND && tcp->ack && session_manager_is_acked (session, ntohl (tcp->ack_seq))) {
 	session->state = CLOSED;
 	manager->closed_session = session;
       }
@@ -462,19 +800,195 @@ tcp_session_t *session_manager_update (session_manager_t * manager, struct libtr
   /* If the session is valid, update the associated modules */
   if (session != NULL) {
     session->last_access = current_time & 0xff;
-    for (i = 0; i < manager->module_count; i++) {
-      manager->modules[i]->update (session->data[i], packet);
+    session->end_time = timestamp;
+
+    /* Only call the modules that still want this kind of packet */
+    mask = (payload > 0) ? session->want_data : session->want_acks;
+    if (manager->pipeline != NULL && manager->pipeline_count == manager->module_count) {
+      int wants[SM_MASK_MODULES];
+      int count = (manager->module_count < SM_MASK_MODULES) ? manager->module_count : SM_MASK_MODULES;
+
+      manager->pipeline (session->data, pkt, mask, wants);
+      for (i = 0; i < count; i++) {
+        if (mask & (1u << i))
+          session_manager_set_wants (session, i, wants[i]);
+      }
+    } else {
+      for (i = 0; i < manager->module_count; i++) {
+        if (i >= SM_MASK_MODULES) {
+          manager->modules[i]->update (session->data[i], pkt);
+          continue;
+        }
+        if (!(mask & (1u << i)))
+          continue;
+        session_manager_set_wants (session, i, manager->modules[i]->update (session->data[i], pkt));
+      }
     }
+
+    for (i = 0; i < manager->top_k_count; i++)
+      top_k_update_session (manager->top_k[i], session);
+    for (i = 0; i < manager->aggregate_count; i++)
+      aggregate_update_session (manager->aggregates[i], session, timestamp, mask);
   }
   
   return session;
 }
 
+/*
+ * Allocates a session with fresh module data and adds it to the hashtable.
+ * The caller sets the state.
+ */
+tcp_session_t *session_manager_new_session (session_manager_t * manager, tcp_session_id_t * id, uint64_t timestamp) {
+	int i;
+	tcp_session_t *session = mem_alloc (sizeof (tcp_session_t));
+
+	/* Give it its id */
+	session->id.ip_a = id->ip_a;
+	session->id.ip_b = id->ip_b;
+	session->id.port_a = id->port_a;
+	session->id.port_b = id->port_b;
+
+	/* Clear flags */
+	session->waiting = 0;
+	session->start_time = timestamp;
+	session->want_data = 0xffffffff;
+	session->want_acks = 0xffffffff;
+
+	/* Allocate modules' storage */
+	session->data = mem_alloc (manager->module_count * sizeof (void *));
+	for (i = 0; i < manager->module_count; i++) {
+		session->data[i] = manager->modules[i]->create (manager->modules[i]->config);
+	}
+
+	/* Add the session to the hashtable */
+	hashtable_insert (manager->hashtable, session);
+
+	return session;
+}
+
+/*
+ * Passes a packet that has no session to the SYN cache. Bare SYNs are
+ * cached, and a SYN/ACK that answers a cached SYN creates the session,
+ * which is returned in *session. Returns 1 if the packet was cached and
+ * needs no further processing, otherwise 0.
+ */
+int session_manager_syn_cache_update (session_manager_t * manager, tcp_session_id_t * id, const struct libtrace_tcp *tcp, int direction, uint64_t timestamp, tcp_session_t ** session) {
+	struct tcp_syn_t syn;
+	struct tcp_syn_t *cached;
+	int i;
+
+	if (tcp->rst) {
+		/* The SYN was refused */
+		syn_cache_remove (manager->syn_cache, id);
+		return 0;
+	}
+
+	if (!tcp->syn)
+		return 0;
+
+	if (!tcp->ack) {
+		session_manager_parse_syn (tcp, direction, timestamp, &syn);
+		syn_cache_insert (manager->syn_cache, id, &syn);
+		return 1;
+	}
+
+	/* A SYN/ACK must come from the other side and acknowledge the SYN */
+	cached = syn_cache_lookup (manager->syn_cache, id, timestamp);
+	if (cached == NULL || cached->direction == direction || ntohl (tcp->ack_seq) != cached->seq + 1)
+		return 0;
+
+	/* Create the session as the SYN would have done */
+	*session = session_manager_new_session (manager, id, cached->time);
+	if (cached->direction == SM_OUTBOUND) {
+		(*session)->state = SYN_SENT;
+		(*session)->expected_ack = cached->seq;
+	} else {
+		(*session)->state = SYN_RCVD;
+		(*session)->expected_ack = SM_NO_EXPECTED_ACK;
+	}
+	(*session)->last_access = (uint8_t) ((cached->time / TCP_NSEC_PER_SEC) & 0xff);
+
+	/* Let the modules catch up on the SYN they missed */
+	for (i = 0; i < manager->module_count; i++) {
+		if (manager->modules[i]->syn != NULL)
+			manager->modules[i]->syn ((*session)->data[i], cached);
+	}
+
+	syn_cache_remove (manager->syn_cache, id);
+	return 0;
+}
+
+/*
+ * Reads the details of a SYN, including its options, into syn.
+ */
+void session_manager_parse_syn (const struct libtrace_tcp *tcp, int direction, uint64_t timestamp, struct tcp_syn_t *syn) {
+	unsigned char *pkt = (unsigned char *) tcp + sizeof (*tcp);
+	int plen = tcp->doff * 4 - sizeof (*tcp);
+	unsigned char type = 0, optlen = 0, *optdata = NULL;
+
+	syn->time = timestamp;
+	syn->seq = ntohl (tcp->seq);
+	syn->tsval = 0;
+	syn->mss = 0;
+	syn->wscale = 0xff;
+	syn->direction = direction;
+	syn->sack_permitted = 0;
+	syn->has_ts = 0;
+
+	while (trace_get_next_option (&pkt, &plen, &type, &optlen, &optdata)) {
+		switch (type) {
+		case 2:
+			if (optlen == 4)
+				syn->mss = ntohs (*(uint16_t *) optdata);
+			break;
+		case 3:
+			if (optlen == 3)
+				syn->wscale = optdata[0];
+			break;
+		case 4:
+			syn->sack_permitted = 1;
+			break;
+		case 8:
+			if (optlen == 10) {
+				syn->tsval = ntohl (*(uint32_t *) optdata);
+				syn->has_ts = 1;
+			}
+			break;
+		}
+	}
+}
+
 /*
  * Frees a session, removing it from the hashtable and freeing its module data.
  */
 void session_manager_free_session (session_manager_t * manager, tcp_session_t * session) {
 
+	session_manager_notify_close (manager, session);
+
+	/* Remove from hashtable straight away, so that a new session with
+	 * the same id can be created even if this one is freed later.
+	 */
+	hashtable_remove (manager->hashtable, &(session->id));
+
+	session_manager_dispose (manager, session);
+}
+
+/*
+ * Frees a session that has already been removed from the hashtable, either
+ * now or later from the reclaim list.
+ */
+void session_manager_dispose (session_manager_t * manager, tcp_session_t * session) {
+	if (manager->reclaim_budget > 0)
+		queue_add (manager->reclaim, &session_manager_reclaim_vars, &session);
+	else
+		session_manager_release (manager, session);
+}
+
+/*
+ * Frees the module data of a session and the session itself.
+ */
+void session_manager_release (session_manager_t * manager, tcp_session_t * session) {
+
 	/* Free modules' data */
 	int i;
 	for (i = 0; i < manager->module_count; i++) {
@@ -482,15 +996,230 @@ void session_manager_free_session (session_manager_t * manager, tcp_session_t *
 		session->data[i] = NULL;
 	}
 
-	free (session->data);
+	mem_free (session->data);
 	session->data = NULL;
 
-	/* Remove from hashtable */
+	/* Free session itself */
+	mem_free (session);
+}
+
+/*
+ * Sets the direction of every packet from a table of inside prefixes, for
+ * traces such as plain pcap files that carry no direction. A prefix with a
+ * value greater than 0 is inside, and one with the value 0 is outside,
+ * which allows holes to be cut in larger inside prefixes. A packet from an
+ * inside address to an outside one is outbound, and the reverse is
+ * inbound. Other packets keep the direction given with the packet. The
+ * table is not copied or freed by the manager. Passing NULL turns this off.
+ */
+void session_manager_set_inside_prefixes (session_manager_t * manager, prefix_table_t * table) {
+	manager->inside = table;
+}
+
+/*
+ * With follow_only set, the manager only updates the sessions it already
+ * tracks, e.g. those restored from a snapshot, and ignores packets of any
+ * other session.
+ */
+void session_manager_set_follow_only (session_manager_t * manager, int follow_only) {
+	manager->follow_only = follow_only;
+}
+
+/*
+ * Expires sessions that have seen no packet for timeout seconds, whatever
+ * their state, as if they had closed. Sessions are checked at each cleanup,
+ * so one may stay up to SM_TCP_SYN_TIMEOUT longer. A timeout of 0, the
+ * default, keeps sessions until they close.
+ */
+void session_manager_set_idle_timeout (session_manager_t * manager, uint32_t timeout) {
+	manager->idle_timeout = timeout;
+}
+
+/*
+ * Updates the modules with the given pipeline, which was built for count
+ * modules. It is only used while exactly that many modules are registered,
+ * so registering another module falls back to the registered update
+ * functions. Passing NULL turns it off.
+ */
+void session_manager_set_pipeline (session_manager_t * manager, session_pipeline_t pipeline, int count) {
+	manager->pipeline = pipeline;
+	manager->pipeline_count = count;
+}
+
+/*
+ * Returns the number of sessions being tracked.
+ */
+unsigned int session_manager_session_count (session_manager_t * manager) {
+	return hashtable_count (manager->hashtable);
+}
+
+/*
+ * Keeps a top-K tracker (see topk.h) up to date with the sessions of this
+ * manager: it is offered each session after the modules are updated, and
+ * sessions are removed from it when they end. A tracker should only be
+ * given to one manager.
+ */
+void session_manager_add_top_k (session_manager_t * manager, struct top_k_t *top_k) {
+	const struct mem_allocator_t *previous = mem_set_allocator (manager->allocator);
+
+	manager->top_k = mem_realloc (manager->top_k, (manager->top_k_count + 1) * sizeof (struct top_k_t *));
+	manager->top_k[manager->top_k_count++] = top_k;
+	mem_set_allocator (previous);
+}
+
+/*
+ * Feeds an aggregate table (see aggregate.h) from the sessions of this
+ * manager: it is given each session after the modules are updated, for
+ * RTT samples, and each session as it ends. A table should only be given
+ * to one manager.
+ */
+void session_manager_add_aggregate (session_manager_t * manager, struct aggregate_t *aggregate) {
+	const struct mem_allocator_t *previous = mem_set_allocator (manager->allocator);
+
+	manager->aggregates = mem_realloc (manager->aggregates, (manager->aggregate_count + 1) * sizeof (struct aggregate_t *));
+	manager->aggregates[manager->aggregate_count++] = aggregate;
+	mem_set_allocator (previous);
+}
+
+/*
+ * Calls the visit function with every tracked session, e.g. for a periodic
+ * export. This costs time in the number of tracked sessions. The visit
+ * function must not add or remove sessions.
+ */
+void session_manager_foreach (session_manager_t * manager, session_visit_t visit, void *arg) {
+	hashtable_iterator_t *itr = hashtable_iterator_create (manager->hashtable);
+	tcp_session_t *session;
+
+	while ((session = hashtable_iterator_next (manager->hashtable, itr)) != NULL)
+		visit (session, arg);
+	mem_free (itr);
+}
+
+/*
+ * Returns the tracked session with the given ID, or NULL.
+ */
+tcp_session_t *session_manager_find (session_manager_t * manager, tcp_session_id_t * id) {
+	return hashtable_retrieve (manager->hashtable, id);
+}
+
+/*
+ * Stops tracking a session and frees it without passing it to the close
+ * callback, e.g. a session restored from a snapshot that turns out to be a
+ * copy of another.
+ */
+void session_manager_drop_session (session_manager_t * manager, tcp_session_t * session) {
+	struct timer_queue_t *queue = &(manager->waiting_sessions);
+	unsigned int i, pos;
+
+	/* Make sure neither the timer queue nor the next update frees it */
+	if (session->waiting) {
+		for (i = 0; i < queue->length; i++) {
+			pos = (queue->lower_idx + i) % SM_TIMER_QUEUE_LENGTH;
+			if (queue->sessions[pos] == session)
+				queue->sessions[pos] = NULL;
+		}
+		session->waiting = 0;
+	}
+	if (manager->closed_session == session)
+		manager->closed_session = NULL;
+
+	for (i = 0; i < (unsigned int) manager->top_k_count; i++)
+		top_k_remove (manager->top_k[i], session);
+
 	hashtable_remove (manager->hashtable, &(session->id));
+	session_manager_release (manager, session);
+}
 
-	/* Free session itself */
-	free (session);
-	session = NULL;
+/*
+ * Turns on flow sampling, so that only about 1 in rate sessions are
+ * tracked. A session is chosen by a keyed hash of its ID, so both
+ * directions and every packet of a chosen session are seen, and the same
+ * key always chooses the same sessions. Packets of other sessions are
+ * dropped before the session lookup. A rate of 1 tracks every session.
+ * This should be set before the first packet, as sessions that are
+ * already tracked stop being updated if they fall out of a new sample.
+ */
+void session_manager_set_sampling (session_manager_t * manager, uint32_t rate, uint64_t key) {
+	if (rate == 0) {
+		fprintf (stderr, "Sampling rate out of range\n");
+		rate = 1;
+	}
+	manager->sample_rate = rate;
+	manager->sample_threshold = (uint32_t) (0x100000000ULL / rate - 1);
+	manager->sample_key = key;
+}
+
+/*
+ * Returns the sampling rate, i.e. the N in 1 in N sessions, to scale
+ * results by. This is 1 when sampling is off.
+ */
+uint32_t session_manager_get_sampling_rate (session_manager_t * manager) {
+	return manager->sample_rate;
+}
+
+/*
+ * Turns on the SYN cache, which holds up to size bare SYNs in a small
+ * fixed-size table instead of creating a full session for each. A session
+ * is only created when the matching SYN/ACK is seen, and the modules are
+ * then given the cached SYN. This keeps scans and SYN floods from creating
+ * many sessions that never complete. A size of 0 turns the cache off,
+ * which is the default.
+ */
+void session_manager_set_syn_cache (session_manager_t * manager, unsigned int size) {
+	const struct mem_allocator_t *previous;
+
+	if (manager->syn_cache != NULL)
+		syn_cache_destroy (manager->syn_cache);
+	manager->syn_cache = NULL;
+
+	if (size > 0) {
+		previous = mem_set_allocator (manager->allocator);
+		manager->syn_cache = syn_cache_create (size, TCP_SEC_TO_NSEC (SM_TCP_SYN_TIMEOUT));
+		mem_set_allocator (previous);
+	}
+}
+
+/*
+ * By default a session's module data is freed as soon as the session ends,
+ * inside session_manager_update(). With a reclaim budget greater than 0,
+ * ended sessions are instead put on a reclaim list and at most budget of
+ * them are freed on each call to session_manager_update(), which spreads
+ * out the cost of a wave of closing sessions. Setting the budget back to 0
+ * frees any pending sessions straight away.
+ */
+void session_manager_set_reclaim_budget (session_manager_t * manager, int budget) {
+	if (budget < 0) {
+		fprintf (stderr, "Reclaim budget out of range\n");
+		budget = 0;
+	}
+	manager->reclaim_budget = budget;
+	if (budget == 0)
+		session_manager_reclaim (manager, -1);
+}
+
+/*
+ * Frees up to max sessions from the reclaim list, or all of them if max is
+ * negative, e.g. when the capture is idle. Returns the number freed.
+ */
+int session_manager_reclaim (session_manager_t * manager, int max) {
+	tcp_session_t **item;
+	int count = 0;
+
+	while (max < 0 || count < max) {
+		item = queue_remove (manager->reclaim, &session_manager_reclaim_vars);
+		if (item == NULL)
+			break;
+		session_manager_release (manager, *item);
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Returns the number of ended sessions waiting on the reclaim list.
+ */
+unsigned int session_manager_reclaim_pending (session_manager_t * manager) {
+	return queue_length (manager->reclaim);
 }
 
 /*
@@ -506,13 +1235,54 @@ void session_manager_free_module_data (session_manager_t * manager, tcp_session_
 	for (i = 0; i < manager->module_count; i++) {
 		manager->modules[i]->destroy (session->data[i]);
 	}
-	free (session->data);
+	mem_free (session->data);
 	session->data = NULL;
 }
 
+/*
+ * Records which packets a module wants from a session.
+ */
+void session_manager_set_wants (tcp_session_t * session, int module, int wants) {
+	uint32_t bit = 1u << module;
+
+	if (wants & SM_WANT_DATA)
+		session->want_data |= bit;
+	else
+		session->want_data &= ~bit;
+
+	if (wants & SM_WANT_ACKS)
+		session->want_acks |= bit;
+	else
+		session->want_acks &= ~bit;
+}
+
+/*
+ * Passes a session that is about to be freed to the close callback.
+ */
+void session_manager_notify_close (session_manager_t * manager, tcp_session_t * session) {
+	int i;
+
+	if (manager->close_callback != NULL)
+		manager->close_callback (session, manager->close_arg);
+
+	for (i = 0; i < manager->top_k_count; i++)
+		top_k_remove (manager->top_k[i], session);
+	for (i = 0; i < manager->aggregate_count; i++)
+		aggregate_end_session (manager->aggregates[i], session);
+}
+
+/*
+ * Sets a function to be called with each session just before it is freed.
+ * Only one callback can be set; passing NULL removes it.
+ */
+void session_manager_set_close_callback (session_manager_t * manager, session_close_callback_t callback, void *arg) {
+	manager->close_callback = callback;
+	manager->close_arg = arg;
+}
+
 /*
  * The cleanup routine to remove sessions in the SYN_RCVD or SYN_SENT state
- * due to unsolicited traffic.
+ * due to unsolicited traffic, and idle sessions if there is an idle timeout.
  */
 void session_manager_cleanup (session_manager_t * manager) {
 
@@ -523,21 +1293,34 @@ void session_manager_cleanup (session_manager_t * manager) {
 	tcp_session_t *session;
 	uint8_t last_access = (manager->last_access & 0xff);
 	uint8_t difference;
+	uint64_t idle_before = 0;
+	int expire;
+
+	if (manager->idle_timeout > 0 && manager->last_access > manager->idle_timeout)
+		idle_before = TCP_SEC_TO_NSEC (manager->last_access - manager->idle_timeout);
 
 	while ((session = hashtable_iterator_next (manager->hashtable, itr)) != NULL) {
 
+		expire = 0;
 		if (session->state == SYN_RCVD || session->state == SYN_SENT) {
 			difference = last_access - session->last_access;
-			if (difference > SM_TCP_SYN_TIMEOUT) {
-				/* Free session and entry in hash table */
-				hashtable_iterator_remove (itr);
-				session_manager_free_module_data (manager, session);
-				free (session);
-				session = NULL;
-			}
+			if (difference > SM_TCP_SYN_TIMEOUT)
+				expire = 1;
+		}
+
+		/* Sessions in TIME_WAIT or just closed are freed elsewhere */
+		if (session->end_time < idle_before && !session->waiting && session != manager->closed_session)
+			expire = 1;
+
+		if (expire) {
+			/* Free session and entry in hash table */
+			hashtable_iterator_remove (itr);
+			session_manager_notify_close (manager, session);
+			session_manager_dispose (manager, session);
+			session = NULL;
 		}
 	}
-        free(itr);
+        mem_free (itr);
         
 }
 
@@ -619,3 +1402,369 @@ void timer_queue_free_early (session_manager_t * manager, tcp_session_t * sessio
 	}
 
 }
+
+/*
+ * Checks whether an acknowledgement number covers the expected_ack of a
+ * session, allowing for sequence number wraparound.
+ */
+int session_manager_is_acked (tcp_session_t * session, uint32_t ack) {
+	if (session->expected_ack == SM_NO_EXPECTED_ACK)
+		return 0;
+	return SEQ_GEQ (ack, session->expected_ack);
+}
+
+/*
+ * Writes one session to a snapshot file, using buf as scratch space for
+ * the module data. Returns 0 on success or -1 on a write error.
+ */
+int session_manager_write_session (session_manager_t * manager, tcp_session_t * session, FILE * file, char **buf, size_t * buf_len) {
+	struct snapshot_session_t record;
+	char *grown;
+	uint32_t len;
+	int i;
+
+	memset (&record, 0, sizeof (record));
+	record.id = session->id;
+	record.state = session->state;
+	record.expected_ack = session->expected_ack;
+	record.waiting = session->waiting;
+	record.last_access = session->last_access;
+	record.start_time = session->start_time;
+	record.end_time = session->end_time;
+
+	if (fwrite (&record, sizeof (record), 1, file) != 1)
+		return -1;
+
+	for (i = 0; i < manager->module_count; i++) {
+		if (manager->modules[i]->serialize == NULL) {
+			len = SM_SNAPSHOT_NO_DATA;
+			if (fwrite (&len, sizeof (len), 1, file) != 1)
+				return -1;
+			continue;
+		}
+
+		/* Find the size first, growing the scratch buffer if needed */
+		len = manager->modules[i]->serialize (session->data[i], *buf, *buf_len);
+		if (len > *buf_len) {
+			if ((grown = realloc (*buf, len)) == NULL)
+				return -1;
+			*buf = grown;
+			*buf_len = len;
+			manager->modules[i]->serialize (session->data[i], *buf, *buf_len);
+		}
+
+		if (fwrite (&len, sizeof (len), 1, file) != 1)
+			return -1;
+		if (len > 0 && fwrite (*buf, len, 1, file) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Writes all live sessions, including the data of modules that support
+ * serialization, to a snapshot file. Returns the number of sessions written
+ * or -1 on error.
+ */
+int session_manager_checkpoint (session_manager_t * manager, const char *path) {
+	char *tmp_path;
+	FILE *file;
+	int count;
+	int error = 0;
+
+	/* Write to a temporary file first so that an old snapshot is only
+	 * replaced by a complete one.
+	 */
+	tmp_path = malloc (strlen (path) + 5);
+	sprintf (tmp_path, "%s.tmp", path);
+
+	if ((file = fopen (tmp_path, "wb")) == NULL) {
+		fprintf (stderr, "Cannot open snapshot file %s\n", tmp_path);
+		free (tmp_path);
+		return -1;
+	}
+
+	count = session_manager_checkpoint_file (manager, file);
+	if (count < 0)
+		error = 1;
+
+	if (fclose (file) != 0)
+		error = 1;
+
+	if (!error && rename (tmp_path, path) != 0)
+		error = 1;
+
+	if (error) {
+		fprintf (stderr, "Error writing snapshot file %s\n", path);
+		remove (tmp_path);
+		free (tmp_path);
+		return -1;
+	}
+
+	free (tmp_path);
+	return count;
+}
+
+/*
+ * The same as session_manager_checkpoint(), writing the snapshot to an open
+ * file from its current position. The file must be seekable.
+ */
+int session_manager_checkpoint_file (session_manager_t * manager, FILE * file) {
+	struct snapshot_header_t header;
+	hashtable_iterator_t *itr;
+	tcp_session_t *session;
+	char *buf = NULL;
+	size_t buf_len = 0;
+	long start;
+	int count = 0;
+	int error = 0;
+
+	if ((start = ftell (file)) < 0)
+		return -1;
+
+	/* The session count is filled in once it is known */
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, SM_SNAPSHOT_MAGIC, sizeof (header.magic));
+	header.version = SM_SNAPSHOT_VERSION;
+	header.byte_order = SM_SNAPSHOT_BYTE_ORDER;
+	header.module_count = manager->module_count;
+	header.last_access = manager->last_access;
+	header.last_clean = manager->last_clean;
+	if (fwrite (&header, sizeof (header), 1, file) != 1)
+		error = 1;
+
+	itr = hashtable_iterator_create (manager->hashtable);
+	while (!error && (session = hashtable_iterator_next (manager->hashtable, itr)) != NULL) {
+		/* Closed sessions are about to be freed anyway */
+		if (session->state == CLOSED || session->state == RESET)
+			continue;
+		if (session_manager_write_session (manager, session, file, &buf, &buf_len) != 0)
+			error = 1;
+		else
+			count++;
+	}
+	mem_free (itr);
+	free (buf);
+
+	header.session_count = count;
+	if (!error && (fseek (file, start, SEEK_SET) != 0 || fwrite (&header, sizeof (header), 1, file) != 1))
+		error = 1;
+	if (!error && fseek (file, 0, SEEK_END) != 0)
+		error = 1;
+
+	if (error)
+		return -1;
+	return count;
+}
+
+/*
+ * Reads one session from a snapshot file. Returns NULL on error.
+ */
+tcp_session_t *session_manager_read_session (session_manager_t * manager, FILE * file, char **buf, size_t * buf_len) {
+	struct snapshot_session_t record;
+	tcp_session_t *session;
+	const struct mem_allocator_t *previous;
+	char *grown;
+	uint32_t len;
+	int i, error = 0;
+
+	if (fread (&record, sizeof (record), 1, file) != 1)
+		return NULL;
+
+	previous = mem_set_allocator (manager->allocator);
+
+	session = mem_alloc (sizeof (tcp_session_t));
+	session->id = record.id;
+	session->state = (tcp_conn_state_t) record.state;
+	session->expected_ack = record.expected_ack;
+	session->waiting = record.waiting;
+	session->last_access = record.last_access;
+	session->start_time = record.start_time;
+	session->end_time = record.end_time;
+	session->want_data = 0xffffffff;
+	session->want_acks = 0xffffffff;
+	session->data = mem_alloc (manager->module_count * sizeof (void *));
+
+	for (i = 0; i < manager->module_count; i++) {
+		session->data[i] = NULL;
+		if (error || fread (&len, sizeof (len), 1, file) != 1) {
+			error = 1;
+			continue;
+		}
+
+		if (len != SM_SNAPSHOT_NO_DATA) {
+			if (len > *buf_len) {
+				/* Keep the old buffer on failure, the caller frees it */
+				if ((grown = realloc (*buf, len)) == NULL) {
+					error = 1;
+					continue;
+				}
+				*buf = grown;
+				*buf_len = len;
+			}
+			if (len > 0 && fread (*buf, len, 1, file) != 1) {
+				error = 1;
+				continue;
+			}
+			if (manager->modules[i]->deserialize != NULL) {
+				session->data[i] = manager->modules[i]->deserialize (manager->modules[i]->config, *buf, len);
+				if (session->data[i] == NULL)
+					error = 1;
+				continue;
+			}
+		}
+
+		/* No saved data for this module, so start it afresh */
+		session->data[i] = manager->modules[i]->create (manager->modules[i]->config);
+	}
+
+	if (error) {
+		for (i = 0; i < manager->module_count; i++) {
+			if (session->data[i] != NULL)
+				manager->modules[i]->destroy (session->data[i]);
+		}
+		mem_free (session->data);
+		mem_free (session);
+		session = NULL;
+	}
+
+	mem_set_allocator (previous);
+	return session;
+}
+
+/*
+ * Reads the sessions from a snapshot file written by
+ * session_manager_checkpoint() into the manager. The same modules must be
+ * registered, in the same order, as when the snapshot was written. Module
+ * data that was not serialized is created afresh. Returns the number of
+ * sessions restored or -1 on error.
+ */
+int session_manager_restore (session_manager_t * manager, const char *path) {
+	FILE *file;
+	int count;
+
+	if ((file = fopen (path, "rb")) == NULL) {
+		fprintf (stderr, "Cannot open snapshot file %s\n", path);
+		return -1;
+	}
+
+	count = session_manager_restore_file (manager, file);
+	if (count < 0)
+		fprintf (stderr, "Cannot restore from snapshot file %s\n", path);
+
+	fclose (file);
+	return count;
+}
+
+/*
+ * The same as session_manager_restore(), reading the snapshot from an open
+ * file at its current position.
+ */
+int session_manager_restore_file (session_manager_t * manager, FILE * file) {
+	struct snapshot_header_t header;
+	tcp_session_t *session, **sessions;
+	char *buf = NULL;
+	size_t buf_len = 0;
+	uint32_t i, read;
+	int count = 0;
+
+	if (fread (&header, sizeof (header), 1, file) != 1
+	    || memcmp (header.magic, SM_SNAPSHOT_MAGIC, sizeof (header.magic)) != 0) {
+		fprintf (stderr, "Not a snapshot file\n");
+		return -1;
+	}
+
+	if (header.version != SM_SNAPSHOT_VERSION || header.byte_order != SM_SNAPSHOT_BYTE_ORDER) {
+		fprintf (stderr, "Snapshot was written by a different version or machine\n");
+		return -1;
+	}
+
+	if (header.module_count != manager->module_count) {
+		fprintf (stderr, "Snapshot has %u modules but %u are registered\n", header.module_count, manager->module_count);
+		return -1;
+	}
+
+	/* All the sessions are read before any is tracked, so that a damaged
+	 * snapshot leaves the manager as it was.
+	 */
+	sessions = malloc ((header.session_count > 0 ? header.session_count : 1) * sizeof (tcp_session_t *));
+	if (sessions == NULL) {
+		fprintf (stderr, "Cannot allocate memory for %u sessions\n", header.session_count);
+		return -1;
+	}
+	for (read = 0; read < header.session_count; read++) {
+		if ((sessions[read] = session_manager_read_session (manager, file, &buf, &buf_len)) == NULL)
+			break;
+	}
+	free (buf);
+
+	if (read < header.session_count) {
+		fprintf (stderr, "Snapshot is truncated or corrupt\n");
+		for (i = 0; i < read; i++)
+			session_manager_discard_session (manager, sessions[i]);
+		free (sessions);
+		return -1;
+	}
+
+	if (header.last_access > manager->last_access)
+		manager->last_access = header.last_access;
+	if (header.last_clean > manager->last_clean)
+		manager->last_clean = header.last_clean;
+
+	for (i = 0; i < read; i++) {
+		session = sessions[i];
+
+		/* A session that is already being tracked takes precedence */
+		if (hashtable_retrieve (manager->hashtable, &(session->id)) != NULL) {
+			session->waiting = 0;
+			session_manager_free_module_data (manager, session);
+			mem_free (session);
+			continue;
+		}
+
+		hashtable_insert (manager->hashtable, session);
+
+		/* TIME_WAIT sessions start their timeout again */
+		if (session->waiting)
+			timer_queue_add (manager, session, manager->last_access);
+		count++;
+	}
+
+	free (sessions);
+	return count;
+}
+
+/*
+ * Writes one session, and the data of its modules, to a file in the same
+ * form as a session in a snapshot. This can be called from a close callback
+ * to keep the results of finished sessions. Returns 0 on success or -1 on
+ * a write error.
+ */
+int session_manager_save_session (session_manager_t * manager, tcp_session_t * session, FILE * file) {
+	char *buf = NULL;
+	size_t buf_len = 0;
+	int ret = session_manager_write_session (manager, session, file, &buf, &buf_len);
+	free (buf);
+	return ret;
+}
+
+/*
+ * Reads a session written by session_manager_save_session(). The session
+ * is not tracked by the manager and must be freed with
+ * session_manager_discard_session(). Returns NULL at the end of the file or
+ * on error.
+ */
+tcp_session_t *session_manager_load_session (session_manager_t * manager, FILE * file) {
+	char *buf = NULL;
+	size_t buf_len = 0;
+	tcp_session_t *session = session_manager_read_session (manager, file, &buf, &buf_len);
+	free (buf);
+	return session;
+}
+
+/*
+ * Frees a session returned by session_manager_load_session().
+ */
+void session_manager_discard_session (session_manager_t * manager, tcp_session_t * session) {
+	session_manager_release (manager, session);
+}
@@ -32,8 +32,10 @@
 #ifndef SESSIONMANAGER_H_
 #define SESSIONMANAGER_H_
 
+#include <stdio.h>
 #include <inttypes.h>
 #include <libtrace.h>
+#include "prefixtable.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -72,20 +74,93 @@ struct tcp_session_t {
         uint8_t waiting;
         uint8_t last_access;
         void **data;
+
+        /* The times of the first and latest packets, in nanoseconds */
+        uint64_t start_time;
+        uint64_t end_time;
+
+        /* One bit per module (for the first SM_MASK_MODULES modules) that
+         * is set if the module still wants packets with data, and packets
+         * without data, of this session.
+         */
+        uint32_t want_data;
+        uint32_t want_acks;
+};
+
+/*
+ * The number of modules that can be switched off per session. Modules
+ * registered after these always receive every packet.
+ */
+#define SM_MASK_MODULES 32
+
+/*
+ * The values returned by a module's update function to say which packets
+ * of the session it still needs. Packets without data include pure ACKs
+ * and SYN, FIN and RST packets.
+ */
+#define SM_WANT_NONE 0
+#define SM_WANT_DATA 1
+#define SM_WANT_ACKS 2
+#define SM_WANT_ALL (SM_WANT_DATA | SM_WANT_ACKS)
+
+/*
+ * A packet as it is passed to the modules, with the headers already found
+ * so that each module does not have to parse the packet again. The ip and
+ * tcp headers point into the captured packet, in network byte order, and
+ * the TCP options can be read up to tcp->doff words. The time is in
+ * nanoseconds, direction 0 is outbound and 1 is inbound, and payload is
+ * the number of bytes of TCP data. The libtrace packet is NULL for
+ * packets given to session_manager_update_raw().
+ */
+struct session_packet_t {
+        const struct libtrace_ip *ip;
+        const struct libtrace_tcp *tcp;
+        uint64_t time;
+        int direction;
+        int payload;
+        struct libtrace_packet_t *packet;
+};
+
+/*
+ * What is known about the SYN of a session that was held in the SYN cache
+ * before the session was created. The time is in nanoseconds and wscale is
+ * 0xff if the option was not present.
+ */
+struct tcp_syn_t {
+        uint64_t time;
+        uint32_t seq;
+        uint32_t tsval;
+        uint16_t mss;
+        uint8_t wscale;
+        uint8_t direction;
+        uint8_t sack_permitted;
+        uint8_t has_ts;
 };
 
 
 /*
  * The session module struct is the core component that allows users
- * to specify their own analysis on flows.
+ * to specify their own analysis on flows. Members may be added in later
+ * versions, and the optional ones are called when they are not NULL, so
+ * a module struct must be zeroed before it is filled in, e.g. with
+ * calloc() or session_module_init().
  */
 struct session_module_t {
 
         /*
-         * The create function is called when a new TCP session is initiated.
-         * It should return a pointer to the data structure that the module needs.
+         * The settings of this instance of the module, which are shared by
+         * all of its sessions and given to create and deserialize. Keeping
+         * them here rather than in globals lets several managers, each with
+         * its own modules, run at once in different threads.
+         */
+        void *config;
+
+        /*
+         * The create function is called when a new TCP session is initiated
+         * and is given the module's config. It should return a pointer to
+         * the data structure that the module needs.
          */
-        void *(*create) ();
+        void *(*create) (void *config);
 
         /*
          * The destroy function is called on a closed, reset or discarded flow.
@@ -99,20 +174,77 @@ struct session_module_t {
          * to the flow is found. The behaviour of this function will vary from
          * module to module, but it is expected that it will need to use the
          * memory allocated from the create function.
+         *
+         * It returns the packets of the session that the module still needs,
+         * as SM_WANT_ALL, SM_WANT_DATA, SM_WANT_ACKS or SM_WANT_NONE. Once a
+         * kind of packet is no longer wanted, the module is not called for
+         * it again in this session.
+         */
+        int (*update) (void *, const struct session_packet_t *);
+
+        /*
+         * The serialize function is optional and may be NULL. It should write
+         * the module data into the buffer, which is len bytes long, and
+         * return the number of bytes needed. If the buffer is NULL or too
+         * small, the required size is still returned so that the function
+         * can be called first to find the size. It is used to checkpoint
+         * live sessions.
          */
-        void (*update) (void *, struct libtrace_packet_t *);
+        size_t (*serialize) (void *, char *buf, size_t len);
+
+        /*
+         * The deserialize function is optional and may be NULL. It should
+         * rebuild the module data from a buffer written by serialize, or
+         * return NULL if the buffer is not valid. It is given the module's
+         * config, as for create.
+         */
+        void *(*deserialize) (void *config, const char *buf, size_t len);
+
+        /*
+         * The syn function is optional and may be NULL. When the SYN cache
+         * is on, a session is only created once the SYN/ACK is seen, so the
+         * modules never see the SYN itself. Instead, this function is
+         * called with the cached SYN just after create.
+         */
+        void (*syn) (void *, const struct tcp_syn_t *);
 
 };
 
 
 
+/*
+ * Zeroes a session module struct, leaving every optional member NULL, for
+ * modules that are not allocated with calloc().
+ */
+void session_module_init (struct session_module_t *module);
+
 typedef struct session_manager_t session_manager_t;
 
+/*
+ * A close callback is given each session just before the session and its
+ * module data are freed, whether it was closed, reset, timed out or still
+ * live when the manager was destroyed.
+ */
+typedef void (*session_close_callback_t) (tcp_session_t * session, void *arg);
+
 /*
  * Creates and initialises a session manager.
  */
 session_manager_t *session_manager_create ();
 
+/*
+ * Creates a session manager whose memory, including that of its sessions,
+ * the hashtable, the queues and the data of its modules, comes from the
+ * given allocator (see mempool.h). The allocator is the calling thread's
+ * allocator while the manager is updated, and the thread's own allocator is
+ * put back before the call returns. A manager with an allocator that is
+ * not thread safe, such as a pool, should only be used by one thread. A
+ * NULL allocator, as with session_manager_create(), means malloc(), not
+ * the allocator of the calling thread.
+ */
+struct mem_allocator_t;
+session_manager_t *session_manager_create_with_allocator (const struct mem_allocator_t *allocator);
+
 /*
  * Frees all memory allocated by this session manager.
  */
@@ -133,6 +265,212 @@ int session_manager_register_module (session_manager_t * manager, struct session
  */
 tcp_session_t *session_manager_update (session_manager_t * manager, struct libtrace_packet_t *packet);
 
+/*
+ * The same as session_manager_update(), for packets that are not libtrace
+ * packets, e.g. those read straight from a capture ring. The buffer starts
+ * at the IPv4 header and holds caplen bytes, which must include the whole
+ * TCP header. The time is in nanoseconds and direction is 0 for outbound
+ * and 1 for inbound. The buffer is used in place and must stay valid, and
+ * unchanged, until the call returns.
+ */
+tcp_session_t *session_manager_update_raw (session_manager_t * manager, const uint8_t * l3, size_t caplen, uint64_t ts_ns, int direction);
+
+/*
+ * Sets a function to be called with each session just before it is freed.
+ * Only one callback can be set; passing NULL removes it.
+ */
+void session_manager_set_close_callback (session_manager_t * manager, session_close_callback_t callback, void *arg);
+
+/*
+ * Sets the direction of every packet from a table of inside prefixes, for
+ * traces such as plain pcap files that carry no direction. A prefix with a
+ * value greater than 0 is inside, and one with the value 0 is outside,
+ * which allows holes to be cut in larger inside prefixes. A packet from an
+ * inside address to an outside one is outbound, and the reverse is
+ * inbound. Other packets keep the direction given with the packet. The
+ * table is not copied or freed by the manager. Passing NULL turns this off.
+ */
+void session_manager_set_inside_prefixes (session_manager_t * manager, prefix_table_t * table);
+
+/*
+ * With follow_only set, the manager only updates the sessions it already
+ * tracks, e.g. those restored from a snapshot, and ignores packets of any
+ * other session.
+ */
+void session_manager_set_follow_only (session_manager_t * manager, int follow_only);
+
+/*
+ * Expires sessions that have seen no packet for timeout seconds, whatever
+ * their state, as if they had closed. Sessions are checked at each cleanup,
+ * so one may stay up to a minute longer. A timeout of 0, the
+ * default, keeps sessions until they close.
+ */
+void session_manager_set_idle_timeout (session_manager_t * manager, uint32_t timeout);
+
+/*
+ * Returns the number of sessions being tracked.
+ */
+unsigned int session_manager_session_count (session_manager_t * manager);
+
+/*
+ * Keeps a top-K tracker (see topk.h) up to date with the sessions of this
+ * manager: it is offered each session after the modules are updated, and
+ * sessions are removed from it when they end. A tracker should only be
+ * given to one manager.
+ */
+struct top_k_t;
+void session_manager_add_top_k (session_manager_t * manager, struct top_k_t *top_k);
+
+/*
+ * Feeds an aggregate table (see aggregate.h) from the sessions of this
+ * manager: it is given each session after the modules are updated, for
+ * RTT samples, and each session as it ends. A table should only be given
+ * to one manager.
+ */
+struct aggregate_t;
+void session_manager_add_aggregate (session_manager_t * manager, struct aggregate_t *aggregate);
+
+/*
+ * A visit function is given each tracked session by
+ * session_manager_foreach().
+ */
+typedef void (*session_visit_t) (tcp_session_t * session, void *arg);
+
+/*
+ * Calls the visit function with every tracked session, e.g. for a periodic
+ * export. This costs time in the number of tracked sessions. The visit
+ * function must not add or remove sessions.
+ */
+void session_manager_foreach (session_manager_t * manager, session_visit_t visit, void *arg);
+
+/*
+ * A pipeline calls the update functions of a fixed set of modules directly,
+ * in place of the calls through the registered modules. It is given the
+ * module data of the session, the packet and the mask of modules still
+ * wanting it, and stores what each called module returns in wants. Modules
+ * at or beyond SM_MASK_MODULES are always called. See sessionpipeline.h.
+ */
+typedef void (*session_pipeline_t) (void **data, const struct session_packet_t * packet,
+                                    uint32_t mask, int *wants);
+
+/*
+ * Updates the modules with the given pipeline, which was built for count
+ * modules. It is only used while exactly that many modules are registered,
+ * so registering another module falls back to the registered update
+ * functions. Passing NULL turns it off.
+ */
+void session_manager_set_pipeline (session_manager_t * manager, session_pipeline_t pipeline, int count);
+
+/*
+ * Returns the tracked session with the given ID, or NULL.
+ */
+tcp_session_t *session_manager_find (session_manager_t * manager, tcp_session_id_t * id);
+
+/*
+ * Stops tracking a session and frees it without passing it to the close
+ * callback, e.g. a session restored from a snapshot that turns out to be a
+ * copy of another.
+ */
+void session_manager_drop_session (session_manager_t * manager, tcp_session_t * session);
+
+/*
+ * Turns on flow sampling, so that only about 1 in rate sessions are
+ * tracked. A session is chosen by a keyed hash of its ID, so both
+ * directions and every packet of a chosen session are seen, and the same
+ * key always chooses the same sessions. Packets of other sessions are
+ * dropped before the session lookup. A rate of 1 tracks every session.
+ * This should be set before the first packet, as sessions that are
+ * already tracked stop being updated if they fall out of a new sample.
+ */
+void session_manager_set_sampling (session_manager_t * manager, uint32_t rate, uint64_t key);
+
+/*
+ * Returns the sampling rate, i.e. the N in 1 in N sessions, to scale
+ * results by. This is 1 when sampling is off.
+ */
+uint32_t session_manager_get_sampling_rate (session_manager_t * manager);
+
+/*
+ * Turns on the SYN cache, which holds up to size bare SYNs in a small
+ * fixed-size table instead of creating a full session for each. A session
+ * is only created when the matching SYN/ACK is seen, and the modules are
+ * then given the cached SYN. This keeps scans and SYN floods from creating
+ * many sessions that never complete. A size of 0 turns the cache off,
+ * which is the default.
+ */
+void session_manager_set_syn_cache (session_manager_t * manager, unsigned int size);
+
+/*
+ * By default a session's module data is freed as soon as the session ends,
+ * inside session_manager_update(). With a reclaim budget greater than 0,
+ * ended sessions are instead put on a reclaim list and at most budget of
+ * them are freed on each call to session_manager_update(), which spreads
+ * out the cost of a wave of closing sessions. Setting the budget back to 0
+ * frees any pending sessions straight away.
+ */
+void session_manager_set_reclaim_budget (session_manager_t * manager, int budget);
+
+/*
+ * Frees up to max sessions from the reclaim list, or all of them if max is
+ * negative, e.g. when the capture is idle. Returns the number freed.
+ */
+int session_manager_reclaim (session_manager_t * manager, int max);
+
+/*
+ * Returns the number of ended sessions waiting on the reclaim list.
+ */
+unsigned int session_manager_reclaim_pending (session_manager_t * manager);
+
+/*
+ * Writes all live sessions, including the data of modules that support
+ * serialization, to a snapshot file. Returns the number of sessions written
+ * or -1 on error.
+ */
+int session_manager_checkpoint (session_manager_t * manager, const char *path);
+
+/*
+ * Reads the sessions from a snapshot file written by
+ * session_manager_checkpoint() into the manager. The same modules must be
+ * registered, in the same order, as when the snapshot was written. Module
+ * data that was not serialized is created afresh. Returns the number of
+ * sessions restored or -1 on error. A truncated or corrupt snapshot is an
+ * error, and then none of its sessions are restored.
+ */
+int session_manager_restore (session_manager_t * manager, const char *path);
+
+/*
+ * The same as session_manager_checkpoint(), writing the snapshot to an open
+ * file from its current position. The file must be seekable.
+ */
+int session_manager_checkpoint_file (session_manager_t * manager, FILE * file);
+
+/*
+ * The same as session_manager_restore(), reading the snapshot from an open
+ * file at its current position.
+ */
+int session_manager_restore_file (session_manager_t * manager, FILE * file);
+
+/*
+ * Writes one session, and the data of its modules, to a file in the same
+ * form as a session in a snapshot. This can be called from a close callback
+ * to keep the results of finished sessions. Returns 0 on success or -1 on
+ * a write error.
+ */
+int session_manager_save_session (session_manager_t * manager, tcp_session_t * session, FILE * file);
+
+/*
+ * Reads a session written by session_manager_save_session(). The session
+ * is not tracked by the manager and must be freed with
+ * session_manager_discard_session(). Returns NULL at the end of the file or
+ * on error.
+ */
+tcp_session_t *session_manager_load_session (session_manager_t * manager, FILE * file);
+
+/*
+ * Frees a session returned by session_manager_load_session().
+ */
+void session_manager_discard_session (session_manager_t * manager, tcp_session_t * session);
+
 #ifdef __cplusplus
 }
 #endif
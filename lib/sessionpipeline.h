@@ -0,0 +1,115 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#ifndef SESSIONPIPELINE_H_
+#define SESSIONPIPELINE_H_
+
+#include "sessionmanager.h"
+
+/*
+ * A pipeline replaces the per-packet loop over the registered modules, and
+ * its call through a function pointer for every module, with one function
+ * that calls the update function of each module directly. The compiler can
+ * then inline the updates where their definitions are visible, e.g. with
+ * link time optimisation, and the branches no longer depend on the module
+ * array.
+ *
+ * The modules are listed once in an X-macro, in the order they are to be
+ * registered, as the function that returns the session module and the
+ * module's update function:
+ *
+ *	#define MY_MODULES(X) \
+ *		X (bwest_module, bwest_update) \
+ *		X (rtt_handshake_module, rtt_handshake_update)
+ *
+ *	SESSION_PIPELINE (my_pipeline, MY_MODULES)
+ *
+ * This defines my_pipeline_update(), a session_pipeline_t, and
+ * my_pipeline_register (manager, modules), which registers the modules with
+ * a session manager that has none yet, installs the pipeline and returns
+ * the id of the first module. The others follow in order. Modules
+ * registered afterwards turn the pipeline off and the manager falls back
+ * to the registered update functions.
+ *
+ * modules is an array with one entry per module, in the same order, so
+ * that modules can be built and configured before they are registered:
+ *
+ *	struct session_module_t *modules[2] = { NULL, NULL };
+ *
+ *	modules[0] = bwest_module ();
+ *	bwest_set_interval (modules[0], 0.5);
+ *	my_pipeline_register (manager, modules);
+ *
+ * A NULL entry is built with the module's function and stored back in the
+ * array. modules may also be NULL when no module needs configuring.
+ */
+
+/* Calls one module of a pipeline, if it still wants the packet */
+#define SESSION_PIPELINE_UPDATE(module, update) \
+	if (i >= SM_MASK_MODULES) \
+		update (data[i], packet); \
+	else if (mask & (1u << i)) \
+		wants[i] = update (data[i], packet); \
+	i++;
+
+/* Registers one module of a pipeline, building it if it was not given */
+#define SESSION_PIPELINE_REGISTER(module, update) \
+	built = (modules != NULL) ? modules[count] : NULL; \
+	if (built == NULL) \
+		built = module (); \
+	if (modules != NULL) \
+		modules[count] = built; \
+	id = session_manager_register_module (manager, built); \
+	if (first < 0) \
+		first = id; \
+	count++;
+
+#define SESSION_PIPELINE(name, list) \
+static void name##_update (void **data, const struct session_packet_t *packet, \
+                           uint32_t mask, int *wants) { \
+	int i = 0; \
+	list (SESSION_PIPELINE_UPDATE) \
+	(void) mask; \
+	(void) wants; \
+} \
+\
+static int name##_register (session_manager_t * manager, \
+                           struct session_module_t **modules) { \
+	struct session_module_t *built; \
+	int first = -1, id, count = 0; \
+	list (SESSION_PIPELINE_REGISTER) \
+	(void) id; \
+	session_manager_set_pipeline (manager, &name##_update, count); \
+	return first; \
+}
+
+#endif							/*SESSIONPIPELINE_H_ */
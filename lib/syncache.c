@@ -0,0 +1,192 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sessionmanager.h"
+#include "tcpsession.h"
+#include "mempool.h"
+#include "syncache.h"
+
+/*
+ * An entry in the cache. An entry is empty when valid is 0.
+ */
+struct syn_cache_entry_t {
+	tcp_session_id_t id;
+	uint8_t valid;
+	struct tcp_syn_t syn;
+};
+
+struct syn_cache_t {
+	struct syn_cache_entry_t *entries;
+
+	/* The number of sets of SYN_CACHE_WAYS entries */
+	unsigned int sets;
+
+	/* The key for the hash, which differs between caches */
+	uint64_t key;
+
+	/* How long, in nanoseconds, an entry is kept */
+	uint64_t timeout;
+
+	uint64_t inserted;
+	uint64_t evicted;
+};
+
+/*
+ * Returns the first entry of the set that a session belongs to.
+ */
+struct syn_cache_entry_t *syn_cache_set (syn_cache_t * cache, tcp_session_id_t * id);
+
+/*
+ * Returns the entry for a session in its set, or NULL.
+ */
+struct syn_cache_entry_t *syn_cache_find (syn_cache_t * cache, tcp_session_id_t * id);
+
+
+
+/*
+ * Creates a cache with room for size entries, which is rounded up to a
+ * multiple of SYN_CACHE_WAYS. Entries expire after timeout nanoseconds.
+ */
+syn_cache_t *syn_cache_create (unsigned int size, uint64_t timeout) {
+	syn_cache_t *cache = mem_alloc (sizeof (syn_cache_t));
+
+	cache->sets = (size + SYN_CACHE_WAYS - 1) / SYN_CACHE_WAYS;
+	if (cache->sets == 0)
+		cache->sets = 1;
+	cache->entries = mem_calloc (cache->sets * SYN_CACHE_WAYS, sizeof (struct syn_cache_entry_t));
+
+	/* The address of the cache is a cheap source of a per-cache key */
+	cache->key = (uint64_t) (uintptr_t) cache;
+	cache->timeout = timeout;
+
+	cache->inserted = 0;
+	cache->evicted = 0;
+	return cache;
+}
+
+/*
+ * Frees the cache.
+ */
+void syn_cache_destroy (syn_cache_t * cache) {
+	mem_free (cache->entries);
+	mem_free (cache);
+}
+
+/*
+ * Returns the first entry of the set that a session belongs to.
+ */
+struct syn_cache_entry_t *syn_cache_set (syn_cache_t * cache, tcp_session_id_t * id) {
+	uint32_t hash = tcp_session_id_hash (id, cache->key);
+	return &(cache->entries[(hash % cache->sets) * SYN_CACHE_WAYS]);
+}
+
+/*
+ * Returns the entry for a session in its set, or NULL.
+ */
+struct syn_cache_entry_t *syn_cache_find (syn_cache_t * cache, tcp_session_id_t * id) {
+	struct syn_cache_entry_t *set = syn_cache_set (cache, id);
+	int i;
+
+	for (i = 0; i < SYN_CACHE_WAYS; i++) {
+		if (set[i].valid && tcp_session_id_equals (&(set[i].id), id))
+			return &(set[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Adds a SYN for a session, replacing any earlier SYN for the same session.
+ */
+void syn_cache_insert (syn_cache_t * cache, tcp_session_id_t * id, struct tcp_syn_t *syn) {
+	struct syn_cache_entry_t *set;
+	struct syn_cache_entry_t *entry = syn_cache_find (cache, id);
+	int i;
+
+	if (entry == NULL) {
+		/* Use an empty or expired entry, or else evict the oldest */
+		set = syn_cache_set (cache, id);
+		entry = &(set[0]);
+		for (i = 0; i < SYN_CACHE_WAYS; i++) {
+			if (!set[i].valid || syn->time - set[i].syn.time > cache->timeout) {
+				entry = &(set[i]);
+				break;
+			}
+			if (set[i].syn.time < entry->syn.time)
+				entry = &(set[i]);
+		}
+		if (i == SYN_CACHE_WAYS)
+			cache->evicted++;
+		cache->inserted++;
+	}
+
+	entry->id = *id;
+	entry->valid = 1;
+	entry->syn = *syn;
+}
+
+/*
+ * Finds the SYN for a session, or returns NULL if there is none.
+ */
+struct tcp_syn_t *syn_cache_lookup (syn_cache_t * cache, tcp_session_id_t * id, uint64_t now) {
+	struct syn_cache_entry_t *entry = syn_cache_find (cache, id);
+
+	if (entry == NULL)
+		return NULL;
+
+	if (now - entry->syn.time > cache->timeout) {
+		entry->valid = 0;
+		return NULL;
+	}
+	return &(entry->syn);
+}
+
+/*
+ * Removes the SYN for a session, if there is one.
+ */
+void syn_cache_remove (syn_cache_t * cache, tcp_session_id_t * id) {
+	struct syn_cache_entry_t *entry = syn_cache_find (cache, id);
+	if (entry != NULL)
+		entry->valid = 0;
+}
+
+/*
+ * Returns the number of SYNs added and the number evicted to make room.
+ */
+uint64_t syn_cache_inserted (syn_cache_t * cache) {
+	return cache->inserted;
+}
+
+uint64_t syn_cache_evicted (syn_cache_t * cache) {
+	return cache->evicted;
+}
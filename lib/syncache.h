@@ -0,0 +1,90 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef SYNCACHE_H_
+#define SYNCACHE_H_
+
+#include <inttypes.h>
+#include "sessionmanager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A SYN cache holds half-open connections in a fixed-size table, so that a
+ * bare SYN costs one small entry rather than a full session with data for
+ * every module. It is modelled on the BSD syncache: entries are kept in
+ * sets of SYN_CACHE_WAYS chosen by a keyed hash of the session ID, and
+ * when a set is full its oldest entry is evicted. Entries older than the
+ * timeout are treated as empty.
+ */
+typedef struct syn_cache_t syn_cache_t;
+
+#define SYN_CACHE_WAYS 4
+
+/*
+ * Creates a cache with room for size entries, which is rounded up to a
+ * multiple of SYN_CACHE_WAYS. Entries expire after timeout nanoseconds.
+ */
+syn_cache_t *syn_cache_create (unsigned int size, uint64_t timeout);
+
+/*
+ * Frees the cache.
+ */
+void syn_cache_destroy (syn_cache_t * cache);
+
+/*
+ * Adds a SYN for a session, replacing any earlier SYN for the same session.
+ */
+void syn_cache_insert (syn_cache_t * cache, tcp_session_id_t * id, struct tcp_syn_t *syn);
+
+/*
+ * Finds the SYN for a session, or returns NULL if there is none.
+ */
+struct tcp_syn_t *syn_cache_lookup (syn_cache_t * cache, tcp_session_id_t * id, uint64_t now);
+
+/*
+ * Removes the SYN for a session, if there is one.
+ */
+void syn_cache_remove (syn_cache_t * cache, tcp_session_id_t * id);
+
+/*
+ * Returns the number of SYNs added and the number evicted to make room.
+ */
+uint64_t syn_cache_inserted (syn_cache_t * cache);
+uint64_t syn_cache_evicted (syn_cache_t * cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*SYNCACHE_H_ */
@@ -57,17 +57,27 @@ void tcp_session_id_print (tcp_session_id_t * id) {
  * This string avoids the need for a malloc() every time a string
  * representation of the id is required.
  * */
-char tcp_session_id_string_array[40];
+char tcp_session_id_string_array[TCP_SESSION_ID_STRING_LENGTH];
 
 /*
  * For debugging or otherwise, this returns a string representation of
  * the ID, for possible inclusion in another printf() with other data.
  * Note: hexadecimal is used for the IP address as the dotted-decimal 
  * is meaningless with the scrambled IP addresses.
+ * The string is shared by all callers, so this is not thread-safe.
  * */
 char *tcp_session_id_string (tcp_session_id_t * id) {
-	sprintf (tcp_session_id_string_array, "(%8x:%5u , %8x:%5u)", id->ip_a, id->port_a, id->ip_b, id->port_b);
-	return tcp_session_id_string_array;
+	return tcp_session_id_string_r (id, tcp_session_id_string_array, sizeof (tcp_session_id_string_array));
+}
+
+/*
+ * As tcp_session_id_string(), but writes into the caller's buffer of the
+ * given length, which should be TCP_SESSION_ID_STRING_LENGTH bytes.
+ * Returns the buffer.
+ * */
+char *tcp_session_id_string_r (tcp_session_id_t * id, char *buf, size_t len) {
+	snprintf (buf, len, "(%8x:%5u , %8x:%5u)", id->ip_a, id->port_a, id->ip_b, id->port_b);
+	return buf;
 }
 
 /*
@@ -85,3 +95,40 @@ int tcp_session_id_equals (tcp_session_id_t * id1, tcp_session_id_t * id2) {
 		return 0;
 	return 1;
 }
+
+/*
+ * Returns the time of a packet in nanoseconds since the epoch. The time is
+ * taken from the ERF timestamp, so no floating point is involved.
+ */
+uint64_t tcp_packet_time (struct libtrace_packet_t *packet) {
+	/* ERF timestamps are fixed point, with the seconds in the upper
+	 * 32 bits and the fraction of a second in the lower 32 bits.
+	 */
+	uint64_t erf = trace_get_erf_timestamp (packet);
+	return (erf >> 32) * TCP_NSEC_PER_SEC + (((erf & 0xffffffff) * TCP_NSEC_PER_SEC) >> 32);
+}
+
+/*
+ * Mixes the bits of a 64 bit value (the MurmurHash3 finaliser).
+ */
+uint64_t tcp_session_hash_mix (uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * Returns a keyed hash of the ID. As an ID is the same for both directions
+ * of a session, so is the hash. Different keys give unrelated hashes, so
+ * the key can be kept secret to stop traffic being crafted to fall in or
+ * out of a sample.
+ * */
+uint32_t tcp_session_id_hash (tcp_session_id_t * id, uint64_t key) {
+	uint64_t h = key;
+	h = tcp_session_hash_mix (h ^ (((uint64_t) id->ip_a << 32) | id->ip_b));
+	h = tcp_session_hash_mix (h ^ (((uint64_t) id->port_a << 16) | id->port_b));
+	return (uint32_t) (h >> 32);
+}
@@ -48,16 +48,62 @@ void tcp_session_id_print (tcp_session_id_t * id);
  * the ID, for possible inclusion in another printf() with other data.
  * Note: hexadecimal is used for the IP address as the dotted-decimal 
  * is meaningless with the scrambled IP addresses.
+ * The string is shared by all callers, so this is not thread-safe.
  * */
 char *tcp_session_id_string (tcp_session_id_t * id);
 
+/* The buffer length needed by tcp_session_id_string_r(). */
+#define TCP_SESSION_ID_STRING_LENGTH 40
+
+/*
+ * As tcp_session_id_string(), but writes into the caller's buffer of the
+ * given length, for use from several threads. Returns the buffer.
+ * */
+char *tcp_session_id_string_r (tcp_session_id_t * id, char *buf, size_t len);
+
 /*
  * This is used by the hashtable and session manager as a convenient
  * way to compare two IDs.
  * */
 int tcp_session_id_equals (tcp_session_id_t * id1, tcp_session_id_t * id2);
 
+/*
+ * Returns a keyed hash of the ID. As an ID is the same for both directions
+ * of a session, so is the hash. Different keys give unrelated hashes, so
+ * the key can be kept secret to stop traffic being crafted to fall in or
+ * out of a sample.
+ * */
+uint32_t tcp_session_id_hash (tcp_session_id_t * id, uint64_t key);
+
 void * tcp_session_get_ptr (tcp_session_t * session, int module_id);
 
+/*
+ * Times are kept as 64 bit integer nanoseconds since the epoch. Per-packet
+ * records only need to measure short intervals, so they keep the low 32
+ * bits of the time in microseconds, which wraps every 71 minutes. The
+ * difference of two such values is correct as long as it is less than
+ * that, in the same way as for sequence numbers.
+ */
+#define TCP_NSEC_PER_SEC 1000000000ULL
+#define TCP_NSEC_PER_USEC 1000
+#define TCP_TIME_USEC32(ns) ((uint32_t) ((ns) / TCP_NSEC_PER_USEC))
+
+/*
+ * Converts a time or interval to seconds for output.
+ */
+#define TCP_NSEC_TO_SEC(ns) ((double) (ns) / 1e9)
+#define TCP_USEC_TO_SEC(us) ((double) (us) / 1e6)
+
+/*
+ * Converts seconds given by the user to nanoseconds.
+ */
+#define TCP_SEC_TO_NSEC(sec) ((uint64_t) ((sec) * 1e9))
+
+/*
+ * Returns the time of a packet in nanoseconds since the epoch. The time is
+ * taken from the ERF timestamp, so no floating point is involved.
+ */
+uint64_t tcp_packet_time (struct libtrace_packet_t *packet);
+
 
 #endif							/*TCPSESSION_H_ */
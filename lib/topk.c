@@ -0,0 +1,349 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sessionmanager.h"
+#include "tcpsession.h"
+#include "topk.h"
+
+/* Marks an empty place in the map from sessions to the heap */
+#define TOP_K_EMPTY -1
+
+/*
+ * An item of the heap, with its place in the map.
+ */
+struct top_k_item_t {
+	tcp_session_t *session;
+	uint64_t value;
+	unsigned int slot;
+};
+
+struct top_k_t {
+	int k;
+
+	/* Where the counter is read from */
+	int module;
+	top_k_metric_t metric;
+
+	/* The min-heap of at most k items, smallest counter first */
+	struct top_k_item_t *heap;
+	int length;
+
+	/*
+	 * An open addressing map from sessions to their heap position, with
+	 * at least twice as many places as the heap.
+	 */
+	int *map;
+	unsigned int map_mask;
+
+	/*
+	 * Held while the heap is changed and while it is copied out, so that
+	 * other threads can read it. The updating thread is the only writer,
+	 * so it reads the heap without the lock.
+	 */
+	pthread_mutex_t lock;
+};
+
+/*
+ * Returns the place in the map where a session would first be looked for.
+ */
+unsigned int top_k_hash (top_k_t * top_k, tcp_session_t * session);
+
+/*
+ * Returns the heap position of a session, or -1 if it is not tracked.
+ */
+int top_k_find (top_k_t * top_k, tcp_session_t * session);
+
+/*
+ * Adds the session at a heap position to the map.
+ */
+void top_k_map_add (top_k_t * top_k, int pos);
+
+/*
+ * Empties a place in the map, moving later entries of the probe sequence
+ * back so that lookups still find them.
+ */
+void top_k_map_remove (top_k_t * top_k, unsigned int slot);
+
+/*
+ * Moves an item to a heap position, updating the map.
+ */
+void top_k_place (top_k_t * top_k, int pos, struct top_k_item_t item);
+
+/*
+ * Restores the heap order around a position whose counter has changed.
+ */
+void top_k_sift (top_k_t * top_k, int pos);
+
+/*
+ * Creates a tracker for the k sessions with the largest counter, which is
+ * read by metric from the data of the module with the given id. Returns
+ * NULL if k is not positive.
+ */
+top_k_t *top_k_create (int k, int module, top_k_metric_t metric) {
+	top_k_t *top_k;
+	unsigned int size = 2, i;
+
+	if (k <= 0) {
+		fprintf (stderr, "top_k: K out of range\n");
+		return NULL;
+	}
+
+	while (size < 2 * (unsigned int) k)
+		size *= 2;
+
+	top_k = malloc (sizeof (top_k_t));
+	top_k->k = k;
+	top_k->module = module;
+	top_k->metric = metric;
+	top_k->heap = malloc (k * sizeof (struct top_k_item_t));
+	top_k->length = 0;
+	top_k->map = malloc (size * sizeof (int));
+	for (i = 0; i < size; i++)
+		top_k->map[i] = TOP_K_EMPTY;
+	top_k->map_mask = size - 1;
+	pthread_mutex_init (&top_k->lock, NULL);
+	return top_k;
+}
+
+/*
+ * Frees a tracker. It must have been taken off any session manager.
+ */
+void top_k_destroy (top_k_t * top_k) {
+	pthread_mutex_destroy (&top_k->lock);
+	free (top_k->map);
+	free (top_k->heap);
+	free (top_k);
+}
+
+/*
+ * Returns the place in the map where a session would first be looked for.
+ */
+unsigned int top_k_hash (top_k_t * top_k, tcp_session_t * session) {
+	uint64_t key = (uint64_t) (uintptr_t) session;
+	return (unsigned int) ((key * 0x9e3779b97f4a7c15ULL) >> 32) & top_k->map_mask;
+}
+
+/*
+ * Returns the heap position of a session, or -1 if it is not tracked.
+ */
+int top_k_find (top_k_t * top_k, tcp_session_t * session) {
+	unsigned int slot = top_k_hash (top_k, session);
+
+	while (top_k->map[slot] != TOP_K_EMPTY) {
+		if (top_k->heap[top_k->map[slot]].session == session)
+			return top_k->map[slot];
+		slot = (slot + 1) & top_k->map_mask;
+	}
+	return -1;
+}
+
+/*
+ * Adds the session at a heap position to the map.
+ */
+void top_k_map_add (top_k_t * top_k, int pos) {
+	unsigned int slot = top_k_hash (top_k, top_k->heap[pos].session);
+
+	while (top_k->map[slot] != TOP_K_EMPTY)
+		slot = (slot + 1) & top_k->map_mask;
+	top_k->map[slot] = pos;
+	top_k->heap[pos].slot = slot;
+}
+
+/*
+ * Empties a place in the map, moving later entries of the probe sequence
+ * back so that lookups still find them.
+ */
+void top_k_map_remove (top_k_t * top_k, unsigned int slot) {
+	unsigned int next = slot, home;
+
+	top_k->map[slot] = TOP_K_EMPTY;
+	for (;;) {
+		next = (next + 1) & top_k->map_mask;
+		if (top_k->map[next] == TOP_K_EMPTY)
+			return;
+		home = top_k_hash (top_k, top_k->heap[top_k->map[next]].session);
+
+		/* Leave the entry if its home lies after the gap */
+		if (((next - home) & top_k->map_mask) < ((next - slot) & top_k->map_mask))
+			continue;
+
+		top_k->map[slot] = top_k->map[next];
+		top_k->heap[top_k->map[slot]].slot = slot;
+		top_k->map[next] = TOP_K_EMPTY;
+		slot = next;
+	}
+}
+
+/*
+ * Moves an item to a heap position, updating the map.
+ */
+void top_k_place (top_k_t * top_k, int pos, struct top_k_item_t item) {
+	top_k->heap[pos] = item;
+	top_k->map[item.slot] = pos;
+}
+
+/*
+ * Restores the heap order around a position whose counter has changed.
+ */
+void top_k_sift (top_k_t * top_k, int pos) {
+	struct top_k_item_t item = top_k->heap[pos];
+	int parent, child;
+
+	/* Up, while smaller than the parent */
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (top_k->heap[parent].value <= item.value)
+			break;
+		top_k_place (top_k, pos, top_k->heap[parent]);
+		pos = parent;
+	}
+
+	/* Down, while larger than the smaller child */
+	for (;;) {
+		child = 2 * pos + 1;
+		if (child >= top_k->length)
+			break;
+		if (child + 1 < top_k->length && top_k->heap[child + 1].value < top_k->heap[child].value)
+			child++;
+		if (item.value <= top_k->heap[child].value)
+			break;
+		top_k_place (top_k, pos, top_k->heap[child]);
+		pos = child;
+	}
+
+	top_k_place (top_k, pos, item);
+}
+
+/*
+ * Offers a session with its current counter.
+ */
+void top_k_update (top_k_t * top_k, tcp_session_t * session, uint64_t value) {
+	int pos = top_k_find (top_k, session);
+
+	if (pos >= 0) {
+		if (top_k->heap[pos].value == value)
+			return;
+		pthread_mutex_lock (&top_k->lock);
+		top_k->heap[pos].value = value;
+		top_k_sift (top_k, pos);
+		pthread_mutex_unlock (&top_k->lock);
+	} else if (top_k->length < top_k->k) {
+		pthread_mutex_lock (&top_k->lock);
+		pos = top_k->length++;
+		top_k->heap[pos].session = session;
+		top_k->heap[pos].value = value;
+		top_k_map_add (top_k, pos);
+		top_k_sift (top_k, pos);
+		pthread_mutex_unlock (&top_k->lock);
+	} else if (value > top_k->heap[0].value) {
+		/* Replace the smallest */
+		pthread_mutex_lock (&top_k->lock);
+		top_k_map_remove (top_k, top_k->heap[0].slot);
+		top_k->heap[0].session = session;
+		top_k->heap[0].value = value;
+		top_k_map_add (top_k, 0);
+		top_k_sift (top_k, 0);
+		pthread_mutex_unlock (&top_k->lock);
+	}
+}
+
+/*
+ * Offers a session, reading its counter from its module data.
+ */
+void top_k_update_session (top_k_t * top_k, tcp_session_t * session) {
+	top_k_update (top_k, session, top_k->metric (session->data[top_k->module]));
+}
+
+/*
+ * Forgets a session, e.g. because it has ended.
+ */
+void top_k_remove (top_k_t * top_k, tcp_session_t * session) {
+	int pos = top_k_find (top_k, session);
+
+	if (pos < 0)
+		return;
+
+	pthread_mutex_lock (&top_k->lock);
+	top_k_map_remove (top_k, top_k->heap[pos].slot);
+	top_k->length--;
+	if (pos < top_k->length) {
+		top_k_place (top_k, pos, top_k->heap[top_k->length]);
+		top_k_sift (top_k, pos);
+	}
+	pthread_mutex_unlock (&top_k->lock);
+}
+
+/*
+ * Orders entries by counter, largest first.
+ */
+int top_k_compare (const void *a, const void *b) {
+	const struct top_k_entry_t *x = (const struct top_k_entry_t *) a;
+	const struct top_k_entry_t *y = (const struct top_k_entry_t *) b;
+
+	if (x->value != y->value)
+		return (x->value < y->value) ? 1 : -1;
+	return 0;
+}
+
+/*
+ * Copies up to max of the tracked sessions into entries, largest counter
+ * first, and returns how many were copied.
+ */
+int top_k_get (top_k_t * top_k, struct top_k_entry_t *entries, int max) {
+	struct top_k_entry_t *all;
+	int i, count;
+
+	if (max <= 0)
+		return 0;
+
+	all = malloc (top_k->k * sizeof (struct top_k_entry_t));
+
+	pthread_mutex_lock (&top_k->lock);
+	count = top_k->length;
+	for (i = 0; i < count; i++) {
+		all[i].id = top_k->heap[i].session->id;
+		all[i].value = top_k->heap[i].value;
+	}
+	pthread_mutex_unlock (&top_k->lock);
+
+	qsort (all, count, sizeof (struct top_k_entry_t), &top_k_compare);
+	if (count > max)
+		count = max;
+	for (i = 0; i < count; i++)
+		entries[i] = all[i];
+	free (all);
+	return count;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+
+#ifndef TOPK_H_
+#define TOPK_H_
+
+#include <inttypes.h>
+#include "sessionmanager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A top-K tracker keeps the K live sessions with the largest value of one
+ * module's counter, such as bwest_total() or reordering_retransmissions(),
+ * in a min-heap. The session manager updates it after every packet, which
+ * costs O(log K), and removes sessions as they end, so the heaviest flows
+ * can be read at any time without scanning every session. The counter
+ * should only grow, as byte and packet counts do. When a tracked session
+ * ends, its place is taken by whichever untracked session is updated next,
+ * not necessarily the next largest. Until the larger sessions are updated
+ * again and push the smaller ones out, the tracker may hold sessions that
+ * are not among the K largest.
+ *
+ * The tracker may be read with top_k_get() from another thread while the
+ * manager's thread updates it.
+ */
+typedef struct top_k_t top_k_t;
+
+/*
+ * Returns the counter of a session from its data for the module.
+ */
+typedef uint64_t (*top_k_metric_t) (void *data);
+
+/*
+ * A session and its counter, as given by top_k_get().
+ */
+struct top_k_entry_t {
+	tcp_session_id_t id;
+	uint64_t value;
+};
+
+/*
+ * Creates a tracker for the k sessions with the largest counter, which is
+ * read by metric from the data of the module with the given id. Returns
+ * NULL if k is not positive.
+ */
+top_k_t *top_k_create (int k, int module, top_k_metric_t metric);
+
+/*
+ * Frees a tracker. It must have been taken off any session manager.
+ */
+void top_k_destroy (top_k_t * top_k);
+
+/*
+ * Offers a session with its current counter.
+ */
+void top_k_update (top_k_t * top_k, tcp_session_t * session, uint64_t value);
+
+/*
+ * Offers a session, reading its counter from its module data.
+ */
+void top_k_update_session (top_k_t * top_k, tcp_session_t * session);
+
+/*
+ * Forgets a session, e.g. because it has ended.
+ */
+void top_k_remove (top_k_t * top_k, tcp_session_t * session);
+
+/*
+ * Copies up to max of the tracked sessions into entries, largest counter
+ * first, and returns how many were copied.
+ */
+int top_k_get (top_k_t * top_k, struct top_k_entry_t *entries, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*TOPK_H_ */
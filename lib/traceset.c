@@ -0,0 +1,461 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libtrace.h>
+#include "sessionmanager.h"
+#include "tcpsession.h"
+#include "traceset.h"
+
+/* The number of URIs by which the list grows */
+#define TRACE_SET_INCREMENT 64
+
+struct trace_set_t {
+	trace_set_create_manager_t create_manager;
+	trace_set_flow_callback_t flow;
+	void *arg;
+
+	char **uris;
+	int count;
+	int size;
+
+	uint32_t idle_timeout;
+};
+
+/*
+ * A run of consecutive traces read by one thread.
+ */
+struct trace_set_run_t {
+	trace_set_t *set;
+	session_manager_t *manager;
+	pthread_t thread;
+
+	int first;
+	int count;
+
+	/* The flows that finished in this run, in the order they finished */
+	FILE *flows;
+
+	/* A snapshot of the flows still live at the end of the run */
+	FILE *live;
+
+	/* Set once the traces have been read, when only the flows that are
+	 * already closed are saved. Live ones go in the snapshot instead.
+	 */
+	int finishing;
+
+	int error;
+};
+
+/*
+ * A flow that the stitching manager followed into a run, and the time of
+ * its last packet, or UINT64_MAX if it is still live.
+ */
+struct trace_set_stitched_t {
+	tcp_session_id_t id;
+	uint64_t end_time;
+};
+
+/*
+ * The state of the stitching pass, which runs on the calling thread.
+ */
+struct trace_set_stitch_t {
+	trace_set_t *set;
+	session_manager_t *manager;
+
+	struct trace_set_stitched_t *stitched;
+	int stitched_count;
+	int stitched_size;
+
+	int64_t flows;
+
+	/* Set while the flows still followed at the end of a file are given
+	 * as they are, when the copies in the next run are kept.
+	 */
+	int splitting;
+};
+
+/*
+ * Reads one trace into a session manager. With follow_only set, reading
+ * stops once the manager has no more sessions. Returns 0 or -1 on error.
+ */
+int trace_set_read (session_manager_t * manager, const char *uri, int follow_only);
+
+/*
+ * The thread that reads a run of traces.
+ */
+void *trace_set_run_thread (void *data);
+
+/*
+ * The close callback of a run's manager, which saves finished flows.
+ */
+void trace_set_save_flow (tcp_session_t * session, void *arg);
+
+/*
+ * Creates the stitching manager.
+ */
+void trace_set_stitch_create (struct trace_set_stitch_t *stitch);
+
+/*
+ * The close callback of the stitching manager, which gives the flow to the
+ * user and remembers it.
+ */
+void trace_set_stitch_flow (tcp_session_t * session, void *arg);
+
+/*
+ * Remembers a flow followed by the stitching manager.
+ */
+void trace_set_add_stitched (struct trace_set_stitch_t *stitch, tcp_session_id_t * id, uint64_t end_time);
+
+/*
+ * Returns 1 if a flow of a run is a copy of a flow that the stitching
+ * manager followed into the run.
+ */
+int trace_set_is_stitched (struct trace_set_stitch_t *stitch, tcp_session_t * session);
+
+/*
+ * Gives the user the saved flows of a run, leaving out stitched copies.
+ */
+void trace_set_emit_run (struct trace_set_stitch_t *stitch, struct trace_set_run_t *run);
+
+
+
+/*
+ * Creates an empty trace set.
+ */
+trace_set_t *trace_set_create (trace_set_create_manager_t create_manager, trace_set_flow_callback_t flow, void *arg) {
+	trace_set_t *set = malloc (sizeof (trace_set_t));
+	set->create_manager = create_manager;
+	set->flow = flow;
+	set->arg = arg;
+	set->uris = NULL;
+	set->count = 0;
+	set->size = 0;
+	set->idle_timeout = TRACE_SET_IDLE_TIMEOUT;
+	return set;
+}
+
+/*
+ * Frees a trace set.
+ */
+void trace_set_destroy (trace_set_t * set) {
+	int i;
+	for (i = 0; i < set->count; i++)
+		free (set->uris[i]);
+	free (set->uris);
+	free (set);
+}
+
+/*
+ * Adds a trace, as a libtrace URI. Traces must be added in time order.
+ */
+void trace_set_add (trace_set_t * set, const char *uri) {
+	if (set->count == set->size) {
+		set->size += TRACE_SET_INCREMENT;
+		set->uris = realloc (set->uris, set->size * sizeof (char *));
+	}
+	set->uris[set->count] = strdup (uri);
+	set->count++;
+}
+
+/*
+ * Sets the time in seconds after which idle flows expire, which is
+ * TRACE_SET_IDLE_TIMEOUT by default. A timeout of 0 keeps flows until they
+ * close, which may split more of them.
+ */
+void trace_set_set_idle_timeout (trace_set_t * set, uint32_t timeout) {
+	set->idle_timeout = timeout;
+}
+
+/*
+ * Reads one trace into a session manager. With follow_only set, reading
+ * stops once the manager has no more sessions. Returns 0 or -1 on error.
+ */
+int trace_set_read (session_manager_t * manager, const char *uri, int follow_only) {
+	libtrace_t *trace;
+	libtrace_packet_t *packet;
+	int error = 0;
+
+	trace = trace_create (uri);
+	if (trace_is_err (trace)) {
+		trace_perror (trace, "Opening trace %s", uri);
+		trace_destroy (trace);
+		return -1;
+	}
+
+	if (trace_start (trace) == -1) {
+		trace_perror (trace, "Starting trace %s", uri);
+		trace_destroy (trace);
+		return -1;
+	}
+
+	packet = trace_create_packet ();
+	while (trace_read_packet (trace, packet) > 0) {
+		session_manager_update (manager, packet);
+		if (follow_only && session_manager_session_count (manager) == 0)
+			break;
+	}
+
+	if (trace_is_err (trace)) {
+		trace_perror (trace, "Reading trace %s", uri);
+		error = 1;
+	}
+
+	trace_destroy_packet (packet);
+	trace_destroy (trace);
+	return error ? -1 : 0;
+}
+
+/*
+ * The close callback of a run's manager, which saves finished flows.
+ */
+void trace_set_save_flow (tcp_session_t * session, void *arg) {
+	struct trace_set_run_t *run = (struct trace_set_run_t *) arg;
+
+	if (run->finishing && session->state != CLOSED && session->state != RESET)
+		return;
+
+	if (session_manager_save_session (run->manager, session, run->flows) != 0)
+		run->error = 1;
+}
+
+/*
+ * The thread that reads a run of traces.
+ */
+void *trace_set_run_thread (void *data) {
+	struct trace_set_run_t *run = (struct trace_set_run_t *) data;
+	trace_set_t *set = run->set;
+	int i;
+
+	run->flows = tmpfile ();
+	run->live = tmpfile ();
+	if (run->flows == NULL || run->live == NULL) {
+		fprintf (stderr, "Cannot create temporary files for a trace set\n");
+		run->error = 1;
+		return NULL;
+	}
+
+	run->manager = set->create_manager (set->arg);
+	session_manager_set_close_callback (run->manager, &trace_set_save_flow, run);
+	session_manager_set_idle_timeout (run->manager, set->idle_timeout);
+
+	for (i = run->first; i < run->first + run->count; i++) {
+		if (trace_set_read (run->manager, set->uris[i], 0) != 0)
+			run->error = 1;
+	}
+
+	/* Flows that are still live go into the snapshot for the next run */
+	if (session_manager_checkpoint_file (run->manager, run->live) < 0)
+		run->error = 1;
+	run->finishing = 1;
+	session_manager_destroy (run->manager);
+	run->manager = NULL;
+
+	rewind (run->flows);
+	rewind (run->live);
+	return NULL;
+}
+
+/*
+ * Remembers a flow followed by the stitching manager.
+ */
+void trace_set_add_stitched (struct trace_set_stitch_t *stitch, tcp_session_id_t * id, uint64_t end_time) {
+	if (stitch->stitched_count == stitch->stitched_size) {
+		stitch->stitched_size += TRACE_SET_INCREMENT;
+		stitch->stitched = realloc (stitch->stitched, stitch->stitched_size * sizeof (struct trace_set_stitched_t));
+	}
+	stitch->stitched[stitch->stitched_count].id = *id;
+	stitch->stitched[stitch->stitched_count].end_time = end_time;
+	stitch->stitched_count++;
+}
+
+/*
+ * Creates the stitching manager.
+ */
+void trace_set_stitch_create (struct trace_set_stitch_t *stitch) {
+	stitch->manager = stitch->set->create_manager (stitch->set->arg);
+	session_manager_set_close_callback (stitch->manager, &trace_set_stitch_flow, stitch);
+	session_manager_set_follow_only (stitch->manager, 1);
+	session_manager_set_idle_timeout (stitch->manager, stitch->set->idle_timeout);
+}
+
+/*
+ * The close callback of the stitching manager, which gives the flow to the
+ * user and remembers it.
+ */
+void trace_set_stitch_flow (tcp_session_t * session, void *arg) {
+	struct trace_set_stitch_t *stitch = (struct trace_set_stitch_t *) arg;
+
+	/* A flow waiting in TIME_WAIT has ended even when splitting */
+	if (!stitch->splitting || session->waiting)
+		trace_set_add_stitched (stitch, &(session->id), session->end_time);
+	stitch->set->flow (session, stitch->set->arg);
+	stitch->flows++;
+}
+
+/*
+ * Returns 1 if a flow of a run is a copy of a flow that the stitching
+ * manager followed into the run.
+ */
+int trace_set_is_stitched (struct trace_set_stitch_t *stitch, tcp_session_t * session) {
+	int i;
+
+	/* A flow still followed by the stitching manager */
+	if (session_manager_find (stitch->manager, &(session->id)) != NULL)
+		return 1;
+
+	/* A flow that started before the followed flow ended, rather than a
+	 * new flow that reused the same addresses and ports later on.
+	 */
+	for (i = 0; i < stitch->stitched_count; i++) {
+		if (tcp_session_id_equals (&(stitch->stitched[i].id), &(session->id))
+		    && session->start_time <= stitch->stitched[i].end_time)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Gives the user the saved flows of a run, leaving out stitched copies.
+ */
+void trace_set_emit_run (struct trace_set_stitch_t *stitch, struct trace_set_run_t *run) {
+	tcp_session_t *session;
+
+	if (run->flows == NULL)
+		return;
+
+	while ((session = session_manager_load_session (stitch->manager, run->flows)) != NULL) {
+		if (!trace_set_is_stitched (stitch, session)) {
+			stitch->set->flow (session, stitch->set->arg);
+			stitch->flows++;
+		}
+		session_manager_discard_session (stitch->manager, session);
+	}
+}
+
+/*
+ * Reads all the traces using up to threads threads, passing every flow to
+ * the flow callback. Returns the number of flows, or -1 if a trace could
+ * not be read, in which case the flows of the other traces are still given.
+ */
+int64_t trace_set_run (trace_set_t * set, int threads) {
+	struct trace_set_run_t *runs;
+	struct trace_set_stitch_t stitch;
+	tcp_session_t *session;
+	int i, j, first = 0;
+	int error = 0;
+
+	if (set->count == 0)
+		return 0;
+	if (threads < 1)
+		threads = 1;
+	if (threads > set->count)
+		threads = set->count;
+
+	/* Split the traces into runs that differ in length by at most one */
+	runs = calloc (threads, sizeof (struct trace_set_run_t));
+	for (i = 0; i < threads; i++) {
+		runs[i].set = set;
+		runs[i].first = first;
+		runs[i].count = set->count / threads + (i < set->count % threads ? 1 : 0);
+		first += runs[i].count;
+
+		if (pthread_create (&(runs[i].thread), NULL, &trace_set_run_thread, &(runs[i])) != 0) {
+			fprintf (stderr, "Cannot start a trace set thread\n");
+			runs[i].error = 1;
+			runs[i].count = 0;
+		}
+	}
+
+	stitch.set = set;
+	stitch.stitched = NULL;
+	stitch.stitched_count = 0;
+	stitch.stitched_size = 0;
+	stitch.flows = 0;
+	stitch.splitting = 0;
+	trace_set_stitch_create (&stitch);
+
+	/* Go through the runs in order as each one finishes. The flows live
+	 * at the end of the previous run are followed through the first file
+	 * of this run, and then the run's own flows are given, leaving out
+	 * the copies of those that ended.
+	 */
+	for (i = 0; i < threads; i++) {
+		if (runs[i].count > 0)
+			pthread_join (runs[i].thread, NULL);
+
+		stitch.stitched_count = 0;
+		if (runs[i].count > 0 && session_manager_session_count (stitch.manager) > 0) {
+			if (trace_set_read (stitch.manager, set->uris[runs[i].first], 1) != 0)
+				error = 1;
+		}
+
+		/* The flows that are still followed are given as they are, and
+		 * the run's copies of those that have not ended are kept.
+		 */
+		if (session_manager_session_count (stitch.manager) > 0) {
+			stitch.splitting = 1;
+			session_manager_destroy (stitch.manager);
+			stitch.splitting = 0;
+			trace_set_stitch_create (&stitch);
+		}
+
+		trace_set_emit_run (&stitch, &(runs[i]));
+
+		/* Followed flows that are still live take precedence over the
+		 * run's copies, and copies of those that ended are dropped.
+		 */
+		if (runs[i].live != NULL && session_manager_restore_file (stitch.manager, runs[i].live) < 0)
+			error = 1;
+		for (j = 0; j < stitch.stitched_count; j++) {
+			session = session_manager_find (stitch.manager, &(stitch.stitched[j].id));
+			if (session != NULL && session->start_time <= stitch.stitched[j].end_time)
+				session_manager_drop_session (stitch.manager, session);
+		}
+
+		if (runs[i].error)
+			error = 1;
+		if (runs[i].flows != NULL)
+			fclose (runs[i].flows);
+		if (runs[i].live != NULL)
+			fclose (runs[i].live);
+	}
+
+	/* Flows still live at the end of the last trace are given as well */
+	session_manager_destroy (stitch.manager);
+
+	free (stitch.stitched);
+	free (runs);
+	return error ? -1 : stitch.flows;
+}
@@ -0,0 +1,117 @@
+/*
+ * This file is part of libtcptools
+ *
+ * Copyright (c) 2009 The University of Waikato, Hamilton, New Zealand.
+ * Authors: Brett McGirr 
+ *          Shane Alcock
+ *          
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND 
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtcptools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtcptools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtcptools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+#ifndef TRACESET_H_
+#define TRACESET_H_
+
+#include "sessionmanager.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A trace set processes many trace files, e.g. the rotated files of a day,
+ * on several threads and gives back the finished flows as if the files had
+ * been read one after another through a single session manager.
+ *
+ * The files are split into as many runs of consecutive files as there are
+ * threads, and each run is read by its own session manager. Flows that are
+ * still live at the end of a run are then carried into the next run: they
+ * are restored into a stitching manager that follows only those flows
+ * through the first file of the next run. A flow that ends there replaces
+ * the copy that the next run picked up part way through. A flow that is
+ * still live at the end of that file is split instead: the part followed
+ * so far is given, and so is the next run's copy, so the packets of that
+ * file are seen by both. Module data is carried with the snapshot format,
+ * so modules should support serialize and deserialize.
+ *
+ * Flows that see no packet for the idle timeout are expired by every
+ * manager of the set, so that flows which never close, e.g. those whose
+ * FIN was not captured, are not carried from run to run.
+ *
+ * Flows are passed to the flow callback one at a time from the thread that
+ * called trace_set_run(), run by run, so the order, and any totals worked
+ * out in the callback, are the same from one run to the next for a given
+ * list of files and number of threads.
+ */
+typedef struct trace_set_t trace_set_t;
+
+/* The default time in seconds after which idle flows expire */
+#define TRACE_SET_IDLE_TIMEOUT 600
+
+/*
+ * Creates a session manager and registers the modules. It is called once
+ * for each thread and once for stitching, possibly from several threads at
+ * once, and must register the same modules in the same order each time.
+ */
+typedef session_manager_t *(*trace_set_create_manager_t) (void *arg);
+
+/*
+ * Called with each finished flow. The session and its module data are
+ * freed when it returns.
+ */
+typedef void (*trace_set_flow_callback_t) (tcp_session_t * session, void *arg);
+
+/*
+ * Creates an empty trace set.
+ */
+trace_set_t *trace_set_create (trace_set_create_manager_t create_manager, trace_set_flow_callback_t flow, void *arg);
+
+/*
+ * Frees a trace set.
+ */
+void trace_set_destroy (trace_set_t * set);
+
+/*
+ * Adds a trace, as a libtrace URI. Traces must be added in time order.
+ */
+void trace_set_add (trace_set_t * set, const char *uri);
+
+/*
+ * Sets the time in seconds after which idle flows expire, which is
+ * TRACE_SET_IDLE_TIMEOUT by default. A timeout of 0 keeps flows until they
+ * close, which may split more of them.
+ */
+void trace_set_set_idle_timeout (trace_set_t * set, uint32_t timeout);
+
+/*
+ * Reads all the traces using up to threads threads, passing every flow to
+ * the flow callback. Returns the number of flows, or -1 if a trace could
+ * not be read, in which case the flows of the other traces are still given.
+ */
+int64_t trace_set_run (trace_set_t * set, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/*TRACESET_H_ */